@@ -0,0 +1,187 @@
+/*  Allocation check.
+
+    Renders the worlds map into a headless render window as the camera turns
+    on the spot. After a couple of turns to warm up, it checks that the next
+    turn makes no heap allocations at all - global operator new is replaced
+    to count them, and the Renderer's frame arenas must not have grown either
+    (see Renderer::get_frame_arena_allocation_count). This is done with a single
+    thread, with several (which bins triangles into tiles), and pipelined
+    (see Renderer::submit_scene).
+
+    Exits with a non-zero status if any frame after the warm up allocates. */
+
+#include "./../../src/System/RenderWindow.hpp"
+#include "./../../src/Graphics/Model.hpp"
+#include "./../../src/Graphics/Renderer.hpp"
+#include "./../../src/Resources/load_resources.hpp"
+
+#include <atomic>
+#include <cstdlib>
+#include <iostream>
+#include <new>
+#include <string>
+#include <vector>
+
+/*  The camera turns a full circle every frame_count frames, so the warm up
+    sees every frame that is then checked. */
+int frame_count = 60;
+int warm_up_frames = 2 * frame_count;
+double rotation_step = 2.0 * 3.14159265358979323846 / frame_count;
+
+/*  Heap allocations made through operator new while counting is set. */
+std::atomic<unsigned long long> allocation_count(0);
+std::atomic<bool> counting(false);
+
+void* operator new(size_t size) {
+    if (counting) {
+        allocation_count++;
+    }
+
+    void* memory = std::malloc(size == 0 ? 1 : size);
+
+    if (memory == nullptr) {
+        throw std::bad_alloc();
+    }
+
+    return memory;
+}
+
+void operator delete(void* memory) noexcept {
+    std::free(memory);
+}
+
+void operator delete(void* memory, size_t) noexcept {
+    std::free(memory);
+}
+
+/*  Render warm_up_frames and then frame_count frames of the scene, the
+    camera turning by rotation_step each frame, and report whether the
+    latter allocated. With pipelined set, each frame is submitted before the
+    one before it is waited for. */
+bool check_allocations(const std::string& name, System::RenderWindow& window,
+    Graphics::Renderer& renderer, Graphics::Scene& scene, bool pipelined) {
+    unsigned long long arena_count = 0;
+
+    for (int i = 0; i < warm_up_frames + frame_count; i++) {
+        if (i == warm_up_frames) {
+            if (pipelined) {
+                /*  The arena counts may only be read with no frames in
+                    flight. */
+                renderer.wait_frame();
+            }
+
+            arena_count = renderer.get_frame_arena_allocation_count();
+
+            allocation_count = 0;
+            counting = true;
+        }
+
+        scene.camera.rotation(1) += rotation_step;
+
+        if (!pipelined) {
+            window.clear_window();
+            renderer.render_scene(window, scene);
+            continue;
+        }
+
+        renderer.submit_scene(window, scene);
+
+        if (i != 0 && i != warm_up_frames) {
+            Graphics::copy_framebuffer(*renderer.wait_frame(), window);
+        }
+    }
+
+    if (pipelined) {
+        Graphics::copy_framebuffer(*renderer.wait_frame(), window);
+    }
+
+    counting = false;
+
+    unsigned long long arena_growth =
+        renderer.get_frame_arena_allocation_count() - arena_count;
+
+    bool passed = allocation_count == 0 && arena_growth == 0;
+
+    std::cout << name << ": " << allocation_count << " heap allocations, "
+        << arena_growth << " frame arena allocations in " << frame_count
+        << " frames - " << (passed ? "passed" : "FAILED") << "." << std::endl;
+
+    return passed;
+}
+
+int main() {
+    Resources::TrueColourBitmap* bmp =
+        Resources::load_bitmap_from_file("./../res/artisans_hub_texture.bmp");
+
+    if (bmp == nullptr) {
+        return -1;
+    }
+
+    Graphics::Mesh* test_mesh =
+        Resources::load_mesh_from_obj("./../res/test.obj");
+
+    if (test_mesh == nullptr) {
+        std::cerr << "Failed to load mesh." << std::endl;
+        return -1;
+    }
+
+    Resources::attach_texture(*test_mesh, *bmp);
+
+    System::RenderWindowOptions options;
+    options.type = System::RenderWindowType::HEADLESS;
+
+    std::unique_ptr<System::RenderWindow> window(
+        System::make_render_window("Allocations", 640, 480, options));
+
+    Graphics::Model test_model {
+        test_mesh,
+        Maths::Vector<double, 4> { 0.0, -20.0, 0.0, 1.0 },
+        Maths::Vector<double, 4> { 1.0, 1.0, 1.0, 0.0 },
+        Maths::Vector<double, 4> { 0.0, 0.0, 0.0, 0.0 }
+    };
+
+    Graphics::Scene scene {
+        std::vector<Graphics::Model*> { &test_model },
+
+        std::vector<Graphics::Light> {
+            Graphics::Light {
+                Graphics::LightType::AMBIENT,
+                0.5,
+                Maths::Vector<double, 4> { 0.0, 0.0, 0.0, 0.0 }
+            },
+
+            Graphics::Light {
+                Graphics::LightType::DIRECTION,
+                0.5,
+                Maths::Vector<double, 4> { 1.0, -2.0, -1.0, 0.0 }
+            }
+        },
+
+        Graphics::Camera {}
+    };
+
+    bool passed = true;
+
+    {
+        Graphics::Renderer renderer(45.0, 640.0 / 480.0, 1000.0);
+        passed &= check_allocations("1 thread", *window, renderer, scene,
+            false);
+    }
+
+    {
+        Graphics::Renderer renderer(45.0, 640.0 / 480.0, 1000.0, 4);
+        passed &= check_allocations("4 threads", *window, renderer, scene,
+            false);
+    }
+
+    {
+        Graphics::Renderer renderer(45.0, 640.0 / 480.0, 1000.0);
+        passed &= check_allocations("Pipelined", *window, renderer, scene,
+            true);
+    }
+
+    delete test_mesh;
+    delete bmp;
+
+    return passed ? 0 : 1;
+}
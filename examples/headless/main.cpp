@@ -0,0 +1,489 @@
+/*  Headless demo.
+
+    Renders the worlds map into a headless (memory only) render window, which
+    does not need a display. The camera turns on the spot for a fixed number
+    of frames, after which the average time taken to render a frame is
+    reported and the final frame is saved to headless.bmp.
+
+    Since nothing is blitted to the screen, this also serves as a benchmark
+    of the rendering pipeline itself. The frames are rendered with each of
+    thread_counts threads in turn, reporting the speed up over a single
+    thread, and then pipelined (see Renderer::submit_scene) with a single
+    thread, so that the geometry of each frame overlaps the rasterisation
+    of the one before.
+
+    Finally, the frames are rendered with the half-space rasteriser in each
+    precision (see RasteriserPrecision), and then into windows with each
+    depth format (see System::DepthFormat), reporting the time per frame and
+    how far the last frame is from the one rendered in double precision.
+
+    This also checks the precisions and depth formats - the last frame of
+    each must be within the bounds given below of the one rendered in double
+    precision with double depths, and the half-space rasteriser must cover
+    every pixel of a mesh exactly once (see check_coverage). If not, the
+    demo exits with a non-zero status. */
+
+#include "./../../src/System/RenderWindow.hpp"
+#include "./../../src/System/DepthBuffer.hpp"
+#include "./../../src/Graphics/Model.hpp"
+#include "./../../src/Graphics/Renderer.hpp"
+#include "./../../src/Resources/load_resources.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+int frame_count = 200;
+double rotation_step = 0.02;
+unsigned int thread_counts[] = { 1, 2, 4, 8, 16 };
+
+Graphics::RasteriserPrecision precisions[] = {
+    Graphics::RasteriserPrecision::DOUBLE,
+    Graphics::RasteriserPrecision::FLOAT,
+    Graphics::RasteriserPrecision::FIXED
+};
+
+const char* precision_names[] = { "Double", "Float", "Fixed" };
+
+/*  How far the last frame rendered in each precision may be from the one
+    rendered in double precision - at most precision_bounds of the pixels
+    may differ by more than precision_tolerances in any channel.
+
+    Float only rounds the interpolated attributes differently, so may only
+    change the odd pixel. Fixed places vertices to a sixteenth of a pixel,
+    where double (for the scanline rasteriser's sake) rounds them to whole
+    pixels. Every edge and texture coordinate therefore moves by up to half
+    a pixel - around one pixel in six changes a little, so differences of up
+    to the tolerance are allowed, and around one in a hundred more than
+    that, along edges and sharp changes in the texture. */
+int precision_tolerances[] = { 0, 16, 16 };
+double precision_bounds[] = { 0.0, 0.001, 0.02 };
+
+System::DepthFormat depth_formats[] = {
+    System::DepthFormat::DOUBLE,
+    System::DepthFormat::FLOAT32,
+    System::DepthFormat::UNORM24,
+    System::DepthFormat::UNORM16
+};
+
+const char* depth_format_names[] = {
+    "Double",
+    "32 bit float",
+    "24 bit unorm",
+    "16 bit unorm"
+};
+
+/*  The fraction of pixels of the last frame rendered with each depth format
+    that may differ at all from the one rendered with double depths.
+
+    32 bit floats keep 24 significant bits of each inverse depth, and 24 bit
+    unorms split the range up to the view plane's inverse depth into 2^24
+    steps, so only the odd pixel where two surfaces (almost) meet changes
+    which is drawn in front. 16 bit unorms have only 2^16 steps, which far
+    from the camera are coarser than the gaps between nearby surfaces, so
+    around one pixel in a hundred and fifty may change - in exchange for
+    half the depth buffer memory traffic of the 32 bit formats (see
+    System::DepthFormat). */
+double depth_format_bounds[] = { 0.0, 0.005, 0.005, 0.02 };
+
+/*  Copies the colour buffer of the window, one pixel per element. */
+std::vector<uint32_t> copy_colour_buffer(System::RenderWindow& window) {
+    System::FramebufferView view = window.lock_framebuffer();
+
+    std::vector<uint32_t> pixels;
+    pixels.reserve(view.width * view.height);
+
+    for (int y = 0; y < view.height; y++) {
+        uint32_t* row = view.colour + y * view.colour_stride;
+        pixels.insert(pixels.end(), row, row + view.width);
+    }
+
+    window.unlock_framebuffer();
+
+    return pixels;
+}
+
+/*  Report the time taken per frame, and the number of pixels differing from
+    the reference frame (in all, and by more than tolerance in any one
+    channel). Returns false if the latter is more than max_fraction of the
+    pixels. */
+bool check_accuracy(const std::string& name, double frame_time,
+    const std::vector<uint32_t>& pixels,
+    const std::vector<uint32_t>& reference, int tolerance,
+    double max_fraction) {
+    int differing_pixels = 0;
+    int outlying_pixels = 0;
+
+    for (size_t i = 0; i < pixels.size(); i++) {
+        if (pixels[i] == reference[i]) {
+            continue;
+        }
+
+        differing_pixels++;
+
+        int difference = 0;
+
+        for (int shift = 0; shift < 32; shift += 8) {
+            int a = (pixels[i] >> shift) & 0xff;
+            int b = (reference[i] >> shift) & 0xff;
+            difference = std::max(difference, std::abs(a - b));
+        }
+
+        if (difference > tolerance) {
+            outlying_pixels++;
+        }
+    }
+
+    bool passed = outlying_pixels <= max_fraction * pixels.size();
+
+    std::cout << name << ": " << frame_time << " ms per frame, "
+        << differing_pixels << " pixels differ, " << outlying_pixels
+        << " by more than " << tolerance << " (at most "
+        << (int) (max_fraction * pixels.size()) << " allowed) - "
+        << (passed ? "passed" : "FAILED") << "." << std::endl;
+
+    return passed;
+}
+
+/*  Draw a mesh of triangles sharing edges with the half-space rasteriser in
+    the given precision, checking that every pixel inside it is drawn exactly
+    once. The mesh is a grid of cells split into two triangles each, with
+    the vertices inside the grid moved at random by whole sixteenths of a
+    pixel, so that many lie exactly on pixels or have edges passing exactly
+    through them. Each triangle is drawn on its own, in a random winding
+    order, and the pixels it writes are counted. */
+bool check_coverage(const std::string& name,
+    Graphics::RasteriserPrecision precision) {
+    const int size = 64;
+    const int cells = 8;
+    const int cell_size = 7;
+    const int grid_min = (size - cells * cell_size) / 2;
+    const int grid_max = grid_min + cells * cell_size;
+    const int meshes = 50;
+
+    std::vector<uint32_t> colour(size * size);
+    System::DepthBuffer depth(size, size);
+
+    System::FramebufferView framebuffer {};
+    framebuffer.width = size;
+    framebuffer.height = size;
+    framebuffer.colour = colour.data();
+    framebuffer.colour_stride = size;
+    framebuffer.red_shift = 16;
+    framebuffer.green_shift = 8;
+    framebuffer.blue_shift = 0;
+    depth.fill_view(framebuffer);
+
+    /*  A single flat colour, with no depth test. */
+    Graphics::triangle_shading shading {};
+    shading.features = 0;
+    shading.precision = precision;
+
+    Graphics::pixel_rect scissor { 0, 0, size, size };
+
+    std::mt19937 random(1);
+    std::uniform_int_distribution<int> offset(-24, 24);
+
+    int bad_pixels = 0;
+
+    for (int m = 0; m < meshes; m++) {
+        Graphics::pixel_coord vertices[cells + 1][cells + 1];
+
+        for (int i = 0; i <= cells; i++) {
+            for (int j = 0; j <= cells; j++) {
+                Graphics::pixel_coord& vertex = vertices[i][j];
+
+                vertex = Graphics::pixel_coord {};
+                vertex.x = grid_min + i * cell_size;
+                vertex.y = grid_min + j * cell_size;
+
+                if (i > 0 && i < cells && j > 0 && j < cells) {
+                    vertex.x += offset(random) / 16.0;
+                    vertex.y += offset(random) / 16.0;
+                }
+            }
+        }
+
+        std::vector<int> counts(size * size, 0);
+
+        for (int i = 0; i < cells; i++) {
+            for (int j = 0; j < cells; j++) {
+                Graphics::pixel_coord a = vertices[i][j];
+                Graphics::pixel_coord b = vertices[i + 1][j];
+                Graphics::pixel_coord c = vertices[i + 1][j + 1];
+                Graphics::pixel_coord d = vertices[i][j + 1];
+
+                /*  Alternate the diagonal each cell is split along. */
+                Graphics::pixel_coord triangles[2][3] = {
+                    { a, b, (i + j) % 2 ? c : d },
+                    { (i + j) % 2 ? a : b, c, d }
+                };
+
+                for (Graphics::pixel_coord* points : triangles) {
+                    if (random() % 2) {
+                        std::swap(points[1], points[2]);
+                    }
+
+                    std::fill(colour.begin(), colour.end(), 0);
+
+                    Graphics::draw_shaded_triangle_half_space(framebuffer,
+                        points[0], points[1], points[2], nullptr, scissor,
+                        shading);
+
+                    for (int p = 0; p < size * size; p++) {
+                        counts[p] += colour[p] != 0;
+                    }
+                }
+            }
+        }
+
+        /*  Pixels on the edges of the grid belong to it or not by the fill
+            rule, so only need to be drawn at most once. */
+        for (int y = 0; y < size; y++) {
+            for (int x = 0; x < size; x++) {
+                bool inside = x > grid_min && x < grid_max &&
+                    y > grid_min && y < grid_max;
+                int count = counts[y * size + x];
+
+                if (count > 1 || (inside && count != 1)) {
+                    bad_pixels++;
+                }
+            }
+        }
+    }
+
+    std::cout << name << ": " << bad_pixels << " pixels of " << meshes
+        << " meshes not drawn exactly once - "
+        << (bad_pixels == 0 ? "passed" : "FAILED") << "." << std::endl;
+
+    return bad_pixels == 0;
+}
+
+int main() {
+    Resources::TrueColourBitmap* bmp =
+        Resources::load_bitmap_from_file("./../res/artisans_hub_texture.bmp");
+
+    if (bmp == nullptr) {
+        return -1;
+    }
+
+    Graphics::Mesh* test_mesh =
+        Resources::load_mesh_from_obj("./../res/test.obj");
+
+    if (test_mesh == nullptr) {
+        std::cerr << "Failed to load mesh." << std::endl;
+        return -1;
+    }
+
+    Resources::attach_texture(*test_mesh, *bmp);
+
+    System::RenderWindowOptions options;
+    options.type = System::RenderWindowType::HEADLESS;
+
+    std::unique_ptr<System::RenderWindow> window(
+        System::make_render_window("Headless", 640, 480, options));
+
+    Graphics::Model test_model {
+        test_mesh,
+        Maths::Vector<double, 4> { 0.0, -20.0, 0.0, 1.0 },
+        Maths::Vector<double, 4> { 1.0, 1.0, 1.0, 0.0 },
+        Maths::Vector<double, 4> { 0.0, 0.0, 0.0, 0.0 }
+    };
+
+    std::vector<Graphics::Light> lights {
+        Graphics::Light {
+            Graphics::LightType::AMBIENT,
+            0.5,
+            Maths::Vector<double, 4> { 0.0, 0.0, 0.0, 0.0 }
+        },
+
+        Graphics::Light {
+            Graphics::LightType::DIRECTION,
+            0.5,
+            Maths::Vector<double, 4> { 1.0, -2.0, -1.0, 0.0 }
+        }
+    };
+
+    std::cout << "Hardware threads: " << std::thread::hardware_concurrency()
+        << std::endl;
+
+    double single_thread_time = 0.0;
+
+    for (unsigned int thread_count : thread_counts) {
+        Graphics::Renderer renderer(45.0, 640.0 / 480.0, 1000.0,
+            thread_count);
+
+        Graphics::Camera camera;
+
+        auto start = std::chrono::high_resolution_clock::now();
+
+        for (int i = 0; i < frame_count; i++) {
+            window->clear_window();
+
+            camera.rotation(1) += rotation_step;
+
+            Graphics::Scene scene {
+                std::vector<Graphics::Model*> { &test_model },
+                lights,
+                camera
+            };
+
+            renderer.render_scene(*window, scene);
+
+            window->display_render_buffer();
+        }
+
+        auto end = std::chrono::high_resolution_clock::now();
+        std::chrono::duration<double, std::milli> time_diff = end - start;
+        double frame_time = time_diff.count() / frame_count;
+
+        if (thread_count == 1) {
+            single_thread_time = frame_time;
+        }
+
+        std::cout << thread_count << " threads: rendered " << frame_count
+            << " frames, " << frame_time << " ms per frame, speed up "
+            << single_thread_time / frame_time << "x." << std::endl;
+    }
+
+    {
+        Graphics::Renderer renderer(45.0, 640.0 / 480.0, 1000.0);
+
+        Graphics::Camera camera;
+
+        auto start = std::chrono::high_resolution_clock::now();
+
+        for (int i = 0; i < frame_count; i++) {
+            camera.rotation(1) += rotation_step;
+
+            Graphics::Scene scene {
+                std::vector<Graphics::Model*> { &test_model },
+                lights,
+                camera
+            };
+
+            /*  Keep one frame in flight while the previous one is
+                presented. */
+            renderer.submit_scene(*window, scene);
+
+            if (i == 0) {
+                continue;
+            }
+
+            Graphics::copy_framebuffer(*renderer.wait_frame(), *window);
+            window->display_render_buffer();
+        }
+
+        Graphics::copy_framebuffer(*renderer.wait_frame(), *window);
+        window->display_render_buffer();
+
+        auto end = std::chrono::high_resolution_clock::now();
+        std::chrono::duration<double, std::milli> time_diff = end - start;
+        double frame_time = time_diff.count() / frame_count;
+
+        std::cout << "Pipelined: rendered " << frame_count << " frames, "
+            << frame_time << " ms per frame, speed up "
+            << single_thread_time / frame_time << "x." << std::endl;
+    }
+
+    Resources::save_render_buffer_to_file(*window, "headless.bmp");
+
+    std::vector<uint32_t> reference;
+    bool passed = true;
+
+    for (int p = 0; p < 3; p++) {
+        Graphics::Renderer renderer(45.0, 640.0 / 480.0, 1000.0);
+        renderer.set_rasteriser_mode(Graphics::RasteriserMode::HALF_SPACE);
+        renderer.set_rasteriser_precision(precisions[p]);
+
+        Graphics::Camera camera;
+
+        auto start = std::chrono::high_resolution_clock::now();
+
+        for (int i = 0; i < frame_count; i++) {
+            window->clear_window();
+
+            camera.rotation(1) += rotation_step;
+
+            Graphics::Scene scene {
+                std::vector<Graphics::Model*> { &test_model },
+                lights,
+                camera
+            };
+
+            renderer.render_scene(*window, scene);
+        }
+
+        auto end = std::chrono::high_resolution_clock::now();
+        std::chrono::duration<double, std::milli> time_diff = end - start;
+        double frame_time = time_diff.count() / frame_count;
+
+        std::vector<uint32_t> pixels = copy_colour_buffer(*window);
+
+        if (p == 0) {
+            reference = pixels;
+        }
+
+        passed &= check_accuracy(
+            std::string(precision_names[p]) + " precision", frame_time,
+            pixels, reference, precision_tolerances[p], precision_bounds[p]);
+    }
+
+    for (int p = 0; p < 3; p++) {
+        passed &= check_coverage(
+            std::string(precision_names[p]) + " precision coverage",
+            precisions[p]);
+    }
+
+    for (int f = 0; f < 4; f++) {
+        System::RenderWindowOptions depth_options = options;
+        depth_options.depth_format = depth_formats[f];
+
+        std::unique_ptr<System::RenderWindow> depth_window(
+            System::make_render_window("Headless", 640, 480, depth_options));
+
+        Graphics::Renderer renderer(45.0, 640.0 / 480.0, 1000.0);
+
+        Graphics::Camera camera;
+
+        auto start = std::chrono::high_resolution_clock::now();
+
+        for (int i = 0; i < frame_count; i++) {
+            depth_window->clear_window();
+
+            camera.rotation(1) += rotation_step;
+
+            Graphics::Scene scene {
+                std::vector<Graphics::Model*> { &test_model },
+                lights,
+                camera
+            };
+
+            renderer.render_scene(*depth_window, scene);
+        }
+
+        auto end = std::chrono::high_resolution_clock::now();
+        std::chrono::duration<double, std::milli> time_diff = end - start;
+        double frame_time = time_diff.count() / frame_count;
+
+        std::vector<uint32_t> pixels = copy_colour_buffer(*depth_window);
+
+        if (f == 0) {
+            reference = pixels;
+        }
+
+        passed &= check_accuracy(
+            std::string(depth_format_names[f]) + " depths", frame_time,
+            pixels, reference, 0, depth_format_bounds[f]);
+    }
+
+    delete test_mesh;
+    delete bmp;
+
+    return passed ? 0 : 1;
+}
@@ -0,0 +1,400 @@
+/*  Span kernel benchmark.
+
+    Shades the same set of spans with every variant of every span kernel
+    supported by the CPU (see SpanKernel.hpp), and reports the average time
+    taken per pixel. The spans are drawn into an empty depth buffer, so every
+    pixel passes the depth test - this measures the cost of shading a pixel,
+    not of rejecting one. The variant with every feature is then timed with
+    each depth buffer format.
+
+    Finally, it checks that every kernel gives exactly the same output as
+    the scalar kernel, as SpanKernel.hpp and VertexKernel.hpp promise - for
+    every variant of the span kernels (see check_span_kernels) and for each
+    vertex kernel (see check_vertex_kernels). If not, it exits with a
+    non-zero status. */
+
+#include "./../../src/Graphics/SpanKernel.hpp"
+#include "./../../src/Graphics/VertexKernel.hpp"
+#include "./../../src/System/DepthBuffer.hpp"
+
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+int span_width = 640;
+int span_count = 480;
+int repetitions = 20;
+
+const char* kernel_names[] = { "scalar", "SSE2", "AVX2" };
+
+/*  FIXED precision uses the double precision variants. */
+Graphics::RasteriserPrecision precisions[] = {
+    Graphics::RasteriserPrecision::DOUBLE,
+    Graphics::RasteriserPrecision::FLOAT
+};
+
+const char* precision_names[] = { "double", "float" };
+
+const char* depth_format_names[] = {
+    "double",
+    "32 bit float",
+    "24 bit unorm",
+    "16 bit unorm"
+};
+
+std::string describe_features(unsigned int features) {
+    std::string description;
+
+    description += features & Graphics::SHADE_GOURAUD ? "gouraud " : "flat    ";
+    description += features & Graphics::SHADE_VERTEX_COLOUR ?
+        "colour " : "       ";
+    description += features & Graphics::SHADE_TEXTURE ? "texture " : "        ";
+    description += features & Graphics::SHADE_DEPTH_TEST ? "test " : "     ";
+    description += features & Graphics::SHADE_DEPTH_WRITE ? "write" : "     ";
+
+    return description;
+}
+
+/*  The average time in nanoseconds taken per pixel to shade every span with
+    shade, into buffers large enough for depths of any format. */
+double time_spans(
+    Graphics::span_function shade,
+    const Resources::TrueColourBitmap& bitmap,
+    const Graphics::pixel_coord& origin,
+    const Graphics::pixel_coord& step,
+    double depth_scale,
+    std::vector<uint32_t>& colour,
+    std::vector<double>& depth
+) {
+    std::chrono::duration<double, std::nano> time {};
+
+    for (int i = 0; i < repetitions; i++) {
+        std::fill(depth.begin(), depth.end(), 0.0);
+
+        auto start = std::chrono::high_resolution_clock::now();
+
+        for (int row = 0; row < span_count; row++) {
+            Graphics::span_input input {
+                span_width,
+                0.0,
+                origin,
+                step,
+                &bitmap,
+                0.75,
+                255.0,
+                128.0,
+                64.0
+            };
+
+            Graphics::span_output output {
+                colour.data() + row * span_width,
+                depth.data() + row * span_width,
+                depth_scale,
+                16,
+                8,
+                0
+            };
+
+            shade(input, output);
+        }
+
+        time += std::chrono::high_resolution_clock::now() - start;
+    }
+
+    return time.count() / ((double) repetitions * span_count * span_width);
+}
+
+/*  Shade the spans of the check with the variant of the current kernel for
+    features, precision and the format of depth, into colour and depth
+    buffers first filled with the same pattern. The stored depths lie on
+    either side of those of the spans, so that some pixels pass the depth
+    test and some fail it, and the spans vary in length and start so that
+    the vector kernels also finish with partial vectors. */
+void shade_check_spans(
+    unsigned int features,
+    Graphics::RasteriserPrecision precision,
+    const Resources::TrueColourBitmap& bitmap,
+    const Graphics::pixel_coord& origin,
+    const Graphics::pixel_coord& step,
+    std::vector<uint32_t>& colour,
+    System::DepthBuffer& depth
+) {
+    System::FramebufferView view {};
+    depth.fill_view(view);
+
+    for (int y = 0; y < span_count; y++) {
+        for (int x = 0; x < span_width; x++) {
+            colour[y * span_width + x] = 0x00102030 + x + y;
+            depth.write(x, y, 0.2 + 0.35 * ((x * 7 + y * 13) % 32) / 31.0);
+        }
+    }
+
+    Graphics::span_function shade = Graphics::get_span_function(features,
+        precision, view.depth_format);
+
+    for (int row = 0; row < span_count; row++) {
+        Graphics::span_input input {
+            span_width - row % 16,
+            (row % 4) * 0.25,
+            origin,
+            step,
+            &bitmap,
+            0.75,
+            255.0,
+            128.0,
+            64.0
+        };
+
+        Graphics::span_output output {
+            colour.data() + row * span_width,
+            view.depth_pixel(0, row),
+            view.depth_scale,
+            16,
+            8,
+            0
+        };
+
+        shade(input, output);
+    }
+}
+
+/*  Check every variant of every kernel supported by the CPU against the
+    scalar kernel, comparing both the colours and the (encoded) depths they
+    leave in the buffers. Returns false if any differ. */
+bool check_span_kernels(
+    Graphics::SpanKernel best,
+    const Resources::TrueColourBitmap& bitmap,
+    const Graphics::pixel_coord& origin,
+    const Graphics::pixel_coord& step
+) {
+    int failures = 0;
+    int checks = 0;
+
+    for (int format = 0; format < System::NUM_DEPTH_FORMATS; format++) {
+        System::DepthBuffer expected_depth(span_width, span_count,
+            (System::DepthFormat) format);
+        System::DepthBuffer depth(span_width, span_count,
+            (System::DepthFormat) format);
+
+        /*  The inverse depths of the spans are at most 0.5, so some are
+            clamped in the UNORM formats. */
+        expected_depth.set_max_inverse_depth(0.45);
+        depth.set_max_inverse_depth(0.45);
+
+        size_t depth_bytes = (size_t) span_width * span_count *
+            System::get_depth_format_size((System::DepthFormat) format);
+
+        for (int p = 0; p < 2; p++) {
+            for (unsigned int features = 0;
+                features < Graphics::NUM_SHADING_VARIANTS; features++) {
+                std::vector<uint32_t> expected_colour(span_width * span_count);
+                std::vector<uint32_t> colour(span_width * span_count);
+
+                Graphics::set_span_kernel(Graphics::SpanKernel::SCALAR);
+                shade_check_spans(features, precisions[p], bitmap, origin,
+                    step, expected_colour, expected_depth);
+
+                System::FramebufferView expected_view {};
+                System::FramebufferView view {};
+                expected_depth.fill_view(expected_view);
+                depth.fill_view(view);
+
+                for (int kernel = 1; kernel <= (int) best; kernel++) {
+                    Graphics::set_span_kernel((Graphics::SpanKernel) kernel);
+                    shade_check_spans(features, precisions[p], bitmap,
+                        origin, step, colour, depth);
+
+                    checks++;
+
+                    if (colour == expected_colour &&
+                        std::memcmp(view.depth, expected_view.depth,
+                            depth_bytes) == 0) {
+                        continue;
+                    }
+
+                    failures++;
+
+                    std::cout << "    " << kernel_names[kernel] << " "
+                        << precision_names[p] << " "
+                        << describe_features(features) << " "
+                        << depth_format_names[format]
+                        << " depths differ from scalar." << std::endl;
+                }
+            }
+        }
+    }
+
+    Graphics::set_span_kernel(best);
+
+    std::cout << "Span kernels: " << failures << " of " << checks
+        << " variants differ from scalar - "
+        << (failures == 0 ? "passed" : "FAILED") << "." << std::endl;
+
+    return failures == 0;
+}
+
+/*  Run every vertex kernel of each kernel supported by the CPU over the same
+    points, and check that the results are identical to the scalar kernel's.
+    The number of points is not a multiple of any vector width, so that the
+    vector kernels also finish with partial vectors. Returns false if any
+    differ. */
+bool check_vertex_kernels(Graphics::SpanKernel best) {
+    const size_t count = 1003;
+    const int attribute_count = 2;
+
+    /*  x, y, z, w, 1 / w and the attributes of each point, for each
+        kernel. */
+    const int stream_count = 5 + attribute_count;
+    std::vector<std::vector<double>> results;
+
+    Maths::Matrix<double, 4, 4> matrix;
+
+    for (int i = 0; i < 4; i++) {
+        for (int j = 0; j < 4; j++) {
+            matrix(i, j) = (i == j ? 2.0 : 0.0) + 0.1 * (i + 1) / (j + 2);
+        }
+    }
+
+    Graphics::viewport view { -1.0, 1.0, -0.75, 0.75, 640, 480, 16.0 };
+
+    int failures = 0;
+
+    for (int kernel = 0; kernel <= (int) best; kernel++) {
+        Graphics::set_span_kernel((Graphics::SpanKernel) kernel);
+
+        std::vector<double> streams(stream_count * count);
+
+        for (size_t n = 0; n < count; n++) {
+            for (int s = 0; s < stream_count; s++) {
+                streams[s * count + n] = 0.5 + ((n * 37 + s * 11) % 101) /
+                    (50.0 + s);
+            }
+        }
+
+        Graphics::point_stream points {
+            &streams[0],
+            &streams[count],
+            &streams[2 * count],
+            &streams[3 * count]
+        };
+
+        double* attributes[attribute_count] = {
+            &streams[5 * count],
+            &streams[6 * count]
+        };
+
+        Graphics::transform_points(matrix, points, points, count);
+        Graphics::project_points(points, &streams[4 * count], attributes,
+            attribute_count, count);
+        Graphics::convert_points_to_pixels(points.x, points.y, view, count);
+
+        results.push_back(streams);
+
+        if (kernel > 0 && std::memcmp(streams.data(), results[0].data(),
+            streams.size() * sizeof(double)) != 0) {
+            failures++;
+
+            std::cout << "    " << kernel_names[kernel]
+                << " vertex kernels differ from scalar." << std::endl;
+        }
+    }
+
+    Graphics::set_span_kernel(best);
+
+    std::cout << "Vertex kernels: " << failures << " of " << (int) best
+        << " kernels differ from scalar - "
+        << (failures == 0 ? "passed" : "FAILED") << "." << std::endl;
+
+    return failures == 0;
+}
+
+int main() {
+    /*  A checkerboard texture. */
+    Resources::TrueColourBitmap bitmap { 256, 256, {} };
+
+    for (int y = 0; y < bitmap.height; y++) {
+        for (int x = 0; x < bitmap.width; x++) {
+            uint8_t value = ((x / 32 + y / 32) % 2) ? 255 : 64;
+            bitmap.pixels.push_back(Resources::RGBAPixel {
+                255,
+                value,
+                value,
+                value
+            });
+        }
+    }
+
+    std::vector<uint32_t> colour(span_width * span_count);
+    std::vector<double> depth(span_width * span_count);
+
+    /*  Attributes divided by depth across a span receding from z = 2 to
+        z = 4. */
+    Graphics::pixel_coord origin {
+        0.0, 0.0,
+        0.5,
+        0.5 * 0.2,
+        0.5 * 255.0,
+        0.5 * 128.0,
+        0.5 * 64.0,
+        0.0,
+        0.0
+    };
+
+    Graphics::pixel_coord step {
+        1.0, 0.0,
+        -0.25 / span_width,
+        0.25 * 0.8 / span_width,
+        -0.25 * 255.0 / span_width,
+        0.25 * 128.0 / span_width,
+        0.25 * 192.0 / span_width,
+        0.25 / span_width,
+        0.25 / span_width
+    };
+
+    Graphics::SpanKernel best = Graphics::detect_span_kernel();
+
+    for (int kernel = 0; kernel <= (int) best; kernel++) {
+        Graphics::set_span_kernel((Graphics::SpanKernel) kernel);
+
+        std::cout << kernel_names[kernel] << " kernel:" << std::endl;
+
+        for (unsigned int features = 0;
+            features < Graphics::NUM_SHADING_VARIANTS; features++) {
+            Graphics::span_function shade =
+                Graphics::get_span_function(features);
+
+            double pixel_time = time_spans(shade, bitmap, origin, step, 1.0,
+                colour, depth);
+
+            std::cout << "    " << describe_features(features) << "  "
+                << pixel_time << " ns per pixel" << std::endl;
+        }
+
+        for (int format = 0; format < System::NUM_DEPTH_FORMATS; format++) {
+            /*  The inverse depths of the spans are at most 0.5. */
+            double max_depth = (System::DepthFormat) format ==
+                System::DepthFormat::UNORM16 ? System::UNORM16_DEPTH_MAX :
+                System::UNORM24_DEPTH_MAX;
+            double depth_scale = max_depth / 0.5;
+
+            Graphics::span_function shade = Graphics::get_span_function(
+                Graphics::SHADE_ALL,
+                Graphics::RasteriserPrecision::DOUBLE,
+                (System::DepthFormat) format
+            );
+
+            double pixel_time = time_spans(shade, bitmap, origin, step,
+                depth_scale, colour, depth);
+
+            std::cout << "    all features, " << depth_format_names[format]
+                << " depths  " << pixel_time << " ns per pixel" << std::endl;
+        }
+    }
+
+    bool passed = check_span_kernels(best, bitmap, origin, step);
+    passed &= check_vertex_kernels(best);
+
+    return passed ? 0 : 1;
+}
@@ -34,9 +34,13 @@ int main() {
     int bmp_x = 32;
     int bmp_y = 48;
 
-    /*  pixels[num_pixels]Create window. */
+    /*  pixels[num_pixels]Create window. Use double buffering, so that each
+        frame is drawn while the previous one is being displayed. */
+    System::RenderWindowOptions options;
+    options.buffer_count = 2;
+
     std::unique_ptr<System::RenderWindow> window(
-        System::make_render_window("Worlds", 640, 480));
+        System::make_render_window("Worlds", 640, 480, options));
 
     Graphics::Mesh* test_mesh =
         Resources::load_mesh_from_obj("./../res/test.obj");
@@ -55,6 +59,9 @@ int main() {
         Maths::Vector<double, 4> { 0.0, 0.0, 0.0, 0.0 }
     };
 
+    /*  The level never moves, so bake its vertices into world space once. */
+    test_model.is_static = true;
+
     std::vector<Graphics::Light> lights {
         Graphics::Light {
             Graphics::LightType::AMBIENT,
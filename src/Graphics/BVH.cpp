@@ -0,0 +1,214 @@
+/*  BVH.cpp
+
+    Implements the bounding volume hierarchy. */
+
+#include "BVH.hpp"
+#include <algorithm>
+#include <cmath>
+
+namespace Graphics {
+
+bounding_box merge_boxes(const bounding_box& lhs, const bounding_box& rhs) {
+    bounding_box res { lhs.min, lhs.max };
+
+    for (int i = 0; i < 3; i++) {
+        res.min(i) = std::min(lhs.min(i), rhs.min(i));
+        res.max(i) = std::max(lhs.max(i), rhs.max(i));
+    }
+
+    return res;
+}
+
+bounding_box transform_box(
+    const Maths::Matrix<double, 4, 4>& transform,
+    const bounding_box& box
+) {
+    /*  Each coordinate of the transformed box is the sum over the columns of
+        the transform of whichever of the box's bounds minimises (or
+        maximises) that term. */
+    bounding_box res {
+        { transform(0, 3), transform(1, 3), transform(2, 3), 1.0 },
+        { transform(0, 3), transform(1, 3), transform(2, 3), 1.0 }
+    };
+
+    for (int i = 0; i < 3; i++) {
+        for (int j = 0; j < 3; j++) {
+            double a = transform(i, j) * box.min(j);
+            double b = transform(i, j) * box.max(j);
+
+            res.min(i) += std::min(a, b);
+            res.max(i) += std::max(a, b);
+        }
+    }
+
+    return res;
+}
+
+void BVH::build(const bounding_box* boxes, int count, int max_leaf_items) {
+    this->nodes.clear();
+    this->item_order.resize(count);
+    this->item_boxes.assign(boxes, boxes + count);
+    this->item_leaves.resize(count);
+
+    for (int i = 0; i < count; i++) {
+        this->item_order[i] = i;
+    }
+
+    if (count > 0) {
+        this->nodes.reserve(2 * count);
+        this->build_node(-1, 0, count, std::max(max_leaf_items, 1));
+    }
+}
+
+int BVH::build_node(int parent, int first_item, int item_count,
+    int max_leaf_items) {
+    int index = this->nodes.size();
+    this->nodes.push_back(node { {}, parent, -1, first_item, item_count });
+
+    int* items = this->item_order.data() + first_item;
+
+    if (item_count <= max_leaf_items) {
+        for (int i = 0; i < item_count; i++) {
+            this->item_leaves[items[i]] = index;
+        }
+
+        this->update_node_box(index);
+        return index;
+    }
+
+    /*  Split along the longest axis of the bounds of the items' centres (the
+        sums of their corners - halving makes no difference to the order). */
+    Maths::Vector<double, 4> centre_min {};
+    Maths::Vector<double, 4> centre_max {};
+
+    for (int i = 0; i < item_count; i++) {
+        const bounding_box& box = this->item_boxes[items[i]];
+        Maths::Vector<double, 4> centre = box.min + box.max;
+
+        for (int j = 0; j < 3; j++) {
+            centre_min(j) = i == 0 ? centre(j) :
+                std::min(centre_min(j), centre(j));
+            centre_max(j) = i == 0 ? centre(j) :
+                std::max(centre_max(j), centre(j));
+        }
+    }
+
+    int axis = 0;
+
+    for (int j = 1; j < 3; j++) {
+        if (centre_max(j) - centre_min(j) >
+            centre_max(axis) - centre_min(axis)) {
+            axis = j;
+        }
+    }
+
+    int half = item_count / 2;
+
+    std::nth_element(items, items + half, items + item_count,
+        [this, axis](int lhs, int rhs) {
+            double lhs_centre = this->item_boxes[lhs].min(axis) +
+                this->item_boxes[lhs].max(axis);
+            double rhs_centre = this->item_boxes[rhs].min(axis) +
+                this->item_boxes[rhs].max(axis);
+
+            return lhs_centre < rhs_centre ||
+                (lhs_centre == rhs_centre && lhs < rhs);
+        }
+    );
+
+    this->build_node(index, first_item, half, max_leaf_items);
+    int right = this->build_node(index, first_item + half, item_count - half,
+        max_leaf_items);
+
+    this->nodes[index].right = right;
+    this->update_node_box(index);
+
+    return index;
+}
+
+void BVH::update_node_box(int index) {
+    node& n = this->nodes[index];
+
+    if (n.right >= 0) {
+        n.box = merge_boxes(this->nodes[index + 1].box,
+            this->nodes[n.right].box);
+        return;
+    }
+
+    n.box = this->item_boxes[this->item_order[n.first_item]];
+
+    for (int i = 1; i < n.item_count; i++) {
+        n.box = merge_boxes(n.box,
+            this->item_boxes[this->item_order[n.first_item + i]]);
+    }
+}
+
+void BVH::refit(int item, const bounding_box& box) {
+    this->item_boxes[item] = box;
+
+    for (int index = this->item_leaves[item]; index >= 0;
+        index = this->nodes[index].parent) {
+        this->update_node_box(index);
+    }
+}
+
+int BVH::get_item_count() const {
+    return this->item_boxes.size();
+}
+
+const bounding_box& BVH::get_item_box(int item) const {
+    return this->item_boxes[item];
+}
+
+bool BVH::intersect_ray(
+    const Maths::Vector<double, 4>& origin,
+    const Maths::Vector<double, 4>& direction,
+    double max_t,
+    const bounding_box& box,
+    double& t
+) {
+    /*  Slab test - the ray is in the box where it is between the planes of
+        each pair of opposite faces. */
+    double t_enter = 0.0;
+    double t_exit = max_t;
+
+    for (int i = 0; i < 3; i++) {
+        if (direction(i) == 0.0) {
+            if (origin(i) < box.min(i) || origin(i) > box.max(i)) {
+                return false;
+            }
+
+            continue;
+        }
+
+        double t_min = (box.min(i) - origin(i)) / direction(i);
+        double t_max = (box.max(i) - origin(i)) / direction(i);
+
+        if (t_min > t_max) {
+            std::swap(t_min, t_max);
+        }
+
+        t_enter = std::max(t_enter, t_min);
+        t_exit = std::min(t_exit, t_max);
+
+        if (t_enter > t_exit) {
+            return false;
+        }
+    }
+
+    t = t_enter;
+
+    return true;
+}
+
+bool BVH::overlap(const bounding_box& lhs, const bounding_box& rhs) {
+    for (int i = 0; i < 3; i++) {
+        if (lhs.max(i) < rhs.min(i) || rhs.max(i) < lhs.min(i)) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+}
@@ -0,0 +1,228 @@
+/*  BVH.hpp
+
+    A bounding volume hierarchy - a binary tree of axis aligned bounding
+    boxes over a set of items (e.g. the models of a scene, or the triangle
+    clusters of a mesh), each of which has a box of its own. Queries test the
+    boxes of the tree from the root down and skip a whole subtree as soon as
+    its box fails the test, so finding the items that may be visible, that a
+    ray may hit or that overlap a box costs roughly in proportion to the
+    number of items found rather than the number of items in the tree.
+
+    The tree is built top down, splitting the items at the median of their
+    centres along the longest axis of the centres' bounds. When an item moves
+    its box is refitted, which updates the boxes of the nodes above it without
+    changing the shape of the tree - cheap, but the tree gets looser as items
+    move further from where they were when it was built, so it should be
+    rebuilt after large changes. */
+
+#ifndef BVH_HPP
+#define BVH_HPP
+
+#include "./../Maths/Matrix.hpp"
+#include "./../Maths/Vector.hpp"
+
+#include <vector>
+
+namespace Graphics {
+
+/*  Axis aligned box - the points with min(i) <= p(i) <= max(i) for i < 3.
+    w is 1 for both corners. */
+struct bounding_box {
+    Maths::Vector<double, 4> min;
+    Maths::Vector<double, 4> max;
+};
+
+/*  The smallest box containing both boxes. */
+bounding_box merge_boxes(const bounding_box& lhs, const bounding_box& rhs);
+
+/*  The smallest axis aligned box containing box after an affine transform. */
+bounding_box transform_box(
+    const Maths::Matrix<double, 4, 4>& transform,
+    const bounding_box& box
+);
+
+/*  Where a box lies relative to a region of space (e.g. the view frustum). */
+enum class Containment {
+    OUTSIDE,
+    CROSSING,
+    INSIDE
+};
+
+class BVH {
+    public:
+        /*  (Re)build the hierarchy over count items, the box of item n being
+            boxes[n]. Leaves hold at most max_leaf_items items. */
+        void build(const bounding_box* boxes, int count,
+            int max_leaf_items = 1);
+
+        /*  Set the box of an item, updating the boxes of the nodes above it
+            to match. */
+        void refit(int item, const bounding_box& box);
+
+        int get_item_count() const;
+
+        const bounding_box& get_item_box(int item) const;
+
+        /*  Call visit(items, count) with the items of each leaf in turn. */
+        template <typename F>
+        void for_each_leaf(const F& visit) const {
+            for (const node& n : this->nodes) {
+                if (n.right < 0) {
+                    visit(this->item_order.data() + n.first_item,
+                        n.item_count);
+                }
+            }
+        }
+
+        /*  Find the items in a convex region - classify(box) returns whether
+            a box is inside, outside or crossing the boundary of the region.
+            visit(item, inside) is called for each item whose box is not
+            outside of the region, with inside true if it is entirely inside.
+            Subtrees outside of the region are skipped, and subtrees inside of
+            it are visited without classifying their boxes. */
+        template <typename C, typename F>
+        void query(const C& classify, const F& visit) const {
+            if (this->nodes.empty()) {
+                return;
+            }
+
+            int stack[MAX_DEPTH];
+            int stack_size = 0;
+            int current = 0;
+
+            while (true) {
+                const node& n = this->nodes[current];
+                Containment containment = classify(n.box);
+
+                if (containment == Containment::INSIDE) {
+                    this->visit_subtree(current, visit);
+                } else if (containment == Containment::CROSSING) {
+                    if (n.right >= 0) {
+                        stack[stack_size++] = n.right;
+                        current = current + 1;
+                        continue;
+                    }
+
+                    for (int i = 0; i < n.item_count; i++) {
+                        int item = this->item_order[n.first_item + i];
+                        Containment item_containment = n.item_count == 1 ?
+                            containment : classify(this->item_boxes[item]);
+
+                        if (item_containment != Containment::OUTSIDE) {
+                            visit(item,
+                                item_containment == Containment::INSIDE);
+                        }
+                    }
+                }
+
+                if (stack_size == 0) {
+                    return;
+                }
+
+                current = stack[--stack_size];
+            }
+        }
+
+        /*  Call visit(item, t) for each item whose box is hit by the ray
+            origin + t * direction with 0 <= t <= max_t, t being where the ray
+            enters the box (0 if the origin is inside it). Items are visited
+            in no particular order. */
+        template <typename F>
+        void query_ray(
+            const Maths::Vector<double, 4>& origin,
+            const Maths::Vector<double, 4>& direction,
+            double max_t,
+            const F& visit
+        ) const {
+            this->query(
+                [&](const bounding_box& box) {
+                    double t;
+
+                    return intersect_ray(origin, direction, max_t, box, t) ?
+                        Containment::CROSSING : Containment::OUTSIDE;
+                },
+                [&](int item, bool) {
+                    double t;
+
+                    if (intersect_ray(origin, direction, max_t,
+                        this->item_boxes[item], t)) {
+                        visit(item, t);
+                    }
+                }
+            );
+        }
+
+        /*  Call visit(item) for each item whose box overlaps box. */
+        template <typename F>
+        void query_box(const bounding_box& box, const F& visit) const {
+            this->query(
+                [&](const bounding_box& node_box) {
+                    return overlap(box, node_box) ?
+                        Containment::CROSSING : Containment::OUTSIDE;
+                },
+                [&](int item, bool) {
+                    visit(item);
+                }
+            );
+        }
+
+    private:
+        struct node {
+            bounding_box box;
+            int parent;
+
+            /*  The first child of an internal node immediately follows it,
+                and right is the index of the second. -1 for leaves. */
+            int right;
+
+            /*  The items of the leaves of the node's subtree are the
+                item_count items of item_order from first_item onwards. */
+            int first_item;
+            int item_count;
+        };
+
+        /*  The tree is split at the median, so is balanced - its depth is
+            at most about log2 of the item count. */
+        static constexpr int MAX_DEPTH = 64;
+
+        int build_node(int parent, int first_item, int item_count,
+            int max_leaf_items);
+
+        void update_node_box(int index);
+
+        template <typename F>
+        void visit_subtree(int index, const F& visit) const {
+            const node& n = this->nodes[index];
+            int first_item = n.first_item;
+            int end_item = n.first_item + n.item_count;
+
+            for (int i = first_item; i < end_item; i++) {
+                visit(this->item_order[i], true);
+            }
+        }
+
+        static bool intersect_ray(
+            const Maths::Vector<double, 4>& origin,
+            const Maths::Vector<double, 4>& direction,
+            double max_t,
+            const bounding_box& box,
+            double& t
+        );
+
+        static bool overlap(const bounding_box& lhs, const bounding_box& rhs);
+
+        /*  Nodes in depth first order, the root first. */
+        std::vector<node> nodes;
+
+        /*  Items in the order of the leaves holding them. */
+        std::vector<int> item_order;
+
+        std::vector<bounding_box> item_boxes;
+
+        /*  The leaf holding each item. */
+        std::vector<int> item_leaves;
+};
+
+}
+
+#endif
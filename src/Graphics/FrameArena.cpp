@@ -0,0 +1,89 @@
+/*  FrameArena.cpp */
+
+#include "FrameArena.hpp"
+#include <algorithm>
+#include <cstdint>
+
+namespace Graphics {
+
+FrameArena::FrameArena(size_t initial_capacity) {
+    this->add_block(initial_capacity > 0 ? initial_capacity : 1);
+}
+
+void* FrameArena::allocate(size_t bytes, size_t alignment) {
+    Block* block = &this->blocks.back();
+
+    uintptr_t base = (uintptr_t) block->memory.get();
+    uintptr_t start = (base + this->offset + alignment - 1) &
+        ~(uintptr_t) (alignment - 1);
+
+    if (start + bytes > base + block->size) {
+        /*  Grow geometrically, so that a frame needs few extra blocks. */
+        size_t size = std::max(bytes + alignment, block->size * 2);
+        this->add_block(size);
+
+        block = &this->blocks.back();
+        base = (uintptr_t) block->memory.get();
+        start = (base + alignment - 1) & ~(uintptr_t) (alignment - 1);
+    }
+
+    this->used += start + bytes - (base + this->offset);
+    this->offset = start + bytes - base;
+
+    return (void*) start;
+}
+
+void FrameArena::reset() {
+    if (this->blocks.size() > 1) {
+        /*  Replace all of the blocks with one that could have held the whole
+            of the last frame. */
+        size_t capacity = this->get_capacity();
+
+        this->blocks.clear();
+        this->add_block(capacity);
+    }
+
+    this->offset = 0;
+    this->used = 0;
+}
+
+void FrameArena::reserve(size_t capacity) {
+    size_t current = this->get_capacity();
+
+    if (current < capacity) {
+        /*  Grow geometrically, so that a slowly growing workload does not
+            reallocate every frame. */
+        this->blocks.clear();
+        this->add_block(std::max(capacity, current * 2));
+    }
+}
+
+size_t FrameArena::get_capacity() {
+    size_t capacity = 0;
+
+    for (const Block& block : this->blocks) {
+        capacity += block.size;
+    }
+
+    return capacity;
+}
+
+size_t FrameArena::get_used() {
+    return this->used;
+}
+
+unsigned long long FrameArena::get_heap_allocation_count() {
+    return this->heap_allocation_count;
+}
+
+void FrameArena::add_block(size_t size) {
+    this->blocks.push_back(Block {
+        std::unique_ptr<unsigned char[]>(new unsigned char[size]),
+        size
+    });
+
+    this->offset = 0;
+    this->heap_allocation_count ++;
+}
+
+}
@@ -0,0 +1,124 @@
+/*  FrameArena.hpp
+
+    A linear ("bump") allocator for storage that only lives for one frame -
+    e.g. the Renderer's transformed and clipped triangles. Allocating is just
+    a matter of advancing an offset into a block of memory, individual
+    allocations are never freed, and everything is released at once by reset
+    at the start of the next frame.
+
+    Memory is retained across resets. If a frame needs more than the arena
+    holds, further blocks are allocated from the heap and, at the next reset,
+    replaced by a single block large enough for the whole frame. Hence, once
+    the workload stops growing, frames make no heap allocations at all. */
+
+#ifndef FRAME_ARENA_HPP
+#define FRAME_ARENA_HPP
+
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+namespace Graphics {
+
+class FrameArena {
+    public:
+        FrameArena() = delete;
+
+        explicit FrameArena(size_t initial_capacity);
+
+        /*  The arena owns the memory handed out from it, so it is neither
+            copyable nor movable. */
+        FrameArena(FrameArena &)              = delete;
+        FrameArena(FrameArena &&)             = delete;
+        FrameArena& operator=(FrameArena &)   = delete;
+        FrameArena&& operator=(FrameArena &&) = delete;
+
+        /*  Allocate bytes with the given alignment (a power of two). The
+            memory remains valid until the next call to reset. */
+        void* allocate(size_t bytes, size_t alignment);
+
+        template <typename T>
+        T* allocate_array(size_t count) {
+            return static_cast<T*>(this->allocate(count * sizeof(T),
+                alignof(T)));
+        }
+
+        /*  Release everything allocated since the last reset. This is O(1)
+            unless the arena had to grow during the frame. */
+        void reset();
+
+        /*  Ensure that the arena can hold at least capacity bytes without
+            growing (it may be given more). Only to be called straight after
+            reset. */
+        void reserve(size_t capacity);
+
+        /*  Total bytes the arena can hold without growing. */
+        size_t get_capacity();
+
+        /*  Bytes allocated since the last reset, including any padding for
+            alignment. */
+        size_t get_used();
+
+        /*  Number of blocks allocated from the heap over the lifetime of the
+            arena. This stays constant in the steady state, so can be used to
+            check that frames do not allocate. */
+        unsigned long long get_heap_allocation_count();
+
+    private:
+        struct Block {
+            std::unique_ptr<unsigned char[]> memory;
+            size_t size;
+        };
+
+        void add_block(size_t size);
+
+        /*  blocks[0] is the main block. Any others were added when a frame
+            overflowed it, and are merged into it on the next reset. */
+        std::vector<Block> blocks;
+        size_t offset = 0;
+        size_t used = 0;
+
+        unsigned long long heap_allocation_count = 0;
+};
+
+/*  Standard library allocator drawing from a FrameArena, so that containers
+    (see ArenaVector) can be used for per-frame storage. Deallocation does
+    nothing - the memory is reclaimed when the arena is reset. Containers
+    using it must therefore be destroyed before the arena is reset. */
+template <typename T>
+class ArenaAllocator {
+    public:
+        using value_type = T;
+
+        ArenaAllocator(FrameArena& arena) : arena{&arena} {}
+
+        template <typename U>
+        ArenaAllocator(const ArenaAllocator<U>& other) : arena{other.arena} {}
+
+        T* allocate(size_t count) {
+            return this->arena->template allocate_array<T>(count);
+        }
+
+        void deallocate(T*, size_t) {}
+
+        template <typename U>
+        bool operator==(const ArenaAllocator<U>& other) const {
+            return this->arena == other.arena;
+        }
+
+        template <typename U>
+        bool operator!=(const ArenaAllocator<U>& other) const {
+            return this->arena != other.arena;
+        }
+
+        /*  Public so that allocators of other types can be made from this
+            one. */
+        FrameArena* arena;
+};
+
+template <typename T>
+using ArenaVector = std::vector<T, ArenaAllocator<T>>;
+
+}
+
+#endif
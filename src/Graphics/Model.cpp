@@ -2,23 +2,335 @@
 
 #include "Model.hpp"
 #include "./../Maths/Transform.hpp"
+#include <algorithm>
+#include <cmath>
 
 namespace Graphics {
 
-Maths::Matrix<double, 4, 4> model_transform(const Model& model) {
-    return Maths::make_translation(
-        model.position(0),
-        model.position(1),
-        model.position(2)
-    ) * Maths::make_rotation_model(
+void compute_mesh_bounds(Mesh& mesh) {
+    mesh.version ++;
+
+    if (mesh.vertices.empty()) {
+        mesh.bounds = {
+            { 0.0, 0.0, 0.0, 1.0 },
+            { 0.0, 0.0, 0.0, 1.0 }
+        };
+        mesh.bounds_centre = { 0.0, 0.0, 0.0, 1.0 };
+        mesh.bounds_radius = 0.0;
+        return;
+    }
+
+    mesh.bounds = { mesh.vertices[0].pos, mesh.vertices[0].pos };
+
+    for (const Vertex& v : mesh.vertices) {
+        mesh.bounds = merge_boxes(mesh.bounds, { v.pos, v.pos });
+    }
+
+    mesh.bounds_centre = 0.5 * (mesh.bounds.min + mesh.bounds.max);
+    mesh.bounds_radius = 0.0;
+
+    /*  The sphere about the centre of the box through its furthest vertex -
+        tighter than the sphere through the corners of the box. */
+    for (const Vertex& v : mesh.vertices) {
+        Maths::Vector<double, 4> offset = v.pos - mesh.bounds_centre;
+
+        mesh.bounds_radius = std::max(
+            mesh.bounds_radius,
+            std::sqrt(Maths::dot(offset, offset))
+        );
+    }
+}
+
+void compute_face_normals(Mesh& mesh) {
+    size_t triangle_count = mesh.get_triangle_count();
+
+    mesh.face_normals.resize(triangle_count);
+
+    for (size_t t = 0; t < triangle_count; t++) {
+        const Maths::Vector<double, 4>& p0 =
+            mesh.vertices[mesh.indices[t * 3]].pos;
+        const Maths::Vector<double, 4>& p1 =
+            mesh.vertices[mesh.indices[t * 3 + 1]].pos;
+        const Maths::Vector<double, 4>& p2 =
+            mesh.vertices[mesh.indices[t * 3 + 2]].pos;
+
+        Maths::Vector<double, 4> normal = Maths::cross(p1 - p0, p2 - p0);
+
+        /*  Degenerate faces are left with a zero normal. */
+        if (Maths::dot(normal, normal) > 0.0) {
+            normal = Maths::normalise(normal);
+        }
+
+        mesh.face_normals[t] = normal;
+    }
+}
+
+/*  Compute the bounding sphere and normal cone of a cluster of a mesh whose
+    vertices, indices and face normals have been filled in. */
+static void compute_cluster_bounds(MeshCluster& cluster, const Mesh& mesh) {
+    cluster.centre = 0.5 * (cluster.bounds.min + cluster.bounds.max);
+    cluster.radius = 0.0;
+
+    for (int n = 0; n < cluster.vertex_count; n++) {
+        Maths::Vector<double, 4> offset =
+            mesh.vertices[cluster.first_vertex + n].pos - cluster.centre;
+
+        cluster.radius = std::max(
+            cluster.radius,
+            std::sqrt(Maths::dot(offset, offset))
+        );
+    }
+
+    /*  The cone axis is the mean of the unit face normals, and the angle
+        that of the face normal furthest from it. Degenerate faces have no
+        normal, and cannot be seen, so are ignored. */
+    int first_face = cluster.first_index / 3;
+    int face_count = cluster.index_count / 3;
+    Maths::Vector<double, 4> axis { 0.0, 0.0, 0.0, 0.0 };
+
+    for (int f = first_face; f < first_face + face_count; f++) {
+        Maths::Vector<double, 4> normal = mesh.face_normals[f];
+        axis += normal;
+    }
+
+    cluster.cone_axis = { 0.0, 0.0, 0.0, 0.0 };
+    cluster.cone_angle = MESH_CLUSTER_NO_CONE;
+
+    if (Maths::dot(axis, axis) == 0.0) {
+        return;
+    }
+
+    cluster.cone_axis = Maths::normalise(axis);
+
+    double min_cos = 1.0;
+
+    for (int f = first_face; f < first_face + face_count; f++) {
+        const Maths::Vector<double, 4>& normal = mesh.face_normals[f];
+
+        if (Maths::dot(normal, normal) > 0.0) {
+            min_cos = std::min(min_cos, Maths::dot(normal, cluster.cone_axis));
+        }
+    }
+
+    /*  A cone at least 90 degrees wide never faces entirely away. */
+    if (min_cos > 0.0) {
+        cluster.cone_angle = std::acos(std::min(min_cos, 1.0));
+    }
+}
+
+void build_mesh_clusters(Mesh& mesh) {
+    int triangle_count = mesh.get_triangle_count();
+
+    mesh.version ++;
+
+    /*  Split the triangles by the bounds of their vertices - the leaves of a
+        hierarchy over the triangles are the clusters. */
+    std::vector<bounding_box> triangle_bounds(triangle_count);
+
+    for (int t = 0; t < triangle_count; t++) {
+        const Maths::Vector<double, 4>& p0 =
+            mesh.vertices[mesh.indices[t * 3]].pos;
+        const Maths::Vector<double, 4>& p1 =
+            mesh.vertices[mesh.indices[t * 3 + 1]].pos;
+        const Maths::Vector<double, 4>& p2 =
+            mesh.vertices[mesh.indices[t * 3 + 2]].pos;
+
+        triangle_bounds[t] = merge_boxes(
+            merge_boxes({ p0, p0 }, { p1, p1 }),
+            { p2, p2 }
+        );
+    }
+
+    BVH triangle_bvh;
+    triangle_bvh.build(
+        triangle_bounds.data(),
+        triangle_count,
+        MESH_CLUSTER_TRIANGLES
+    );
+
+    /*  Copy the vertices of each cluster in order of first use, noting the
+        index of each vertex's copy within the current cluster. */
+    std::vector<Vertex> vertices;
+    std::vector<int> indices;
+    std::vector<int> cluster_vertex(mesh.vertices.size(), -1);
+
+    vertices.reserve(mesh.vertices.size());
+    indices.reserve(triangle_count * 3);
+    mesh.clusters.clear();
+
+    triangle_bvh.for_each_leaf([&](const int* triangles, int count) {
+        MeshCluster cluster {};
+
+        cluster.first_index = indices.size();
+        cluster.first_vertex = vertices.size();
+        cluster.bounds = triangle_bounds[triangles[0]];
+
+        for (int i = 0; i < count; i++) {
+            int t = triangles[i];
+
+            for (int k = 0; k < 3; k++) {
+                int vertex = mesh.indices[t * 3 + k];
+
+                if (cluster_vertex[vertex] < 0) {
+                    cluster_vertex[vertex] = vertices.size();
+                    vertices.push_back(mesh.vertices[vertex]);
+                }
+
+                indices.push_back(cluster_vertex[vertex]);
+            }
+
+            cluster.bounds = merge_boxes(cluster.bounds, triangle_bounds[t]);
+        }
+
+        cluster.index_count = indices.size() - cluster.first_index;
+        cluster.vertex_count = vertices.size() - cluster.first_vertex;
+
+        for (int i = 0; i < count; i++) {
+            for (int k = 0; k < 3; k++) {
+                cluster_vertex[mesh.indices[triangles[i] * 3 + k]] = -1;
+            }
+        }
+
+        mesh.clusters.push_back(cluster);
+    });
+
+    mesh.vertices = std::move(vertices);
+    mesh.indices = std::move(indices);
+
+    compute_face_normals(mesh);
+
+    std::vector<bounding_box> cluster_bounds;
+
+    for (MeshCluster& cluster : mesh.clusters) {
+        compute_cluster_bounds(cluster, mesh);
+        cluster_bounds.push_back(cluster.bounds);
+    }
+
+    mesh.cluster_bvh.build(cluster_bounds.data(), cluster_bounds.size());
+}
+
+bounding_box get_model_bounds(const Model& model) {
+    return transform_box(model_transform(model), model.mesh->bounds);
+}
+
+const model_matrices& get_model_matrices(const Model& model) {
+    model_matrices& matrices = model.matrices;
+
+    if (matrices.valid &&
+        matrices.position == model.position &&
+        matrices.rotation == model.rotation &&
+        matrices.scale == model.scale) {
+        return matrices;
+    }
+
+    Maths::Matrix<double, 4, 4> rotation = Maths::make_rotation_model(
         model.rotation(0),
         model.rotation(1),
         model.rotation(2)
-    ) * Maths::make_enlargement(
+    );
+    Maths::Matrix<double, 4, 4> inverse_scale = Maths::make_enlargement(
+        1.0 / model.scale(0),
+        1.0 / model.scale(1),
+        1.0 / model.scale(2)
+    );
+
+    /*  Rotations are orthogonal, so are inverted by transposing. */
+    Maths::Matrix<double, 4, 4> inverse_rotation = rotation;
+
+    for (int i = 0; i < 3; i++) {
+        for (int j = 0; j < 3; j++) {
+            inverse_rotation(i, j) = rotation(j, i);
+        }
+    }
+
+    matrices.model = Maths::make_translation(
+        model.position(0),
+        model.position(1),
+        model.position(2)
+    ) * rotation * Maths::make_enlargement(
         model.scale(0),
         model.scale(1),
         model.scale(2)
     );
+    matrices.normal = rotation * inverse_scale;
+    matrices.inverse = inverse_scale * inverse_rotation *
+        Maths::make_translation(
+            -model.position(0),
+            -model.position(1),
+            -model.position(2)
+        );
+
+    matrices.position = model.position;
+    matrices.rotation = model.rotation;
+    matrices.scale = model.scale;
+    matrices.valid = true;
+    matrices.view_generation = 0;
+
+    return matrices;
+}
+
+const world_vertices& get_world_vertices(const Model& model) {
+    world_vertices& cache = model.world_cache;
+    const Mesh& mesh = *model.mesh;
+
+    if (cache.valid &&
+        cache.mesh == &mesh &&
+        cache.mesh_version == mesh.version &&
+        cache.position == model.position &&
+        cache.rotation == model.rotation &&
+        cache.scale == model.scale) {
+        return cache;
+    }
+
+    const model_matrices& matrices = get_model_matrices(model);
+    size_t count = mesh.vertices.size();
+
+    cache.x.resize(count);
+    cache.y.resize(count);
+    cache.z.resize(count);
+    cache.normal_x.resize(count);
+    cache.normal_y.resize(count);
+    cache.normal_z.resize(count);
+
+    for (size_t n = 0; n < count; n++) {
+        const Vertex& v = mesh.vertices[n];
+        Maths::Vector<double, 4> pos = matrices.model * v.pos;
+        Maths::Vector<double, 4> normal = matrices.normal * v.normal;
+
+        if (Maths::dot(normal, normal) > 0.0) {
+            normal = Maths::normalise(normal);
+        }
+
+        cache.x[n] = pos(0);
+        cache.y[n] = pos(1);
+        cache.z[n] = pos(2);
+        cache.normal_x[n] = normal(0);
+        cache.normal_y[n] = normal(1);
+        cache.normal_z[n] = normal(2);
+    }
+
+    cache.mesh = &mesh;
+    cache.mesh_version = mesh.version;
+    cache.position = model.position;
+    cache.rotation = model.rotation;
+    cache.scale = model.scale;
+    cache.valid = true;
+
+    return cache;
+}
+
+const Maths::Matrix<double, 4, 4>& model_transform(const Model& model) {
+    return get_model_matrices(model).model;
+}
+
+const Maths::Matrix<double, 4, 4>& inverse_model_transform(
+    const Model& model
+) {
+    return get_model_matrices(model).inverse;
+}
+
+const Maths::Matrix<double, 4, 4>& normal_transform(const Model& model) {
+    return get_model_matrices(model).normal;
 }
 
 }
\ No newline at end of file
@@ -7,6 +7,7 @@
 
 #include "./../Maths/Matrix.hpp"
 #include "./../Maths/Vector.hpp"
+#include "BVH.hpp"
 #include <vector>
 
 /*  load_resources.hpp includes this, so we forward declare the bitmap structure. */
@@ -36,6 +37,10 @@ struct Point {
     double b_div_z;
     double tex_x_div_z;
     double tex_y_div_z;
+
+    /*  Clip planes that the point lies outside of, one bit per plane - for
+        use in clip space (see Renderer::clip_triangles). */
+    unsigned int outcode;
 };
 
 struct Triangle {
@@ -43,8 +48,136 @@ struct Triangle {
     Resources::TrueColourBitmap* bitmap_ptr = nullptr;
 };
 
+/*  A vertex of a mesh, in model space. Vertices are shared by the triangles
+    that meet at them, unless the triangles need different attributes there
+    (e.g. texture coordinates or, at a sharp edge, normals). */
+struct Vertex {
+    Maths::Vector<double, 4> pos;
+
+    /*  Unit surface normal - a direction, so w is 0. */
+    Maths::Vector<double, 4> normal;
+
+    double r;
+    double g;
+    double b;
+    double tex_x;
+    double tex_y;
+};
+
+/*  Cone angle of a cluster that cannot be culled as back facing. */
+static constexpr double MESH_CLUSTER_NO_CONE = 3.14159265358979323846;
+
+/*  A group of nearby triangles of a mesh - index_count entries of the mesh's
+    indices from first_index onwards, referring only to the vertex_count
+    vertices from first_vertex onwards. The renderer culls clusters that are
+    out of view or facing away from the camera before processing their
+    vertices. */
+struct MeshCluster {
+    int first_index;
+    int index_count;
+    int first_vertex;
+    int vertex_count;
+    bounding_box bounds;
+
+    /*  Bounding sphere, about the centre of the box. */
+    Maths::Vector<double, 4> centre;
+    double radius = 0.0;
+
+    /*  Normal cone - every face normal of the cluster is within cone_angle
+        radians of the unit vector cone_axis. If the faces point in too many
+        directions for the cluster ever to face entirely away from the
+        camera, the angle is pi. */
+    Maths::Vector<double, 4> cone_axis;
+    double cone_angle = MESH_CLUSTER_NO_CONE;
+};
+
+/*  Indexed triangle mesh - each triangle is three consecutive entries of
+    indices, referring to vertices, in the same winding order as the faces of
+    the mesh. The renderer processes each vertex once per frame and assembles
+    the triangles afterwards. */
 struct Mesh {
-    std::vector<Triangle> triangles;
+    std::vector<Vertex> vertices;
+    std::vector<int> indices;
+    Resources::TrueColourBitmap* bitmap_ptr = nullptr;
+
+    /*  Model space bounding volumes of the vertices - an axis aligned box
+        and a sphere about the centre of the box. These are used to cull
+        whole models, so must be updated (by compute_mesh_bounds) whenever
+        the vertices change. */
+    bounding_box bounds;
+    Maths::Vector<double, 4> bounds_centre;
+    double bounds_radius = 0.0;
+
+    /*  Model space unit normal of each triangle (zero for degenerate ones),
+        from the cross product of its sides in winding order. Used to cull
+        back faces before their vertices are transformed - a mesh without
+        face normals has them computed as it is drawn. */
+    std::vector<Maths::Vector<double, 4>> face_normals;
+
+    /*  The triangles partitioned into clusters (by build_mesh_clusters), and
+        a hierarchy over the clusters' bounds. A mesh without clusters is
+        drawn as though it were a single cluster. */
+    std::vector<MeshCluster> clusters;
+    BVH cluster_bvh;
+
+    /*  Incremented whenever the vertices change, so that copies of them
+        (see world_vertices) can tell they are out of date. The functions
+        below that change the vertices increment it themselves - anything
+        else that does must increment it too. */
+    unsigned long long version = 0;
+
+    size_t get_triangle_count() const {
+        return this->indices.size() / 3;
+    }
+};
+
+/*  Matrices derived from a model's position, rotation and scale. They are
+    cached in the model and only recomputed when one of those changes, so a
+    model that does not move costs no matrix work from frame to frame. The
+    cache is updated by the functions returning the matrices, which are not
+    safe to call for the same model from several threads at once. */
+struct model_matrices {
+    /*  The position, rotation and scale the matrices were computed from. */
+    Maths::Vector<double, 4> position;
+    Maths::Vector<double, 4> rotation;
+    Maths::Vector<double, 4> scale;
+    bool valid = false;
+
+    Maths::Matrix<double, 4, 4> model;
+    Maths::Matrix<double, 4, 4> normal;
+    Maths::Matrix<double, 4, 4> inverse;
+
+    /*  The model and normal matrices premultiplied by a camera's view
+        transform, and the generation of that view transform - 0 if they have
+        not been computed since the model last moved (see
+        model_view_transform). */
+    Maths::Matrix<double, 4, 4> model_view;
+    Maths::Matrix<double, 4, 4> normal_view;
+    unsigned long long view_generation = 0;
+};
+
+/*  World space positions and unit normals of the vertices of a static model,
+    as streams - the n-th position is (x[n], y[n], z[n], 1) and the n-th
+    normal (normal_x[n], normal_y[n], normal_z[n], 0). They are baked when the
+    model is first drawn and reused from frame to frame until the model moves
+    or its mesh changes, so that its vertices need only be transformed from
+    world space to clip space. */
+struct world_vertices {
+    /*  The mesh, its version and the placement the vertices were baked
+        from. */
+    const Mesh* mesh = nullptr;
+    unsigned long long mesh_version = 0;
+    Maths::Vector<double, 4> position;
+    Maths::Vector<double, 4> rotation;
+    Maths::Vector<double, 4> scale;
+    bool valid = false;
+
+    std::vector<double> x;
+    std::vector<double> y;
+    std::vector<double> z;
+    std::vector<double> normal_x;
+    std::vector<double> normal_y;
+    std::vector<double> normal_z;
 };
 
 struct Model {
@@ -62,11 +195,60 @@ struct Model {
             y is the angle in the x-z plane.
             z is the angle in the x-y plane. */
     Maths::Vector<double, 4> rotation;
+
+    /*  Static models are expected to move rarely, if ever (e.g. the scenery
+        of a level), so their world space vertices are cached. Moving one is
+        still correct, but rebakes its vertices. */
+    bool is_static = false;
+
+    mutable model_matrices matrices {};
+    mutable world_vertices world_cache {};
 };
 
+/*  Compute the bounding volumes of a mesh from its vertices. */
+void compute_mesh_bounds(Mesh& mesh);
+
+/*  Compute the face normals of a mesh from its vertices and indices. */
+void compute_face_normals(Mesh& mesh);
+
+/*  Target number of triangles in a cluster - clusters hold between half this
+    and this many triangles. */
+static constexpr int MESH_CLUSTER_TRIANGLES = 64;
+
+/*  Partition the triangles of a mesh into clusters of nearby triangles,
+    compute their bounds and normal cones and build the hierarchy over them
+    (computing the face normals too).
+    The indices are reordered so that each cluster's are contiguous, as are
+    the vertices - vertices shared between clusters are duplicated, so that
+    each cluster can be processed on its own. */
+void build_mesh_clusters(Mesh& mesh);
+
+/*  The world space axis aligned bounding box of a model. */
+bounding_box get_model_bounds(const Model& model);
+
+/*  The cached matrices of a model, recomputed first if the model has moved
+    since they were last computed. */
+const model_matrices& get_model_matrices(const Model& model);
+
+/*  The world space vertices of a model, rebaked first if the model has moved
+    or its mesh has changed since they were last baked. Like
+    get_model_matrices, this is not safe to call for the same model from
+    several threads at once. */
+const world_vertices& get_world_vertices(const Model& model);
+
 /*  To transform a model into world space, first scale, then rotate and then
     translate. */
-Maths::Matrix<double, 4, 4> model_transform(const Model& model);
+const Maths::Matrix<double, 4, 4>& model_transform(const Model& model);
+
+/*  The inverse of the model transform - from world space to model space. */
+const Maths::Matrix<double, 4, 4>& inverse_model_transform(
+    const Model& model
+);
+
+/*  Transforms the normals of a model into world space - the inverse
+    transpose of the model transform, which is the rotation applied after the
+    inverse of the scale. */
+const Maths::Matrix<double, 4, 4>& normal_transform(const Model& model);
 
 }
 
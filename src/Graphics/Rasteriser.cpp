@@ -3,8 +3,10 @@
     Implementation of rasterising functions. */
 
 #include "Rasteriser.hpp"
+#include "SpanKernel.hpp"
 
 #include <cmath>
+#include <cstdint>
 #include <algorithm>
 #include <iostream>
 #include <string>
@@ -102,14 +104,86 @@ void draw_wireframe_triangle(
     draw_line(window, p3, p1, red, green, blue);  
 }
 
-static double clamp(double val, double low, double high) {
-    if (val < low) {
-        return low;
-    } else if(val > high) {
-        return high;
+/*  A horizontal run of pixels [x_start, x_end] on row y, already scissored.
+    The attributes (each divided by depth, as in pixel_coord) are given at
+    pixel x_origin by origin and vary by step for each pixel along the row.
+    The x and y members of origin and step are unused. */
+struct shaded_span {
+    int y;
+    int x_start;
+    int x_end;
+    int x_origin;
+    pixel_coord origin;
+    pixel_coord step;
+};
+
+/*  The span kernel variant chosen for a triangle, along with what it needs
+    of the triangle's shading. */
+struct span_shader {
+    span_function function;
+    const Resources::TrueColourBitmap* bitmap_ptr;
+    const triangle_shading* shading;
+};
+
+static span_shader make_span_shader(
+    const System::FramebufferView& framebuffer,
+    const Resources::TrueColourBitmap* bitmap_ptr,
+    const triangle_shading& shading
+) {
+    unsigned int features = shading.features;
+
+    if (bitmap_ptr == nullptr) {
+        features &= ~SHADE_TEXTURE;
     }
 
-    return val;
+    return span_shader {
+        get_span_function(features, shading.precision,
+            framebuffer.depth_format),
+        bitmap_ptr,
+        &shading
+    };
+}
+
+/*  Depth test, shade and write every pixel of a span. Each attribute is
+    evaluated directly from the origin (rather than accumulated pixel by
+    pixel) so that a span entered part of the way along - for instance at the
+    edge of a tile - yields exactly the same values as one drawn in full.
+
+    The shading itself is done by a (possibly vectorised) span kernel, which
+    writes straight into the framebuffer rows - see SpanKernel.hpp. */
+static void draw_shaded_span(
+    const System::FramebufferView& framebuffer,
+    const shaded_span& span,
+    const span_shader& shader
+) {
+    int count = span.x_end - span.x_start + 1;
+
+    if (count <= 0) {
+        return;
+    }
+
+    span_input input {
+        count,
+        (double) (span.x_start - span.x_origin),
+        span.origin,
+        span.step,
+        shader.bitmap_ptr,
+        shader.shading->intensity,
+        shader.shading->red,
+        shader.shading->green,
+        shader.shading->blue
+    };
+
+    span_output output {
+        framebuffer.colour_row(span.y) + span.x_start,
+        framebuffer.depth_pixel(span.x_start, span.y),
+        framebuffer.depth_scale,
+        framebuffer.red_shift,
+        framebuffer.green_shift,
+        framebuffer.blue_shift
+    };
+
+    shader.function(input, output);
 }
 
 /*  Draw shaded pixel row - precondition is that p1.x <= p2.x and that
@@ -131,6 +205,22 @@ void draw_shaded_row(
     Resources::TrueColourBitmap* bitmap_ptr,
     int buffer_width,
     int buffer_height
+) {
+    System::FramebufferView framebuffer = window.lock_framebuffer();
+
+    draw_shaded_row(framebuffer, y, p1, p2, bitmap_ptr,
+        pixel_rect { 0, 0, buffer_width, buffer_height });
+
+    window.unlock_framebuffer();
+}
+
+static void draw_shaded_row(
+    const System::FramebufferView& framebuffer,
+    int y,
+    pixel_coord p1,
+    pixel_coord p2,
+    const span_shader& shader,
+    const pixel_rect& scissor
 ) {
     /*  To draw a perspective-correct row of a triangle, we need to determine
         the following properties for each pixel:
@@ -158,125 +248,110 @@ void draw_shaded_row(
         So I/z varies linearly with 1/z, so therefore we can linearly
         interpolate for I/z and compute I/z / (1 / z) to obtain I. */
     
+    /*  Rows outside of the scissor rectangle are not drawn at all. */
+    if (y < scissor.y_min || y >= scissor.y_max) {
+        return;
+    }
+
     /*  Number of interpolation steps - all other quantities must be divided
         linearly into this number of steps. This is the number of increments
         we do, not the number of pixels drawn (which will be this + 1 for
-        the first one). */
+        the first one). A row of a single pixel has no variation. */
     int num_steps = abs(p2.x - p1.x);
 
+    if (num_steps == 0) {
+        num_steps = 1;
+    }
+
     /*  Inverse depth variation. */
-    double inv_z_diff = p2.inv_z - p1.inv_z;
-    double inv_z_step = inv_z_diff / num_steps;
-    double inv_z = p1.inv_z;
+    double inv_z_step = (p2.inv_z - p1.inv_z) / num_steps;
 
     /*  Intensity / z variation - varies linearly with 1/z. */
-    double i_div_z_diff = p2.i_div_z - p1.i_div_z;
-    double i_div_z_step = i_div_z_diff / num_steps;
-    double i_div_z = p1.i_div_z;
+    double i_div_z_step = (p2.i_div_z - p1.i_div_z) / num_steps;
 
     /*  Colour variation. */
-    double r_div_z_diff = p2.r_div_z - p1.r_div_z;
-    double g_div_z_diff = p2.g_div_z - p1.g_div_z;
-    double b_div_z_diff = p2.b_div_z - p1.b_div_z;
-
-    double r_div_z_step = r_div_z_diff / num_steps;
-    double g_div_z_step = g_div_z_diff / num_steps;
-    double b_div_z_step = b_div_z_diff / num_steps;
-
-    double r_div_z = p1.r_div_z;
-    double g_div_z = p1.g_div_z;
-    double b_div_z = p1.b_div_z;
+    double r_div_z_step = (p2.r_div_z - p1.r_div_z) / num_steps;
+    double g_div_z_step = (p2.g_div_z - p1.g_div_z) / num_steps;
+    double b_div_z_step = (p2.b_div_z - p1.b_div_z) / num_steps;
 
     /*  Texture coordinates. */
-    double tex_x_div_z_diff = p2.tex_x_div_z - p1.tex_x_div_z;
-    double tex_y_div_z_diff = p2.tex_y_div_z - p1.tex_y_div_z;
-
-    double tex_x_div_z_step = tex_x_div_z_diff / num_steps;
-    double tex_y_div_z_step = tex_y_div_z_diff / num_steps;
-
-    double tex_x_div_z = p1.tex_x_div_z;
-    double tex_y_div_z = p1.tex_y_div_z;
-
-    double intensity = 0.0;
-    double r = 0.0;
-    double g = 0.0;
-    double b = 0.0;
-    double tex_x = 0.0;
-    double tex_y = 0.0;
+    double tex_x_div_z_step = (p2.tex_x_div_z - p1.tex_x_div_z) / num_steps;
+    double tex_y_div_z_step = (p2.tex_y_div_z - p1.tex_y_div_z) / num_steps;
 
+    /*  Only visit the pixels of the row that fall inside the scissor. */
     int p1_x = (int) floor(p1.x);
     int p2_x = (int) floor(p2.x);
 
-    for (int i = p1_x; i <= p2_x; i++) {
-        /*  Compute intensity by taking (I/z) / (1/z). */
-        intensity = i_div_z / inv_z;
-        r = r_div_z / inv_z;
-        g = g_div_z / inv_z;
-        b = b_div_z / inv_z;
-        tex_x = tex_x_div_z / inv_z;
-        tex_y = tex_y_div_z / inv_z;
-
-        /*  Check depth buffer and pixel coordinates. */
-        double depth_buff_val = window.read_depth_buffer(i, y);
-        // std::cout << "Depth mine = " << std::to_string(inv_z) << " other = " << std::to_string(depth_buff_val) << std::endl;
-        //std::cout << "i = " << std::to_string(i) << ", y = " << std::to_string(y) << ", buffer w,h = " << std::to_string(buffer_width) << ", " << std::to_string(buffer_height) << std::endl;
-        if (inv_z > depth_buff_val && i >= 0 && i < buffer_width && y >= 0 && y <= buffer_height) {
-            //std::cout << "display" << std::endl;
-            double mix_r = r;
-            double mix_g = g;
-            double mix_b = b;
-
-            /*  Check if textures are used. */
-            if (bitmap_ptr != nullptr) {
-                /*  Mix texture colours and rgb values. */
-                int pixel_x = round(tex_x * (bitmap_ptr->width - 1));
-                int pixel_y = round(tex_y * (bitmap_ptr->height - 1));
-
-                if (pixel_x < 0) {
-                    pixel_x = 0;
-                } else if (pixel_x > bitmap_ptr->width - 1) {
-                    pixel_x = bitmap_ptr->width - 1;
-                }
-
-                if (pixel_y < 0) {
-                    pixel_y = 0;
-                } else if (pixel_y > bitmap_ptr->height - 1) {
-                    pixel_y = bitmap_ptr->height - 1;
-                }
-
-                pixel_y = bitmap_ptr->height - 1 - pixel_y;
+    shaded_span span {
+        y,
+        std::max(p1_x, scissor.x_min),
+        std::min(p2_x, scissor.x_max - 1),
+        p1_x,
+        p1,
+        pixel_coord {
+            1.0, 0.0,
+            inv_z_step,
+            i_div_z_step,
+            r_div_z_step,
+            g_div_z_step,
+            b_div_z_step,
+            tex_x_div_z_step,
+            tex_y_div_z_step
+        }
+    };
 
-                // std::cout << "Pix " << std::to_string(pixel_x) << " " << std::to_string(pixel_y) << std::endl;
+    draw_shaded_span(framebuffer, span, shader);
+}
 
-                int pixel_index = pixel_y * bitmap_ptr->width + pixel_x;
+void draw_shaded_row(
+    const System::FramebufferView& framebuffer,
+    int y,
+    pixel_coord p1,
+    pixel_coord p2,
+    Resources::TrueColourBitmap* bitmap_ptr,
+    const pixel_rect& scissor,
+    const triangle_shading& shading
+) {
+    draw_shaded_row(framebuffer, y, p1, p2,
+        make_span_shader(framebuffer, bitmap_ptr, shading), scissor);
+}
 
-                mix_r = bitmap_ptr->pixels[pixel_index].r * (mix_r / 255.0);
-                mix_g = bitmap_ptr->pixels[pixel_index].g * (mix_g / 255.0);
-                mix_b = bitmap_ptr->pixels[pixel_index].b * (mix_b / 255.0);
+pixel_rect shaded_triangle_bounds(pixel_coord p1, pixel_coord p2,
+    pixel_coord p3) {
+    double min_x = std::min({ p1.x, p2.x, p3.x });
+    double max_x = std::max({ p1.x, p2.x, p3.x });
+    double min_y = std::min({ p1.y, p2.y, p3.y });
+    double max_y = std::max({ p1.y, p2.y, p3.y });
+
+    /*  The edge from the lowest to the highest point may overshoot by one
+        step of x per row, and rows may be extended by a pixel to the right
+        (see draw_shaded_triangle). */
+    int num_steps = abs(max_y - min_y);
+    double overshoot = 0.0;
+
+    if (num_steps > 0) {
+        pixel_coord* low = &p1;
+        pixel_coord* high = &p1;
+
+        for (pixel_coord* p : { &p2, &p3 }) {
+            if (p->y < low->y) {
+                low = p;
             }
 
-            /*  Draw pixel. */
-            draw_pixel(
-                window,
-                i,
-                y,
-                static_cast<uint8_t>(clamp(mix_r * intensity, 0, 255)),
-                static_cast<uint8_t>(clamp(mix_g * intensity, 0, 255)),
-                static_cast<uint8_t>(clamp(mix_b * intensity, 0, 255))
-            );
-
-            window.write_depth_buffer(i, y, inv_z);
+            if (p->y >= high->y) {
+                high = p;
+            }
         }
 
-        /*  Increment interpolation steps. */
-        inv_z += inv_z_step;
-        i_div_z += i_div_z_step;
-        r_div_z += r_div_z_step;
-        g_div_z += g_div_z_step;
-        b_div_z += b_div_z_step;
-        tex_x_div_z += tex_x_div_z_step;
-        tex_y_div_z += tex_y_div_z_step;
+        overshoot = std::abs(high->x - low->x) / num_steps;
     }
+
+    return pixel_rect {
+        (int) floor(min_x - overshoot) - 1,
+        (int) floor(min_y),
+        (int) floor(max_x + overshoot) + 2,
+        (int) floor(max_y) + 1
+    };
 }
 
 /*  Precondition - the depths of all of the provided coordinates are non-zero.
@@ -291,6 +366,23 @@ void draw_shaded_triangle(
     Resources::TrueColourBitmap* bitmap_ptr,
     int buffer_width,
     int buffer_height
+) {
+    System::FramebufferView framebuffer = window.lock_framebuffer();
+
+    draw_shaded_triangle(framebuffer, p1, p2, p3, bitmap_ptr,
+        pixel_rect { 0, 0, buffer_width, buffer_height });
+
+    window.unlock_framebuffer();
+}
+
+void draw_shaded_triangle(
+    const System::FramebufferView& framebuffer,
+    pixel_coord p1,
+    pixel_coord p2,
+    pixel_coord p3,
+    Resources::TrueColourBitmap* bitmap_ptr,
+    const pixel_rect& scissor,
+    const triangle_shading& shading
 ) {
     /*  Order points by y - p1 should be the lowest point, p2 the middle and
         p3 the highest (numerically speaking, in pixel space). */
@@ -323,6 +415,14 @@ void draw_shaded_triangle(
         return;
     }
 
+    /*  Nothing to draw if the triangle lies entirely above or below the
+        scissor rectangle. */
+    if ((int) p3.y < scissor.y_min || (int) p1.y >= scissor.y_max) {
+        return;
+    }
+
+    span_shader shader = make_span_shader(framebuffer, bitmap_ptr, shading);
+
     /*  Declare interpolation variables. */
     double x_diff_1_2 {};
     double x_step_1_2 {};
@@ -471,6 +571,14 @@ void draw_shaded_triangle(
 
         /*  Draw lower triangle. */
         for (int i = p1.y; i <= p2.y; i++) {
+            /*  Rows past the bottom of the scissor rectangle are never drawn.
+                Rows before its top are skipped by draw_shaded_row, but must
+                still be stepped through to keep the edge interpolants
+                exact. */
+            if (i >= scissor.y_max) {
+                break;
+            }
+
             /*  Draw row. */
             pixel_coord p_1_2 = {
                 x_1_2,
@@ -498,23 +606,21 @@ void draw_shaded_triangle(
 
             if (x_1_2 <= x_1_3) {
                 draw_shaded_row(
-                    window,
+                    framebuffer,
                     i,
                     p_1_2,
                     p_1_3,
-                    bitmap_ptr,
-                    buffer_width,
-                    buffer_height
+                    shader,
+                    scissor
                 );
             } else {
                 draw_shaded_row(
-                    window,
+                    framebuffer,
                     i,
                     p_1_3,
                     p_1_2,
-                    bitmap_ptr,
-                    buffer_width,
-                    buffer_height
+                    shader,
+                    scissor
                 );
             }
 
@@ -588,6 +694,14 @@ void draw_shaded_triangle(
 
         /*  Draw upper triangle. */
         for (int i = p2.y; i <= p3.y; i++) {
+            /*  Rows past the bottom of the scissor rectangle are never drawn.
+                Rows before its top are skipped by draw_shaded_row, but must
+                still be stepped through to keep the edge interpolants
+                exact. */
+            if (i >= scissor.y_max) {
+                break;
+            }
+
             /*  Draw row. */
             pixel_coord p_2_3 = {
                 x_2_3,
@@ -617,23 +731,21 @@ void draw_shaded_triangle(
                 p_1_3.x += 1;
 
                 draw_shaded_row(
-                    window,
+                    framebuffer,
                     i,
                     p_2_3,
                     p_1_3,
-                    bitmap_ptr,
-                    buffer_width,
-                    buffer_height
+                    shader,
+                    scissor
                 );
             } else {
                 draw_shaded_row(
-                    window,
+                    framebuffer,
                     i,
                     p_1_3,
                     p_2_3,
-                    bitmap_ptr,
-                    buffer_width,
-                    buffer_height
+                    shader,
+                    scissor
                 );
             }
 
@@ -665,4 +777,329 @@ void draw_shaded_triangle(
     }
 }
 
+void draw_shaded_triangle_half_space(
+    System::RenderWindow& window,
+    pixel_coord p1,
+    pixel_coord p2,
+    pixel_coord p3,
+    Resources::TrueColourBitmap* bitmap_ptr,
+    int buffer_width,
+    int buffer_height
+) {
+    System::FramebufferView framebuffer = window.lock_framebuffer();
+
+    draw_shaded_triangle_half_space(framebuffer, p1, p2, p3, bitmap_ptr,
+        pixel_rect { 0, 0, buffer_width, buffer_height });
+
+    window.unlock_framebuffer();
+}
+
+/*  Width and height of the square blocks of pixels classified at once by the
+    half-space rasteriser. */
+static constexpr int HALF_SPACE_BLOCK_SIZE = 8;
+
+/*  Edge function for the directed edge a -> b:
+        E(p) = (b.x - a.x)(p.y - a.y) - (b.y - a.y)(p.x - a.x)
+             = de_dx * p.x + de_dy * p.y + c
+    E is zero on the line through a and b and has opposite signs either side
+    of it. Pixel coordinates are integers, so for the integer vertex
+    coordinates produced by the pipeline E is evaluated exactly. */
+struct edge_function {
+    double de_dx;
+    double de_dy;
+    double c;
+
+    /*  Whether this is a top or left edge of the triangle - pixels exactly on
+        such an edge are drawn, those on any other edge are not. */
+    bool top_left;
+
+    double at(double x, double y) const {
+        return this->de_dx * x + this->de_dy * y + this->c;
+    }
+
+    bool covers(double e) const {
+        return e > 0 || (e == 0 && this->top_left);
+    }
+};
+
+/*  An edge function over vertices in 28.4 fixed point, for
+    RasteriserPrecision::FIXED. Pixel (x, y) is at (x, y) * FIXED_SUBPIXEL_SCALE
+    in fixed point, so E is evaluated there - the gradients are premultiplied
+    by the scale. Every term is an integer, so E is exact for vertices
+    anywhere in the guard band. */
+struct fixed_edge_function {
+    int64_t de_dx;
+    int64_t de_dy;
+    int64_t c;
+    bool top_left;
+
+    int64_t at(int x, int y) const {
+        return this->de_dx * x + this->de_dy * y + this->c;
+    }
+
+    bool covers(int64_t e) const {
+        return e > 0 || (e == 0 && this->top_left);
+    }
+};
+
+/*  Precondition - the triangle a -> b -> c has positive area with respect to
+    edge functions, i.e. its interior is on the positive side of each edge. */
+static edge_function make_edge_function(const pixel_coord& a,
+    const pixel_coord& b) {
+    double dx = b.x - a.x;
+    double dy = b.y - a.y;
+
+    /*  The interior lies where E increases. A left edge has the interior to
+        its right (dE/dx = -dy > 0) and, since y increases down the screen, a
+        top edge is horizontal with the interior below it (dE/dy = dx > 0). */
+    return edge_function {
+        -dy,
+        dx,
+        dy * a.x - dx * a.y,
+        dy < 0 || (dy == 0 && dx > 0)
+    };
+}
+
+static fixed_edge_function make_fixed_edge_function(const pixel_coord& a,
+    const pixel_coord& b) {
+    int64_t ax = std::llround(a.x * FIXED_SUBPIXEL_SCALE);
+    int64_t ay = std::llround(a.y * FIXED_SUBPIXEL_SCALE);
+    int64_t dx = std::llround(b.x * FIXED_SUBPIXEL_SCALE) - ax;
+    int64_t dy = std::llround(b.y * FIXED_SUBPIXEL_SCALE) - ay;
+
+    return fixed_edge_function {
+        -dy * FIXED_SUBPIXEL_SCALE,
+        dx * FIXED_SUBPIXEL_SCALE,
+        dy * ax - dx * ay,
+        dy < 0 || (dy == 0 && dx > 0)
+    };
+}
+
+/*  Draw the pixels of a triangle, within the (inclusive) bounds given, that
+    are covered according to its edge functions - of type edge_function or
+    fixed_edge_function. The attributes are given by their plane equations
+    (see draw_shaded_triangle_half_space). */
+template <typename E>
+static void fill_half_space_blocks(
+    const System::FramebufferView& framebuffer,
+    const E (&edges)[3],
+    const pixel_coord& p1,
+    const pixel_coord& d_dx,
+    const pixel_coord& d_dy,
+    int min_x,
+    int max_x,
+    int min_y,
+    int max_y,
+    const span_shader& shader
+) {
+    /*  Blocks are aligned to the render buffer, not the bounding box, so that
+        the attribute origins (and hence the shaded values) do not depend on
+        the scissor. */
+    int first_block_x = min_x - (min_x % HALF_SPACE_BLOCK_SIZE);
+    int first_block_y = min_y - (min_y % HALF_SPACE_BLOCK_SIZE);
+
+    for (int block_y = first_block_y; block_y <= max_y;
+        block_y += HALF_SPACE_BLOCK_SIZE) {
+        int block_bottom = block_y + HALF_SPACE_BLOCK_SIZE - 1;
+
+        for (int block_x = first_block_x; block_x <= max_x;
+            block_x += HALF_SPACE_BLOCK_SIZE) {
+            int block_right = block_x + HALF_SPACE_BLOCK_SIZE - 1;
+
+            /*  Classify the block against each edge by its corners - since
+                edge functions are linear, the extreme values over the block
+                are found at its corners. */
+            bool rejected = false;
+            bool fully_covered = true;
+
+            for (const E& edge : edges) {
+                decltype(edge.at(0, 0)) corners[4] = {
+                    edge.at(block_x, block_y),
+                    edge.at(block_right, block_y),
+                    edge.at(block_x, block_bottom),
+                    edge.at(block_right, block_bottom)
+                };
+
+                auto lowest = std::min({ corners[0], corners[1], corners[2],
+                    corners[3] });
+                auto highest = std::max({ corners[0], corners[1],
+                    corners[2], corners[3] });
+
+                if (highest < 0) {
+                    rejected = true;
+                    break;
+                }
+
+                if (lowest <= 0) {
+                    fully_covered = false;
+                }
+            }
+
+            if (rejected) {
+                continue;
+            }
+
+            int row_start = std::max(block_x, min_x);
+            int row_end = std::min(block_right, max_x);
+
+            for (int y = std::max(block_y, min_y);
+                y <= std::min(block_bottom, max_y); y++) {
+                shaded_span span {
+                    y,
+                    row_start,
+                    row_end,
+                    block_x,
+                    pixel_coord {},
+                    d_dx
+                };
+
+                /*  A triangle is convex, so the covered pixels of a row form
+                    one contiguous run. Narrow the span to that run. */
+                if (!fully_covered) {
+                    auto covered = [&](int x) {
+                        return edges[0].covers(edges[0].at(x, y)) &&
+                            edges[1].covers(edges[1].at(x, y)) &&
+                            edges[2].covers(edges[2].at(x, y));
+                    };
+
+                    while (span.x_start <= span.x_end &&
+                        !covered(span.x_start)) {
+                        span.x_start ++;
+                    }
+
+                    while (span.x_end >= span.x_start &&
+                        !covered(span.x_end)) {
+                        span.x_end --;
+                    }
+
+                    if (span.x_start > span.x_end) {
+                        continue;
+                    }
+                }
+
+                /*  Evaluate the plane equations at the block origin of this
+                    row. */
+                double dx = block_x - p1.x;
+                double dy = y - p1.y;
+
+                span.origin = pixel_coord {
+                    (double) block_x,
+                    (double) y,
+                    p1.inv_z + d_dx.inv_z * dx + d_dy.inv_z * dy,
+                    p1.i_div_z + d_dx.i_div_z * dx + d_dy.i_div_z * dy,
+                    p1.r_div_z + d_dx.r_div_z * dx + d_dy.r_div_z * dy,
+                    p1.g_div_z + d_dx.g_div_z * dx + d_dy.g_div_z * dy,
+                    p1.b_div_z + d_dx.b_div_z * dx + d_dy.b_div_z * dy,
+                    p1.tex_x_div_z + d_dx.tex_x_div_z * dx +
+                        d_dy.tex_x_div_z * dy,
+                    p1.tex_y_div_z + d_dx.tex_y_div_z * dx +
+                        d_dy.tex_y_div_z * dy
+                };
+
+                draw_shaded_span(framebuffer, span, shader);
+            }
+        }
+    }
+}
+
+void draw_shaded_triangle_half_space(
+    const System::FramebufferView& framebuffer,
+    pixel_coord p1,
+    pixel_coord p2,
+    pixel_coord p3,
+    Resources::TrueColourBitmap* bitmap_ptr,
+    const pixel_rect& scissor,
+    const triangle_shading& shading
+) {
+    /*  Twice the signed area of the triangle. Reorder the points if need be
+        so that the interior is on the positive side of every edge. */
+    double area = (p2.x - p1.x) * (p3.y - p1.y) - (p2.y - p1.y) * (p3.x - p1.x);
+
+    if (area == 0) {
+        return;
+    } else if (area < 0) {
+        std::swap(p2, p3);
+        area = -area;
+    }
+
+    /*  Plane equations for each attribute. Each attribute (already divided by
+        depth, so that it varies linearly in pixel space) is written as
+            a(x, y) = a(p1) + da_dx * (x - p1.x) + da_dy * (y - p1.y)
+        where the gradients follow from the barycentric weights, which are the
+        edge functions divided by the area:
+            a(p) = (a1 E_23(p) + a2 E_31(p) + a3 E_12(p)) / area */
+    double y2_y3 = (p2.y - p3.y) / area;
+    double y3_y1 = (p3.y - p1.y) / area;
+    double y1_y2 = (p1.y - p2.y) / area;
+    double x3_x2 = (p3.x - p2.x) / area;
+    double x1_x3 = (p1.x - p3.x) / area;
+    double x2_x1 = (p2.x - p1.x) / area;
+
+    auto gradient_x = [&](double a1, double a2, double a3) {
+        return a1 * y2_y3 + a2 * y3_y1 + a3 * y1_y2;
+    };
+
+    auto gradient_y = [&](double a1, double a2, double a3) {
+        return a1 * x3_x2 + a2 * x1_x3 + a3 * x2_x1;
+    };
+
+    pixel_coord d_dx {
+        1.0, 0.0,
+        gradient_x(p1.inv_z, p2.inv_z, p3.inv_z),
+        gradient_x(p1.i_div_z, p2.i_div_z, p3.i_div_z),
+        gradient_x(p1.r_div_z, p2.r_div_z, p3.r_div_z),
+        gradient_x(p1.g_div_z, p2.g_div_z, p3.g_div_z),
+        gradient_x(p1.b_div_z, p2.b_div_z, p3.b_div_z),
+        gradient_x(p1.tex_x_div_z, p2.tex_x_div_z, p3.tex_x_div_z),
+        gradient_x(p1.tex_y_div_z, p2.tex_y_div_z, p3.tex_y_div_z)
+    };
+
+    pixel_coord d_dy {
+        0.0, 1.0,
+        gradient_y(p1.inv_z, p2.inv_z, p3.inv_z),
+        gradient_y(p1.i_div_z, p2.i_div_z, p3.i_div_z),
+        gradient_y(p1.r_div_z, p2.r_div_z, p3.r_div_z),
+        gradient_y(p1.g_div_z, p2.g_div_z, p3.g_div_z),
+        gradient_y(p1.b_div_z, p2.b_div_z, p3.b_div_z),
+        gradient_y(p1.tex_x_div_z, p2.tex_x_div_z, p3.tex_x_div_z),
+        gradient_y(p1.tex_y_div_z, p2.tex_y_div_z, p3.tex_y_div_z)
+    };
+
+    /*  Bounding box of the triangle, restricted to the scissor. */
+    int min_x = std::max(
+        (int) ceil(std::min({ p1.x, p2.x, p3.x })), scissor.x_min);
+    int max_x = std::min(
+        (int) floor(std::max({ p1.x, p2.x, p3.x })), scissor.x_max - 1);
+    int min_y = std::max(
+        (int) ceil(std::min({ p1.y, p2.y, p3.y })), scissor.y_min);
+    int max_y = std::min(
+        (int) floor(std::max({ p1.y, p2.y, p3.y })), scissor.y_max - 1);
+
+    if (min_x > max_x || min_y > max_y) {
+        return;
+    }
+
+    span_shader shader = make_span_shader(framebuffer, bitmap_ptr, shading);
+
+    if (shading.precision == RasteriserPrecision::FIXED) {
+        fixed_edge_function edges[3] = {
+            make_fixed_edge_function(p2, p3),
+            make_fixed_edge_function(p3, p1),
+            make_fixed_edge_function(p1, p2)
+        };
+
+        fill_half_space_blocks(framebuffer, edges, p1, d_dx, d_dy,
+            min_x, max_x, min_y, max_y, shader);
+    } else {
+        edge_function edges[3] = {
+            make_edge_function(p2, p3),
+            make_edge_function(p3, p1),
+            make_edge_function(p1, p2)
+        };
+
+        fill_half_space_blocks(framebuffer, edges, p1, d_dx, d_dy,
+            min_x, max_x, min_y, max_y, shader);
+    }
+}
+
 }
\ No newline at end of file
@@ -27,6 +27,87 @@ struct pixel_coord {
     double tex_y_div_z;
 };
 
+/*  Axis-aligned rectangle of pixels [x_min, x_max) x [y_min, y_max) in pixel
+    space. Shaded rasterisation is scissored to one of these so that a caller
+    can restrict drawing to a sub-region of the render buffer (e.g. a single
+    screen tile), allowing disjoint regions to be filled concurrently. */
+struct pixel_rect {
+    int x_min;
+    int y_min;
+    int x_max;
+    int y_max;
+};
+
+/*  Algorithms available for filling shaded triangles. Both produce the same
+    shading, but differ in how pixel coverage is determined:
+        - SCANLINE splits the triangle into upper and lower halves and steps
+          the attributes down each edge, drawing one row at a time.
+        - HALF_SPACE sets up an edge function for each side and a plane
+          equation for each attribute once per triangle, and then evaluates
+          coverage over square blocks of pixels, applying the top-left fill
+          rule to pixels that lie exactly on an edge. Triangles sharing an
+          edge therefore never both draw, or both miss, a pixel on it. */
+enum class RasteriserMode {
+    SCANLINE,
+    HALF_SPACE
+};
+
+/*  Precision of the rasterisers' arithmetic:
+        - DOUBLE interpolates the attributes of each span in double
+          precision.
+        - FLOAT interpolates them in single precision, which halves the
+          width of each vector lane in the span kernels. Inverse depths
+          are interpolated in single precision too, and (as in every
+          precision) converted to the depth buffer's format before they are
+          compared with it or written to it (see System::DepthFormat).
+        - FIXED is for the half-space rasteriser - it expects vertices on a
+          grid of 1 / FIXED_SUBPIXEL_SCALE of a pixel (28.4 fixed point, as
+          produced by the Renderer in this mode) rather than whole pixels,
+          and evaluates its edge functions exactly, in integers. Triangles
+          sharing an edge therefore still never both draw, or both miss, a
+          pixel on it, while vertices are placed to a sixteenth of a pixel.
+          Attributes are interpolated in double precision. The scanline
+          rasteriser treats it as DOUBLE, so must be given whole pixel
+          vertices. */
+enum class RasteriserPrecision {
+    DOUBLE,
+    FLOAT,
+    FIXED
+};
+
+static constexpr int FIXED_SUBPIXEL_BITS = 4;
+static constexpr int FIXED_SUBPIXEL_SCALE = 1 << FIXED_SUBPIXEL_BITS;
+
+/*  Shading features of a triangle, as a combination of these flags - each
+    one left out removes its work from the innermost loop of the rasterisers
+    (see SpanKernel.hpp):
+        - SHADE_GOURAUD interpolates the intensity across the triangle.
+        - SHADE_VERTEX_COLOUR interpolates the colour.
+        - SHADE_TEXTURE modulates the colour by the triangle's bitmap. It is
+          ignored for triangles without one.
+        - SHADE_DEPTH_TEST only draws pixels nearer than the depth buffer.
+        - SHADE_DEPTH_WRITE writes the depths of the pixels drawn. */
+static constexpr unsigned int SHADE_GOURAUD = 1 << 0;
+static constexpr unsigned int SHADE_VERTEX_COLOUR = 1 << 1;
+static constexpr unsigned int SHADE_TEXTURE = 1 << 2;
+static constexpr unsigned int SHADE_DEPTH_TEST = 1 << 3;
+static constexpr unsigned int SHADE_DEPTH_WRITE = 1 << 4;
+static constexpr unsigned int SHADE_ALL = (1 << 5) - 1;
+static constexpr unsigned int NUM_SHADING_VARIANTS = SHADE_ALL + 1;
+
+/*  How a triangle is shaded - its features, the intensity and colour of
+    every pixel when they are not interpolated, and the precision of the
+    arithmetic. The default shades as the variants of the rasterisers without
+    a shading parameter do. */
+struct triangle_shading {
+    unsigned int features = SHADE_ALL;
+    RasteriserPrecision precision = RasteriserPrecision::DOUBLE;
+    double intensity = 1.0;
+    double red = 255.0;
+    double green = 255.0;
+    double blue = 255.0;
+};
+
 /*  Simple wrapper around window.draw_pixel member function. */
 void draw_pixel(System::RenderWindow& window, int x, int y, uint8_t red,
     uint8_t green, uint8_t blue);
@@ -48,7 +129,61 @@ void draw_shaded_row(
     int buffer_height
 );
 
+/*  Scissored variant - only pixels inside scissor are written. The scissor
+    must lie within the render buffer.
+
+    This, and the other scissored variants below, write directly into a
+    framebuffer obtained from RenderWindow::lock_framebuffer, so that a caller
+    drawing many triangles need only lock the window once. The variants
+    taking a window lock and unlock it on each call. They also take the
+    shading of the triangle - the span kernel for it is chosen once per
+    call. */
+void draw_shaded_row(
+    const System::FramebufferView& framebuffer,
+    int y,
+    pixel_coord p1,
+    pixel_coord p2,
+    Resources::TrueColourBitmap* bitmap_ptr,
+    const pixel_rect& scissor,
+    const triangle_shading& shading = triangle_shading {}
+);
+
+void draw_shaded_triangle(
+    System::RenderWindow& window,
+    pixel_coord p1,
+    pixel_coord p2,
+    pixel_coord p3,
+    Resources::TrueColourBitmap* bitmap_ptr,
+    int buffer_width,
+    int buffer_height
+);
+
+/*  Conservative bounding rectangle of the pixels that draw_shaded_triangle
+    may write for the given points (before any scissoring). Note that this can
+    be wider than the bounding box of the points themselves, as the long edge
+    of the triangle is stepped one row beyond its end in the upper half. */
+pixel_rect shaded_triangle_bounds(pixel_coord p1, pixel_coord p2,
+    pixel_coord p3);
+
+/*  Scissored variant - the triangle is stepped exactly as it would be for the
+    whole render buffer, but only pixels inside scissor are written. Hence,
+    drawing the same triangle into a set of disjoint scissor rectangles that
+    cover the buffer produces output identical to drawing it once. */
 void draw_shaded_triangle(
+    const System::FramebufferView& framebuffer,
+    pixel_coord p1,
+    pixel_coord p2,
+    pixel_coord p3,
+    Resources::TrueColourBitmap* bitmap_ptr,
+    const pixel_rect& scissor,
+    const triangle_shading& shading = triangle_shading {}
+);
+
+
+/*  Half-space (edge function) rasteriser - a drop-in replacement for
+    draw_shaded_triangle taking the same parameters. The points may be given
+    in either winding order. */
+void draw_shaded_triangle_half_space(
     System::RenderWindow& window,
     pixel_coord p1,
     pixel_coord p2,
@@ -58,6 +193,19 @@ void draw_shaded_triangle(
     int buffer_height
 );
 
+/*  Scissored variant - blocks are aligned to the render buffer rather than to
+    the scissor, so, as with draw_shaded_triangle, drawing into a set of
+    disjoint scissor rectangles produces output identical to drawing once. */
+void draw_shaded_triangle_half_space(
+    const System::FramebufferView& framebuffer,
+    pixel_coord p1,
+    pixel_coord p2,
+    pixel_coord p3,
+    Resources::TrueColourBitmap* bitmap_ptr,
+    const pixel_rect& scissor,
+    const triangle_shading& shading = triangle_shading {}
+);
+
 }
 
 #endif
\ No newline at end of file
@@ -6,261 +6,1596 @@
 #include "./../Maths/Matrix.hpp"
 #include "./../Maths/Transform.hpp"
 #include "Rasteriser.hpp"
+#include "VertexKernel.hpp"
+#include <algorithm>
+#include <atomic>
 #include <cmath>
-#include <list>
+#include <cstring>
 #include <iterator>
 #include <iostream>
 
 namespace Graphics {
 
-Renderer::Renderer(double fov, double aspect_ratio, double far_plane_distance)
+/*  Enough for a few thousand triangles before the arena first grows. */
+static constexpr size_t FRAME_ARENA_INITIAL_CAPACITY = 1 << 20;
+
+Renderer::Renderer(double fov, double aspect_ratio, double far_plane_distance,
+    unsigned int thread_count, int tile_size)
     : fov{fov}, aspect_ratio{aspect_ratio},
-    view_plane_distance{1.0 / tan(fov)}, far_plane_distance{},
+    view_plane_distance{1.0 / tan(fov)},
     screen_left_bound { -1.0 },
     screen_right_bound { 1.0 },
     screen_top_bound { 1.0 / aspect_ratio },
-    screen_bottom_bound { -1.0 / aspect_ratio } {};
+    screen_bottom_bound { -1.0 / aspect_ratio },
+    projection_transform {
+        Maths::make_homogeneous_projection(this->view_plane_distance)
+    },
+    tile_size { tile_size > 0 ? tile_size : 64 },
+    worker_pool { std::make_unique<WorkerPool>(thread_count) },
+    immediate_frame {
+        std::make_unique<frame_context>(this->worker_pool->get_thread_count())
+    } {
+    this->set_far_plane_distance(far_plane_distance);
+}
+
+Renderer::~Renderer() {
+    {
+        std::lock_guard<std::mutex> lock(this->pipeline_mutex);
+        this->stop_pipeline = true;
+    }
+
+    this->frame_changed.notify_all();
+
+    if (this->geometry_stage_thread.joinable()) {
+        this->geometry_stage_thread.join();
+    }
+
+    if (this->raster_stage_thread.joinable()) {
+        this->raster_stage_thread.join();
+    }
+}
+
+Renderer::geometry_thread::geometry_thread(size_t arena_capacity)
+    : arena { arena_capacity },
+    vertices { ArenaAllocator<Point>(this->arena) },
+    triangles { ArenaAllocator<Triangle>(this->arena) },
+    active_indices { ArenaAllocator<int>(this->arena) } {}
+
+void Renderer::geometry_thread::reset() {
+    /*  The buffers hold memory from the arena, so must let go of it before
+        the arena is reset. */
+    this->vertices = PointBuffer(ArenaAllocator<Point>(this->arena));
+    this->triangles = TriangleBuffer(ArenaAllocator<Triangle>(this->arena));
+    this->active_indices = IndexBuffer(ArenaAllocator<int>(this->arena));
+
+    this->arena.reset();
+    this->stats = {};
+}
+
+Renderer::frame_context::frame_context(unsigned int thread_count)
+    : arena { FRAME_ARENA_INITIAL_CAPACITY } {
+    /*  Including a slot for a thread running a batch by itself, when the
+        worker pool is busy. */
+    for (unsigned int i = 0; i <= thread_count; i++) {
+        this->geometry_threads.push_back(
+            std::make_unique<geometry_thread>(FRAME_ARENA_INITIAL_CAPACITY)
+        );
+    }
+}
+
+unsigned long long Renderer::frame_context::get_heap_allocation_count() {
+    unsigned long long count = this->arena.get_heap_allocation_count();
+
+    for (std::unique_ptr<geometry_thread>& thread : this->geometry_threads) {
+        count += thread->arena.get_heap_allocation_count();
+    }
+
+    return count;
+}
+
+void Renderer::frame_context::reset() {
+    this->arena.reset();
+    this->stats = {};
+
+    /*  Which thread runs which jobs changes from frame to frame, so each
+        thread is given room for the whole of the largest frame so far -
+        buffers large enough for all of its triangles (and the vertices of
+        its largest job), and an arena that also holds the scratch space of
+        every job. Then, once the scene stops growing, no thread's buffers or
+        arena grow, however the jobs are shared out. */
+    size_t vertices = 0;
+    size_t triangles = 0;
+    size_t used = 0;
+
+    for (std::unique_ptr<geometry_thread>& thread : this->geometry_threads) {
+        vertices = std::max(vertices, thread->vertices.capacity());
+        triangles += thread->triangles.size();
+        used += thread->arena.get_used();
+    }
+
+    /*  If the buffers stayed within their reservations, whatever the
+        threads used beyond those was scratch space. */
+    size_t reserved_total = this->reserved_bytes *
+        this->geometry_threads.size();
+
+    if (vertices <= this->peak_vertices &&
+        triangles <= this->peak_triangles && used > reserved_total) {
+        this->peak_scratch = std::max(this->peak_scratch,
+            used - reserved_total);
+    }
+
+    this->peak_vertices = std::max(this->peak_vertices, vertices);
+    this->peak_triangles = std::max(this->peak_triangles, triangles);
+
+    /*  Allow for the padding of each buffer to its alignment. */
+    this->reserved_bytes = this->peak_vertices * sizeof(Point) +
+        this->peak_triangles * (sizeof(Triangle) + sizeof(int)) +
+        3 * alignof(std::max_align_t);
+
+    for (std::unique_ptr<geometry_thread>& thread : this->geometry_threads) {
+        thread->reset();
+        thread->arena.reserve(this->reserved_bytes + this->peak_scratch);
+
+        thread->vertices.reserve(this->peak_vertices);
+        thread->triangles.reserve(this->peak_triangles);
+        thread->active_indices.reserve(this->peak_triangles);
+    }
+}
+
+/*  Generations handed out to camera view transforms so far. */
+static std::atomic<unsigned long long> view_generations { 0 };
+
+const Maths::Matrix<double, 4, 4>& view_transform(const Camera& camera) {
+    camera_matrices& matrices = camera.matrices;
+
+    if (matrices.valid &&
+        matrices.position == camera.position &&
+        matrices.rotation == camera.rotation) {
+        return matrices.view;
+    }
+
+    matrices.view = Maths::make_rotation_world(
+        -camera.rotation(0),
+        -camera.rotation(1),
+        -camera.rotation(2)
+    ) * Maths::make_translation(
+        -camera.position(0),
+        -camera.position(1),
+        -camera.position(2)
+    );
+
+    matrices.position = camera.position;
+    matrices.rotation = camera.rotation;
+    matrices.valid = true;
+    matrices.generation = ++ view_generations;
+
+    return matrices.view;
+}
+
+/*  Bring the model view transforms of a model up to date. */
+static const model_matrices& get_model_view_matrices(
+    const Model& model,
+    const Camera& camera
+) {
+    const Maths::Matrix<double, 4, 4>& view = view_transform(camera);
+
+    /*  This resets the view generation if the model has moved. */
+    const model_matrices& model_cache = get_model_matrices(model);
+    model_matrices& matrices = model.matrices;
+
+    if (model_cache.view_generation != camera.matrices.generation) {
+        matrices.model_view = view * model_cache.model;
+        matrices.normal_view = view * model_cache.normal;
+        matrices.view_generation = camera.matrices.generation;
+    }
+
+    return matrices;
+}
+
+const Maths::Matrix<double, 4, 4>& model_view_transform(
+    const Model& model,
+    const Camera& camera
+) {
+    return get_model_view_matrices(model, camera).model_view;
+}
+
+const Maths::Matrix<double, 4, 4>& model_view_normal_transform(
+    const Model& model,
+    const Camera& camera
+) {
+    return get_model_view_matrices(model, camera).normal_view;
+}
+
+void Renderer::render_scene(
+    System::RenderWindow& render_window,
+    const Scene& scene
+) {
+    frame_context& frame = *this->immediate_frame;
+
+    /*  Everything allocated in the previous frame has been released by now -
+        start again from the beginning. */
+    frame.reset();
+    frame.settings = this->settings;
+
+    const std::vector<Model*>& models = scene.index != nullptr ?
+        scene.index->get_models() : scene.models;
+
+    this->find_visible_models(frame, scene, models.data());
+    this->run_geometry_stage(
+        frame,
+        scene.camera,
+        scene.lights.data(),
+        scene.lights.size(),
+        render_window.get_width(),
+        render_window.get_height()
+    );
+
+    /*  The framebuffer is locked once for the whole frame, and every tile
+        writes into it directly. Clipping against the near plane bounds the
+        inverse depths drawn. */
+    render_window.set_max_inverse_depth(1.0 / this->view_plane_distance);
+
+    System::FramebufferView framebuffer = render_window.lock_framebuffer();
+
+    /*  If anything but the last frame's lock has written the window's
+        depths since, the dirty tiles no longer describe them. */
+    unsigned long long depth_writes = render_window.get_depth_write_count();
+
+    if (depth_writes != frame.dirty_depth_writes + 1) {
+        frame.dirty_depth_tiles.clear();
+    }
+
+    frame.dirty_depth_writes = depth_writes;
+
+    this->rasterise_triangles(frame, framebuffer);
+    render_window.unlock_framebuffer();
+
+    this->render_stats = frame.stats;
+}
+
+void Renderer::find_visible_models(
+    frame_context& frame,
+    const Scene& scene,
+    Model* const* models
+) {
+    const std::vector<Model*>& scene_models = scene.index != nullptr ?
+        scene.index->get_models() : scene.models;
+
+    frame.model_count = scene_models.size();
+    frame.visible_models = frame.arena.allocate_array<visible_model>(
+        frame.model_count
+    );
+    frame.visible_count = 0;
+
+    if (scene.index == nullptr) {
+        for (int n = 0; n < frame.model_count; n++) {
+            frame.visible_models[frame.visible_count++] = visible_model {
+                models[n],
+                false
+            };
+        }
+
+        return;
+    }
+
+    /*  Cull the models hierarchically - models in subtrees entirely inside
+        the visible region need no further culling. */
+    Maths::Matrix<double, 4, 4> clip_transform = this->projection_transform *
+        view_transform(scene.camera);
+
+    scene.index->update();
+    scene.index->query_indices(
+        [&](const bounding_box& box) {
+            return this->classify_box(frame.settings, clip_transform, box);
+        },
+        [&](int n, bool inside) {
+            frame.visible_models[frame.visible_count++] = visible_model {
+                models[n],
+                inside
+            };
+        }
+    );
+}
+
+void Renderer::run_geometry_stage(
+    frame_context& frame,
+    const Camera& camera,
+    const Light* lights,
+    size_t light_count,
+    int buffer_width,
+    int buffer_height
+) {
+    ArenaAllocator<Light> allocator(frame.arena);
+
+    const Maths::Matrix<double, 4, 4>& camera_transform =
+        view_transform(camera);
+
+    /*  Transform lights into camera space - static models are lit in world
+        space, so keep the originals too. */
+    LightBuffer world_lights(lights, lights + light_count, allocator);
+    LightBuffer camera_lights(lights, lights + light_count, allocator);
+    this->convert_lights_to_camera_space(camera_lights, camera_transform);
+
+    /*  Cull the clusters of the visible models, and split those left into
+        jobs. */
+    GeometryJobBuffer jobs(allocator);
+
+    for (int n = 0; n < frame.visible_count; n++) {
+        const visible_model& visible = frame.visible_models[n];
+
+        this->queue_model_jobs(frame, jobs, *visible.model, camera,
+            visible.inside, n);
+    }
+
+    /*  Transform, light, assemble, clip and project the triangles of each
+        job, in parallel. */
+    geometry_frame geometry {
+        &camera_lights,
+        &world_lights,
+        {
+            camera.position(0),
+            camera.position(1),
+            camera.position(2),
+            0.0
+        },
+        this->projection_transform * camera_transform,
+        buffer_width,
+        buffer_height
+    };
+
+    this->worker_pool->run_on_threads(
+        jobs.size(),
+        [&](int job, unsigned int thread) {
+            this->process_geometry_job(frame, jobs[job], thread, geometry);
+        }
+    );
+
+    /*  Merge the triangles of the jobs, in job order, into one draw list.
+        The jobs of a model are consecutive. */
+    int drawn_models = 0;
+    int last_drawn_model = -1;
+
+    frame.draw_count = 0;
+
+    for (const geometry_job& job : jobs) {
+        frame.draw_count += job.active_count;
+
+        if (job.drawn && job.model_number != last_drawn_model) {
+            drawn_models ++;
+            last_drawn_model = job.model_number;
+        }
+    }
+
+    frame.draw_list = frame.arena.allocate_array<const Triangle*>(
+        frame.draw_count
+    );
+
+    int draw_index = 0;
+
+    for (const geometry_job& job : jobs) {
+        const geometry_thread& thread = *frame.geometry_threads[job.thread];
+        const int* indices = thread.active_indices.data() + job.first_active;
+
+        for (int n = 0; n < job.active_count; n++) {
+            frame.draw_list[draw_index++] = &thread.triangles[indices[n]];
+        }
+    }
+
+    for (const std::unique_ptr<geometry_thread>& thread :
+        frame.geometry_threads) {
+        const RenderStats& stats = thread->stats;
+
+        frame.stats.accepted += stats.accepted;
+        frame.stats.rejected += stats.rejected;
+        frame.stats.scissored += stats.scissored;
+        frame.stats.clipped += stats.clipped;
+        frame.stats.back_faces += stats.back_faces;
+    }
+
+    frame.stats.culled_models = frame.model_count - drawn_models;
+}
+
+bool Renderer::submit_scene(
+    System::RenderWindow& render_window,
+    const Scene& scene
+) {
+    if (this->pipeline_frames.empty()) {
+        this->start_pipeline();
+    }
+
+    frame_context* frame = nullptr;
+
+    {
+        std::lock_guard<std::mutex> lock(this->pipeline_mutex);
+
+        if (this->submitted_frames - this->returned_frames >=
+            MAX_FRAMES_IN_FLIGHT) {
+            return false;
+        }
+
+        frame = this->find_pipeline_frame(FrameStage::FREE);
+    }
+
+    /*  A free frame belongs to the calling thread until it is queued for the
+        geometry stage. */
+    frame->reset();
+
+    /*  Snapshot the scene, and the settings the frame is drawn with - the
+        pipeline threads only ever read the frame's copy of them, so the
+        Renderer's may be changed while frames are in flight. */
+    frame->settings = this->settings;
+
+    const std::vector<Model*>& models = scene.index != nullptr ?
+        scene.index->get_models() : scene.models;
+
+    frame->models.resize(models.size());
+
+    Model** copies = frame->arena.allocate_array<Model*>(models.size());
+
+    for (size_t n = 0; n < models.size(); n++) {
+        Model& copy = frame->models[n];
+
+        copy.mesh = models[n]->mesh;
+        copy.position = models[n]->position;
+        copy.scale = models[n]->scale;
+        copy.rotation = models[n]->rotation;
+        copy.is_static = models[n]->is_static;
+
+        copies[n] = &copy;
+    }
+
+    frame->lights.assign(scene.lights.begin(), scene.lights.end());
+    frame->camera.position = scene.camera.position;
+    frame->camera.rotation = scene.camera.rotation;
+
+    this->find_visible_models(*frame, scene, copies);
+
+    /*  The frame is drawn into buffers of the same size, pixel format and
+        depth format as the window's. */
+    render_window.set_max_inverse_depth(1.0 / this->view_plane_distance);
+
+    int width = render_window.get_width();
+    int height = render_window.get_height();
+    System::PixelFormat pixel_format = render_window.get_pixel_format();
+
+    frame->colour.resize((size_t) width * height);
+    frame->depth.resize(width, height, render_window.get_depth_format());
+    frame->depth.set_max_inverse_depth(1.0 / this->view_plane_distance);
+
+    frame->framebuffer = System::FramebufferView {};
+    frame->framebuffer.width = width;
+    frame->framebuffer.height = height;
+    frame->framebuffer.colour = frame->colour.data();
+    frame->framebuffer.colour_stride = width;
+    frame->framebuffer.red_shift = pixel_format.red_shift;
+    frame->framebuffer.green_shift = pixel_format.green_shift;
+    frame->framebuffer.blue_shift = pixel_format.blue_shift;
+    frame->depth.fill_view(frame->framebuffer);
+
+    {
+        std::lock_guard<std::mutex> lock(this->pipeline_mutex);
+        frame->number = this->submitted_frames ++;
+        frame->stage = FrameStage::GEOMETRY;
+    }
+
+    this->frame_changed.notify_all();
+
+    return true;
+}
+
+const System::FramebufferView* Renderer::wait_frame() {
+    std::unique_lock<std::mutex> lock(this->pipeline_mutex);
+
+    if (this->submitted_frames == this->returned_frames) {
+        return nullptr;
+    }
+
+    /*  Frames complete in order, so the oldest in flight is the next to. */
+    frame_context* frame = nullptr;
+
+    this->frame_changed.wait(lock, [&]() {
+        frame = this->find_pipeline_frame(FrameStage::COMPLETE);
+        return frame != nullptr;
+    });
+
+    frame_context* held = this->find_pipeline_frame(FrameStage::HELD);
+
+    if (held != nullptr) {
+        held->stage = FrameStage::FREE;
+    }
+
+    frame->stage = FrameStage::HELD;
+    this->returned_frames ++;
+    this->render_stats = frame->stats;
+
+    return &frame->framebuffer;
+}
+
+void Renderer::start_pipeline() {
+    /*  Enough frames for one in each stage, and one held by the caller. */
+    for (int i = 0; i < MAX_FRAMES_IN_FLIGHT + 1; i++) {
+        this->pipeline_frames.push_back(std::make_unique<frame_context>(
+            this->worker_pool->get_thread_count()
+        ));
+    }
+
+    this->geometry_stage_thread = std::thread(
+        &Renderer::run_geometry_stage_thread,
+        this
+    );
+    this->raster_stage_thread = std::thread(
+        &Renderer::run_raster_stage_thread,
+        this
+    );
+}
+
+void Renderer::run_geometry_stage_thread() {
+    while (true) {
+        frame_context* frame = nullptr;
+
+        {
+            std::unique_lock<std::mutex> lock(this->pipeline_mutex);
+            this->frame_changed.wait(lock, [&]() {
+                frame = this->find_pipeline_frame(FrameStage::GEOMETRY);
+                return this->stop_pipeline || frame != nullptr;
+            });
+
+            if (this->stop_pipeline) {
+                return;
+            }
+        }
+
+        this->run_geometry_stage(
+            *frame,
+            frame->camera,
+            frame->lights.data(),
+            frame->lights.size(),
+            frame->framebuffer.width,
+            frame->framebuffer.height
+        );
+
+        {
+            std::lock_guard<std::mutex> lock(this->pipeline_mutex);
+            frame->stage = FrameStage::RASTERISATION;
+        }
+
+        this->frame_changed.notify_all();
+    }
+}
+
+void Renderer::run_raster_stage_thread() {
+    while (true) {
+        frame_context* frame = nullptr;
+
+        {
+            std::unique_lock<std::mutex> lock(this->pipeline_mutex);
+            this->frame_changed.wait(lock, [&]() {
+                frame = this->find_pipeline_frame(FrameStage::RASTERISATION);
+                return this->stop_pipeline || frame != nullptr;
+            });
+
+            if (this->stop_pipeline) {
+                return;
+            }
+        }
+
+        std::fill(frame->colour.begin(), frame->colour.end(), 0);
+
+        this->rasterise_triangles(*frame, frame->framebuffer);
+
+        {
+            std::lock_guard<std::mutex> lock(this->pipeline_mutex);
+            frame->stage = FrameStage::COMPLETE;
+        }
+
+        this->frame_changed.notify_all();
+    }
+}
+
+Renderer::frame_context* Renderer::find_pipeline_frame(FrameStage stage) {
+    frame_context* oldest = nullptr;
+
+    for (std::unique_ptr<frame_context>& frame : this->pipeline_frames) {
+        if (frame->stage == stage &&
+            (oldest == nullptr || frame->number < oldest->number)) {
+            oldest = frame.get();
+        }
+    }
+
+    return oldest;
+}
+
+void copy_framebuffer(
+    const System::FramebufferView& frame,
+    System::RenderWindow& render_window
+) {
+    System::FramebufferView target = render_window.lock_framebuffer();
+
+    int width = std::min(frame.width, target.width);
+    int height = std::min(frame.height, target.height);
+
+    bool same_pixel_format = frame.red_shift == target.red_shift &&
+        frame.green_shift == target.green_shift &&
+        frame.blue_shift == target.blue_shift;
+    bool same_depth_format = frame.depth_format == target.depth_format &&
+        frame.depth_scale == target.depth_scale;
+
+    int depth_size = System::get_depth_format_size(frame.depth_format);
+
+    for (int y = 0; y < height; y++) {
+        const uint32_t* frame_row = frame.colour_row(y);
+        uint32_t* target_row = target.colour_row(y);
+
+        if (same_pixel_format) {
+            std::copy(frame_row, frame_row + width, target_row);
+        } else {
+            for (int x = 0; x < width; x++) {
+                target_row[x] = target.pack_colour(
+                    frame_row[x] >> frame.red_shift,
+                    frame_row[x] >> frame.green_shift,
+                    frame_row[x] >> frame.blue_shift);
+            }
+        }
+
+        if (same_depth_format) {
+            std::memcpy(target.depth_pixel(0, y), frame.depth_pixel(0, y),
+                width * depth_size);
+        } else {
+            for (int x = 0; x < width; x++) {
+                System::write_depth(target, x, y,
+                    System::read_depth(frame, x, y));
+            }
+        }
+    }
+
+    render_window.unlock_framebuffer();
+}
+
+void Renderer::set_rasteriser_mode(RasteriserMode mode) {
+    this->settings.rasteriser_mode = mode;
+}
+
+RasteriserMode Renderer::get_rasteriser_mode() {
+    return this->settings.rasteriser_mode;
+}
+
+void Renderer::set_rasteriser_precision(RasteriserPrecision precision) {
+    this->settings.rasteriser_precision = precision;
+}
+
+RasteriserPrecision Renderer::get_rasteriser_precision() {
+    return this->settings.rasteriser_precision;
+}
+
+RasteriserMode Renderer::get_frame_rasteriser_mode(
+    const frame_settings& settings
+) {
+    if (settings.rasteriser_precision == RasteriserPrecision::FIXED) {
+        return RasteriserMode::HALF_SPACE;
+    }
+
+    return settings.rasteriser_mode;
+}
+
+double Renderer::get_subpixel_scale(const frame_settings& settings) {
+    /*  FIXED implies the half-space rasteriser, which is the only one that
+        draws vertices between pixels. */
+    if (settings.rasteriser_precision == RasteriserPrecision::FIXED) {
+        return FIXED_SUBPIXEL_SCALE;
+    }
+
+    return 1.0;
+}
+
+void Renderer::set_depth_test(bool enabled) {
+    if (enabled) {
+        this->settings.depth_features |= SHADE_DEPTH_TEST;
+    } else {
+        this->settings.depth_features &= ~SHADE_DEPTH_TEST;
+    }
+}
+
+bool Renderer::get_depth_test() {
+    return (this->settings.depth_features & SHADE_DEPTH_TEST) != 0;
+}
+
+void Renderer::set_depth_write(bool enabled) {
+    if (enabled) {
+        this->settings.depth_features |= SHADE_DEPTH_WRITE;
+    } else {
+        this->settings.depth_features &= ~SHADE_DEPTH_WRITE;
+    }
+}
+
+bool Renderer::get_depth_write() {
+    return (this->settings.depth_features & SHADE_DEPTH_WRITE) != 0;
+}
+
+unsigned long long Renderer::get_frame_arena_allocation_count() {
+    unsigned long long count =
+        this->immediate_frame->get_heap_allocation_count();
+
+    for (std::unique_ptr<frame_context>& frame : this->pipeline_frames) {
+        count += frame->get_heap_allocation_count();
+    }
+
+    return count;
+}
+
+void Renderer::set_guard_band_scale(double scale) {
+    this->settings.guard_band_scale = std::min(
+        std::max(scale, 1.0),
+        MAX_GUARD_BAND_SCALE
+    );
+}
+
+double Renderer::get_guard_band_scale() {
+    return this->settings.guard_band_scale;
+}
+
+void Renderer::set_far_plane_distance(double distance) {
+    this->settings.far_plane_distance = std::max(
+        distance,
+        2.0 * this->view_plane_distance
+    );
+}
+
+double Renderer::get_far_plane_distance() {
+    return this->settings.far_plane_distance;
+}
+
+RenderStats Renderer::get_render_stats() {
+    return this->render_stats;
+}
+
+void Renderer::convert_lights_to_camera_space(
+    LightBuffer& lights,
+    const Maths::Matrix<double, 4, 4>& camera_transform
+) {
+    for (Light& l : lights) {
+        l.vec = camera_transform * l.vec;
+    }
+}
+
+/*  Allocate a stream of count points from the frame arena. */
+static point_stream allocate_point_stream(FrameArena& arena, size_t count) {
+    return point_stream {
+        arena.allocate_array<double>(count),
+        arena.allocate_array<double>(count),
+        arena.allocate_array<double>(count),
+        arena.allocate_array<double>(count)
+    };
+}
+
+void Renderer::process_model_vertices(
+    const frame_settings& settings,
+    PointBuffer& vertices,
+    const Maths::Matrix<double, 4, 4>& transform,
+    const Maths::Matrix<double, 4, 4>& normal_matrix,
+    const LightBuffer& lights,
+    const Mesh& mesh,
+    const int* mesh_indices,
+    size_t count,
+    FrameArena& arena
+) {
+    /*  Transform the positions and normals as streams, in place. */
+    point_stream positions = allocate_point_stream(arena, count);
+    point_stream normals = allocate_point_stream(arena, count);
+
+    for (size_t n = 0; n < count; n++) {
+        const Vertex& v = mesh.vertices[mesh_indices[n]];
+
+        positions.x[n] = v.pos(0);
+        positions.y[n] = v.pos(1);
+        positions.z[n] = v.pos(2);
+        positions.w[n] = v.pos(3);
+
+        normals.x[n] = v.normal(0);
+        normals.y[n] = v.normal(1);
+        normals.z[n] = v.normal(2);
+        normals.w[n] = v.normal(3);
+    }
+
+    /*  Lighting is done in camera space, but clip space positions are
+        passed on to the rest of the pipeline. */
+    point_stream clip_positions = allocate_point_stream(arena, count);
+
+    transform_points(transform, positions, positions, count);
+    transform_points(normal_matrix, normals, normals, count);
+    transform_points(
+        this->projection_transform,
+        positions,
+        clip_positions,
+        count
+    );
+
+    for (size_t n = 0; n < count; n++) {
+        double length_sq = normals.x[n] * normals.x[n] +
+            normals.y[n] * normals.y[n] +
+            normals.z[n] * normals.z[n] +
+            normals.w[n] * normals.w[n];
+
+        if (length_sq > 0.0) {
+            double scale = 1.0 / std::sqrt(length_sq);
+
+            normals.x[n] *= scale;
+            normals.y[n] *= scale;
+            normals.z[n] *= scale;
+            normals.w[n] *= scale;
+        }
+    }
+
+    this->shade_vertices(
+        settings,
+        vertices,
+        positions,
+        normals,
+        clip_positions,
+        lights,
+        Maths::Vector<double, 4> { 0.0, 0.0, 0.0, 0.0 },
+        mesh,
+        mesh_indices,
+        count
+    );
+}
+
+void Renderer::process_static_vertices(
+    const frame_settings& settings,
+    PointBuffer& vertices,
+    const world_vertices& world,
+    const Maths::Matrix<double, 4, 4>& clip_transform,
+    const LightBuffer& lights,
+    const Maths::Vector<double, 4>& eye,
+    const Mesh& mesh,
+    const int* mesh_indices,
+    size_t count,
+    FrameArena& arena
+) {
+    /*  The baked normals are already unit length, so the only per vertex
+        matrix work is the transform to clip space. */
+    point_stream positions = allocate_point_stream(arena, count);
+    point_stream normals = allocate_point_stream(arena, count);
+
+    for (size_t n = 0; n < count; n++) {
+        int index = mesh_indices[n];
+
+        positions.x[n] = world.x[index];
+        positions.y[n] = world.y[index];
+        positions.z[n] = world.z[index];
+        positions.w[n] = 1.0;
+
+        normals.x[n] = world.normal_x[index];
+        normals.y[n] = world.normal_y[index];
+        normals.z[n] = world.normal_z[index];
+        normals.w[n] = 0.0;
+    }
+
+    point_stream clip_positions = allocate_point_stream(arena, count);
+
+    transform_points(clip_transform, positions, clip_positions, count);
+
+    this->shade_vertices(
+        settings,
+        vertices,
+        positions,
+        normals,
+        clip_positions,
+        lights,
+        eye,
+        mesh,
+        mesh_indices,
+        count
+    );
+}
+
+void Renderer::shade_vertices(
+    const frame_settings& settings,
+    PointBuffer& vertices,
+    const point_stream& positions,
+    const point_stream& normals,
+    const point_stream& clip_positions,
+    const LightBuffer& lights,
+    const Maths::Vector<double, 4>& eye,
+    const Mesh& mesh,
+    const int* mesh_indices,
+    size_t count
+) {
+    for (size_t n = 0; n < count; n++) {
+        const Vertex& v = mesh.vertices[mesh_indices[n]];
+        Point point {};
+
+        point.pos = {
+            positions.x[n],
+            positions.y[n],
+            positions.z[n],
+            positions.w[n]
+        };
+        point.r = v.r;
+        point.g = v.g;
+        point.b = v.b;
+        point.tex_x = v.tex_x;
+        point.tex_y = v.tex_y;
+
+        Maths::Vector<double, 4> normal {
+            normals.x[n],
+            normals.y[n],
+            normals.z[n],
+            normals.w[n]
+        };
+
+        this->compute_vertex_lighting(point, normal, lights, eye);
+
+        point.pos = {
+            clip_positions.x[n],
+            clip_positions.y[n],
+            clip_positions.z[n],
+            clip_positions.w[n]
+        };
+        point.outcode = this->compute_outcode(settings, point.pos);
+
+        vertices.push_back(point);
+    }
+}
+
+void Renderer::compute_vertex_lighting(
+    Point& point,
+    const Maths::Vector<double, 4>& normal,
+    const LightBuffer& lights,
+    const Maths::Vector<double, 4>& eye
+) {
+    /*  Iterate through lights. */
+    for (int i = 0; i < lights.size(); i++) {
+        /*  Determine type. */
+        if (lights[i].type == Graphics::LightType::AMBIENT) {
+            point.i += lights[i].intensity;
+        } else if (lights[i].type == Graphics::LightType::DIRECTION) {
+            /*  Compute dot with light direction. */
+            double angle_intensity = Maths::dot(
+                normal,
+                Maths::normalise(lights[i].vec)
+            );
+
+            point.i += angle_intensity * lights[i].intensity;
+        } else if (lights[i].type == Graphics::LightType::POINT) {
+            /*  Compute angle with vertex. */
+            Maths::Vector<double, 4> direction = Maths::normalise(
+                point.pos - lights[i].vec
+            );
+
+            double scale = Maths::dot(
+                direction,
+                Maths::normalise(point.pos - eye)
+            );
+
+            point.i += scale * lights[i].intensity;
+        }
+    }
+
+    /*  Clamp intensity to range (0, 1). */
+    if (point.i < 0.0) {
+        point.i = 0.0;
+    } else if (point.i > 1.0) {
+        point.i = 1.0;
+    }
+}
 
-void Renderer::render_scene(
-    System::RenderWindow& render_window,
-    const Scene& scene
+void Renderer::assemble_triangles(
+    TriangleBuffer& triangles,
+    IndexBuffer& active_indices,
+    const PointBuffer& vertices,
+    size_t first_vertex,
+    const int* faces,
+    int face_count,
+    const int* slots,
+    Resources::TrueColourBitmap* bitmap_ptr
 ) {
-    render_window.reset_depth_buffer();
+    const Point* model_vertices = vertices.data() + first_vertex;
+
+    for (int f = 0; f < face_count; f++) {
+        const int* face = faces + f * 3;
+
+        triangles.push_back(Triangle {
+            {
+                model_vertices[slots[face[0]]],
+                model_vertices[slots[face[1]]],
+                model_vertices[slots[face[2]]]
+            },
+            bitmap_ptr
+        });
 
-    std::vector<Triangle> triangles;
-    std::list<int> active_indices;
+        active_indices.push_back(triangles.size() - 1);
+    }
+}
 
-    size_t triangle_count = 0;
+/*  Clip space planes, in outcode bit order. The first NUM_CLIP_PLANES are
+    clipped against - the near and far planes and the guard band. The screen
+    planes are only used to reject triangles and to count those scissored. */
+enum {
+    CLIP_NEAR,
+    CLIP_FAR,
+    CLIP_GUARD_LEFT,
+    CLIP_GUARD_RIGHT,
+    CLIP_GUARD_BOTTOM,
+    CLIP_GUARD_TOP,
+    CLIP_SCREEN_LEFT,
+    CLIP_SCREEN_RIGHT,
+    CLIP_SCREEN_BOTTOM,
+    CLIP_SCREEN_TOP
+};
+
+static constexpr unsigned int CLIPPED_PLANES_MASK = (1u << CLIP_SCREEN_LEFT) -
+    1;
+
+/*  Points outside of the guard band are also outside of the screen, so the
+    near, far and screen planes are enough to reject triangles. */
+static constexpr unsigned int REJECT_PLANES_MASK = (1u << CLIP_NEAR) |
+    (1u << CLIP_FAR) |
+    (1u << CLIP_SCREEN_LEFT) | (1u << CLIP_SCREEN_RIGHT) |
+    (1u << CLIP_SCREEN_BOTTOM) | (1u << CLIP_SCREEN_TOP);
+
+unsigned int Renderer::compute_outcode(
+    const frame_settings& settings,
+    const Maths::Vector<double, 4>& pos
+) {
+    double x = pos(0);
+    double y = pos(1);
+    double w = pos(3);
+    double guard_w = settings.guard_band_scale * w;
+
+    return (w < this->view_plane_distance ? 1u << CLIP_NEAR : 0u) |
+        (w > settings.far_plane_distance ? 1u << CLIP_FAR : 0u) |
+        (x < this->screen_left_bound * guard_w ? 1u << CLIP_GUARD_LEFT : 0u) |
+        (x > this->screen_right_bound * guard_w ? 1u << CLIP_GUARD_RIGHT : 0u) |
+        (y < this->screen_bottom_bound * guard_w ?
+            1u << CLIP_GUARD_BOTTOM : 0u) |
+        (y > this->screen_top_bound * guard_w ? 1u << CLIP_GUARD_TOP : 0u) |
+        (x < this->screen_left_bound * w ? 1u << CLIP_SCREEN_LEFT : 0u) |
+        (x > this->screen_right_bound * w ? 1u << CLIP_SCREEN_RIGHT : 0u) |
+        (y < this->screen_bottom_bound * w ? 1u << CLIP_SCREEN_BOTTOM : 0u) |
+        (y > this->screen_top_bound * w ? 1u << CLIP_SCREEN_TOP : 0u);
+}
 
-    for (const Model* m : scene.models) {
-        /*  Transform with respect to world space. */
-        Maths::Matrix<double, 4, 4>  matrix_model = model_transform(*m);
+static constexpr double RIGHT_ANGLE = 1.57079632679489661923;
+
+/*  Whether every face of a cluster faces away from a point (in model
+    space). Each face normal n is within cone_angle of the cone axis, and
+    each point p of the cluster is within its bounding sphere, so seen from
+    eye the direction p - eye is within asin(radius / distance) of the
+    direction to the centre. If the angles between all such n and p - eye
+    are less than 90 degrees then dot(n, p - eye) > 0 for every face, i.e.
+    all of them are back faces. */
+static bool is_cluster_back_facing(
+    const MeshCluster& cluster,
+    const Maths::Vector<double, 4>& eye
+) {
+    Maths::Vector<double, 4> offset = cluster.centre - eye;
+    double distance = std::sqrt(Maths::dot(offset, offset));
 
-        /*  Transform triangles to worldspace. */
-        for (const Triangle& t : m->mesh->triangles) {
-            triangles.push_back(this->transform_triangle(t, matrix_model));
-            active_indices.push_back(triangle_count);
-            triangle_count ++;
-        }
+    if (distance <= cluster.radius) {
+        return false;
     }
 
-    /*  Transform triangles to camera space. */
-    this->convert_triangles_to_camera_space(
-        triangles,
-        active_indices,
-        scene.camera
+    double angle = std::acos(std::min(std::max(
+        Maths::dot(cluster.cone_axis, offset) / distance,
+        -1.0
+    ), 1.0));
+
+    return angle + cluster.cone_angle + std::asin(cluster.radius / distance) <
+        RIGHT_ANGLE;
+}
+
+bool Renderer::queue_model_jobs(
+    frame_context& frame,
+    GeometryJobBuffer& jobs,
+    const Model& model,
+    const Camera& camera,
+    bool inside,
+    int model_number
+) {
+    const Mesh& mesh = *model.mesh;
+    const Maths::Matrix<double, 4, 4>& transform =
+        model_view_transform(model, camera);
+    Containment containment = inside ? Containment::INSIDE :
+        this->classify_model(frame.settings, model, transform);
+
+    if (containment == Containment::OUTSIDE) {
+        return false;
+    }
+
+    /*  Which side of a face the camera is on is unchanged by the model
+        transform, unless it is a reflection (which reverses the winding
+        order) - so back faces are culled against the camera in model space,
+        before any vertices are transformed. */
+    double scale_determinant = model.scale(0) * model.scale(1) *
+        model.scale(2);
+    double orientation = scale_determinant > 0.0 ? 1.0 :
+        scale_determinant < 0.0 ? -1.0 : 0.0;
+    Maths::Vector<double, 4> camera_position {
+        camera.position(0),
+        camera.position(1),
+        camera.position(2),
+        1.0
+    };
+    Maths::Vector<double, 4> eye = inverse_model_transform(model) *
+        camera_position;
+
+    MeshCluster* clusters = frame.arena.allocate_array<MeshCluster>(
+        std::max(mesh.clusters.size(), (size_t) 1)
     );
+    int cluster_count = 0;
+
+    if (mesh.clusters.empty()) {
+        /*  The whole mesh as one cluster, with no normal cone. */
+        clusters[cluster_count++] = MeshCluster {
+            0,
+            (int) mesh.indices.size(),
+            0,
+            (int) mesh.vertices.size(),
+            mesh.bounds,
+            mesh.bounds_centre,
+            mesh.bounds_radius,
+            Maths::Vector<double, 4> { 0.0, 0.0, 0.0, 0.0 },
+            MESH_CLUSTER_NO_CONE
+        };
+    } else {
+        bool cull_back_faces = orientation > 0.0;
+
+        auto add_cluster = [&](int cluster) {
+            const MeshCluster& c = mesh.clusters[cluster];
+
+            if (cull_back_faces && is_cluster_back_facing(c, eye)) {
+                frame.stats.back_face_culled_clusters ++;
+            } else {
+                clusters[cluster_count++] = c;
+            }
+        };
+
+        /*  Find the clusters in view - all of them if the model is entirely
+            inside the visible region. */
+        unsigned int clusters_in_view = 0;
+
+        if (containment == Containment::INSIDE) {
+            for (size_t c = 0; c < mesh.clusters.size(); c++) {
+                add_cluster(c);
+            }
 
-    /*  Transform lights into camera space. */
-    std::vector<Light> lights = scene.lights;
-    this->convert_lights_to_camera_space(lights, scene.camera);
+            clusters_in_view = mesh.clusters.size();
+        } else {
+            Maths::Matrix<double, 4, 4> clip_transform =
+                this->projection_transform * transform;
+
+            mesh.cluster_bvh.query(
+                [&](const bounding_box& box) {
+                    return this->classify_box(frame.settings, clip_transform,
+                        box);
+                },
+                [&](int cluster, bool) {
+                    add_cluster(cluster);
+                    clusters_in_view ++;
+                }
+            );
+        }
 
-    /*  Cull back faces. */
-    this->cull_triangle_back_faces(triangles, active_indices);
+        frame.stats.clusters += mesh.clusters.size();
+        frame.stats.frustum_culled_clusters += mesh.clusters.size() -
+            clusters_in_view;
 
-    /*  Compute lighting at each vertex (Gouraud Shading). */
-    this->compute_triangle_lighting(triangles, active_indices, lights);
+        if (cluster_count == 0) {
+            return false;
+        }
+    }
 
-    /*  Clip against near plane in 3d. */
-    this->clip_near_plane(triangles, active_indices);
+    const Maths::Matrix<double, 4, 4>& normal_matrix =
+        model_view_normal_transform(model, camera);
+    const world_vertices* world = model.is_static ?
+        &get_world_vertices(model) : nullptr;
 
-    /*  Project triangles into clip space - preserving z coordinate for
-        depth comparisons and comparing against the near and far planes. */
-    this->perspective_project_triangles(triangles, active_indices);
+    /*  Split the clusters, in order, into runs of about
+        GEOMETRY_JOB_TRIANGLES triangles. */
+    for (int first = 0; first < cluster_count; ) {
+        int end = first;
+        int job_triangles = 0;
 
-    /*  Clip triangles against screen bounds. */
-    this->clip_screen_bounds(triangles, active_indices);
+        while (end < cluster_count && job_triangles < GEOMETRY_JOB_TRIANGLES) {
+            job_triangles += clusters[end].index_count / 3;
+            end ++;
+        }
 
-    /*  Convert triangles to pixel space. */
-    this->convert_triangles_to_pixel_space(
-        triangles,
-        active_indices,
-        render_window.get_width(),
-        render_window.get_height()
-    );
+        jobs.push_back(geometry_job {
+            &model,
+            &transform,
+            &normal_matrix,
+            world,
+            eye,
+            orientation,
+            clusters + first,
+            end - first,
+            model_number
+        });
+
+        first = end;
+    }
 
-    /*  Raterise triangles. */
-    this->rasterise_triangles(render_window, triangles, active_indices);
+    return true;
 }
 
-inline Triangle Renderer::transform_triangle(
-    const Triangle& triangle,
-    const Maths::Matrix<double, 4, 4>& transform
+void Renderer::process_geometry_job(
+    frame_context& context,
+    geometry_job& job,
+    unsigned int thread,
+    const geometry_frame& frame
 ) {
-    /*  Copy all points to preserve vertex attributes. */
-    Triangle res = triangle;
+    geometry_thread& worker = *context.geometry_threads[thread];
+    const Mesh& mesh = *job.model->mesh;
+    const MeshCluster* clusters = job.clusters;
+    int cluster_count = job.cluster_count;
+    FrameArena& arena = worker.arena;
+
+    job.thread = thread;
+    job.first_active = worker.active_indices.size();
+
+    /*  Each vertex of the clusters has a slot, which is -1 until a front
+        face uses it. */
+    int slot_count = 0;
+    int max_faces = 0;
+
+    for (int c = 0; c < cluster_count; c++) {
+        slot_count += clusters[c].vertex_count;
+        max_faces += clusters[c].index_count / 3;
+    }
 
-    for (int i = 0; i < 3; i++) {
-        res.points[i].pos = transform * triangle.points[i].pos;
+    int* slots = arena.allocate_array<int>(slot_count);
+    int* faces = arena.allocate_array<int>(max_faces * 3);
+    int face_count = 0;
+
+    std::fill(slots, slots + slot_count, -1);
+
+    /*  A face is a back face if its normal points away from the camera, i.e.
+        has a positive dot product with the vector from the camera to any of
+        its vertices. Edge on faces are kept. */
+    bool has_face_normals = mesh.face_normals.size() ==
+        mesh.get_triangle_count();
+
+    for (int c = 0, slot_base = 0; c < cluster_count; c++) {
+        const MeshCluster& cluster = clusters[c];
+        int end_index = cluster.first_index + cluster.index_count -
+            cluster.index_count % 3;
+
+        for (int n = cluster.first_index; n < end_index; n += 3) {
+            const int* face = mesh.indices.data() + n;
+            const Maths::Vector<double, 4>& p0 = mesh.vertices[face[0]].pos;
+            Maths::Vector<double, 4> normal = has_face_normals ?
+                mesh.face_normals[n / 3] :
+                Maths::cross(
+                    mesh.vertices[face[1]].pos - p0,
+                    mesh.vertices[face[2]].pos - p0
+                );
+
+            if (job.orientation * Maths::dot(normal, p0 - job.eye) > 0.0) {
+                worker.stats.back_faces ++;
+                continue;
+            }
+
+            for (int k = 0; k < 3; k++) {
+                int slot = slot_base + face[k] - cluster.first_vertex;
+
+                slots[slot] = 0;
+                faces[face_count * 3 + k] = slot;
+            }
+
+            face_count ++;
+        }
+
+        slot_base += cluster.vertex_count;
     }
 
-    return res;
-}
+    if (face_count == 0) {
+        return;
+    }
 
-void Renderer::build_triangles_list_from_models(
-    std::vector<Triangle>& triangles,
-    std::list<int>& active_indices,
-    std::vector<Model*>& models
-) {
-    for (const Model* m : models) {
-        Maths::Matrix<double, 4, 4> model_transform_matrix
-            = model_transform(*m);
-        
-        for (const Triangle& t : m->mesh->triangles) {
-            triangles.push_back(transform_triangle(t, model_transform_matrix));
-            active_indices.push_back(triangles.size() - 1);
+    job.drawn = true;
+
+    /*  Gather the vertices used by front faces, numbering their slots in
+        order. */
+    int* sources = arena.allocate_array<int>(slot_count);
+    int source_count = 0;
+
+    for (int c = 0, slot_base = 0; c < cluster_count; c++) {
+        const MeshCluster& cluster = clusters[c];
+
+        for (int n = 0; n < cluster.vertex_count; n++) {
+            if (slots[slot_base + n] >= 0) {
+                slots[slot_base + n] = source_count;
+                sources[source_count++] = cluster.first_vertex + n;
+            }
         }
+
+        slot_base += cluster.vertex_count;
     }
-}
 
-static inline Maths::Matrix<double, 4, 4> get_camera_transform(
-    const Camera& camera
-) {
-    return Maths::make_rotation_world(
-        -camera.rotation(0),
-        -camera.rotation(1),
-        -camera.rotation(2)
-    ) * Maths::make_translation(
-        -camera.position(0),
-        -camera.position(1),
-        -camera.position(2)
+    PointBuffer& vertices = worker.vertices;
+
+    vertices.clear();
+    vertices.reserve(source_count);
+
+    if (job.world != nullptr) {
+        this->process_static_vertices(
+            context.settings,
+            vertices,
+            *job.world,
+            frame.clip_transform,
+            *frame.world_lights,
+            frame.eye_offset,
+            mesh,
+            sources,
+            source_count,
+            arena
+        );
+    } else {
+        this->process_model_vertices(
+            context.settings,
+            vertices,
+            *job.transform,
+            *job.normal_matrix,
+            *frame.lights,
+            mesh,
+            sources,
+            source_count,
+            arena
+        );
+    }
+
+    this->assemble_triangles(
+        worker.triangles,
+        worker.active_indices,
+        vertices,
+        0,
+        faces,
+        face_count,
+        slots,
+        mesh.bitmap_ptr
+    );
+
+    /*  Clip against the near and far planes and screen bounds in clip
+        space. */
+    this->clip_triangles(
+        context.settings,
+        worker.triangles,
+        worker.active_indices,
+        job.first_active,
+        worker.stats
+    );
+
+    /*  Project triangles onto the view plane - preserving depth for
+        depth comparisons. */
+    this->perspective_project_triangles(
+        worker.triangles,
+        worker.active_indices,
+        job.first_active,
+        arena
+    );
+
+    /*  Convert triangles to pixel space. */
+    this->convert_triangles_to_pixel_space(
+        context.settings,
+        worker.triangles,
+        worker.active_indices,
+        job.first_active,
+        frame.buffer_width,
+        frame.buffer_height,
+        arena
     );
+
+    job.active_count = worker.active_indices.size() - job.first_active;
 }
 
-void Renderer::convert_triangles_to_camera_space(
-    std::vector<Triangle>& triangles,
-    std::list<int>& active_indices,
-    const Camera& camera
+Containment Renderer::classify_model(
+    const frame_settings& settings,
+    const Model& model,
+    const Maths::Matrix<double, 4, 4>& transform
 ) {
-    /*  Build camera transformation - first we translate all the world
-        by the reverse of the camera position to move the "camera" to the
-        centre of the scene. Then we rotate, also by the reverse of the
-        camera, and in the order y-axis, then x-axis, then z-axis. */
-    Maths::Matrix<double, 4, 4> camera_transform = get_camera_transform(camera);
+    const Mesh& mesh = *model.mesh;
+
+    if (mesh.vertices.empty()) {
+        return Containment::OUTSIDE;
+    }
 
-    std::list<int>::iterator itr = active_indices.begin();
+    /*  The bounding sphere in camera space - the camera transform is a rigid
+        motion, so only the model's scale changes the radius. */
+    Maths::Vector<double, 4> centre = transform * mesh.bounds_centre;
+    double radius = mesh.bounds_radius * std::max({
+        std::fabs(model.scale(0)),
+        std::fabs(model.scale(1)),
+        std::fabs(model.scale(2))
+    });
+
+    /*  Signed distances of the centre from the planes bounding the visible
+        region, positive inside. In camera space the clip space plane
+        x = screen_left_bound * w is view_plane_distance * x =
+        screen_left_bound * z, and similarly for the other screen planes. */
+    double d = this->view_plane_distance;
+    double x = centre(0);
+    double y = centre(1);
+    double z = centre(2);
+
+    double distances[] = {
+        z - d,
+        settings.far_plane_distance - z,
+        (d * x - this->screen_left_bound * z) /
+            std::hypot(d, this->screen_left_bound),
+        (this->screen_right_bound * z - d * x) /
+            std::hypot(d, this->screen_right_bound),
+        (d * y - this->screen_bottom_bound * z) /
+            std::hypot(d, this->screen_bottom_bound),
+        (this->screen_top_bound * z - d * y) /
+            std::hypot(d, this->screen_top_bound)
+    };
 
-    while (itr != active_indices.end()) {
-        Triangle* curr_triangle = &triangles[*itr];
+    bool inside = true;
 
-        *curr_triangle = this->transform_triangle(
-            *curr_triangle,
-            camera_transform
-        );
+    for (double distance : distances) {
+        if (distance < -radius) {
+            return Containment::OUTSIDE;
+        }
+
+        inside = inside && distance >= radius;
+    }
 
-        itr ++;
+    if (inside) {
+        return Containment::INSIDE;
     }
+
+    /*  The sphere crosses a plane, so try the box. */
+    return this->classify_box(settings,
+        this->projection_transform * transform, mesh.bounds);
 }
 
-void Renderer::convert_lights_to_camera_space(
-    std::vector<Light>& lights,
-    const Camera& camera
+Containment Renderer::classify_box(
+    const frame_settings& settings,
+    const Maths::Matrix<double, 4, 4>& clip_transform,
+    const bounding_box& box
 ) {
-    Maths::Matrix<double, 4, 4> transform = get_camera_transform(camera);
-    
-    for (Light& l : lights) {
-        l.vec = transform * l.vec;
+    /*  The box is outside if all of its corners are outside of the same
+        plane, and inside if none of them are outside of any plane. */
+    unsigned int all_outcodes = REJECT_PLANES_MASK;
+    unsigned int any_outcodes = 0;
+
+    for (int corner = 0; corner < 8; corner++) {
+        Maths::Vector<double, 4> pos {
+            (corner & 1 ? box.max : box.min)(0),
+            (corner & 2 ? box.max : box.min)(1),
+            (corner & 4 ? box.max : box.min)(2),
+            1.0
+        };
+
+        unsigned int outcode = this->compute_outcode(settings,
+            clip_transform * pos) &
+            REJECT_PLANES_MASK;
+
+        all_outcodes &= outcode;
+        any_outcodes |= outcode;
+    }
+
+    if (all_outcodes != 0) {
+        return Containment::OUTSIDE;
     }
+
+    return any_outcodes == 0 ? Containment::INSIDE : Containment::CROSSING;
 }
 
-void Renderer::cull_triangle_back_faces(
-    std::vector<Triangle>& triangles,
-    std::list<int>& active_indices
+double Renderer::clip_plane_distance(
+    const frame_settings& settings,
+    int plane,
+    const Maths::Vector<double, 4>& pos
 ) {
-    std::list<int>::iterator itr = active_indices.begin();
+    double guard_w = settings.guard_band_scale * pos(3);
 
-    Maths::Vector<double, 4> view_dir { 0.0, 0.0, 1.0, 0.0 };
+    switch (plane) {
+        case CLIP_NEAR: {
+            return pos(3) - this->view_plane_distance;
+        }
 
-    while (itr != active_indices.end()) {
-        Triangle* curr_triangle = &triangles[*itr];
+        case CLIP_FAR: {
+            return settings.far_plane_distance - pos(3);
+        }
 
-        /*  Determine normal via cross product. Since we are in camera space at
-            this stage, if the normal points away from the camera, this is a back
-            face and cannot be seen. */
-        Maths::Vector<double, 4> side_1 = curr_triangle->points[1].pos -
-            curr_triangle->points[0].pos;
-        Maths::Vector<double, 4> side_2 = curr_triangle->points[2].pos -
-            curr_triangle->points[0].pos;
+        case CLIP_GUARD_LEFT: {
+            return pos(0) - this->screen_left_bound * guard_w;
+        }
 
-        Maths::Vector<double, 4> normal = Maths::cross(side_1, side_2);
+        case CLIP_GUARD_RIGHT: {
+            return this->screen_right_bound * guard_w - pos(0);
+        }
 
-        double dot = Maths::dot(normal, curr_triangle->points[0].pos);
+        case CLIP_GUARD_BOTTOM: {
+            return pos(1) - this->screen_bottom_bound * guard_w;
+        }
 
-        if (dot > 0) {
-            itr = active_indices.erase(itr);
-        } else {
-            itr ++;
+        default: {
+            return this->screen_top_bound * guard_w - pos(1);
         }
     }
 }
 
-void Renderer::compute_triangle_lighting(
-    std::vector<Triangle>& triangles,
-    const std::list<int>& active_indices,
-    const std::vector<Light>& lights
+/*  The point a fraction t of the way from point_1 to point_2. Attributes are
+    interpolated linearly in clip space, which is correct as they have not yet
+    been divided by depth. */
+static Point interpolate_point(
+    const Point& point_1,
+    const Point& point_2,
+    double t
 ) {
-    /*  Iterate through active triangles, compute normals and compute
-        intensities. */
-    std::list<int>::const_iterator itr = active_indices.begin();
+    Point res {};
 
-    while (itr != active_indices.end()) {
-        Triangle* curr_triangle = &triangles[*itr];
+    res.pos = point_1.pos + t * (point_2.pos - point_1.pos);
+    res.i = point_1.i + t * (point_2.i - point_1.i);
+    res.r = point_1.r + t * (point_2.r - point_1.r);
+    res.g = point_1.g + t * (point_2.g - point_1.g);
+    res.b = point_1.b + t * (point_2.b - point_1.b);
+    res.tex_x = point_1.tex_x + t * (point_2.tex_x - point_1.tex_x);
+    res.tex_y = point_1.tex_y + t * (point_2.tex_y - point_1.tex_y);
 
-        /*  Iterate through lights. */
-        for (int i = 0; i < lights.size(); i++) {
-            /*  Determine type. */
-            if (lights[i].type == Graphics::LightType::AMBIENT) {
-                for (int j = 0; j < 3; j++) {
-                    curr_triangle->points[j].i += lights[i].intensity;
-                }
-            } else if (lights[i].type == Graphics::LightType::DIRECTION) {
-                /*  Compute normal. */
-                Maths::Vector<double, 4> vec_1 = curr_triangle->points[1].pos -
-                    curr_triangle->points[0].pos;
-                Maths::Vector<double, 4> vec_2 = curr_triangle->points[2].pos -
-                    curr_triangle->points[0].pos;
-                Maths::Vector<double, 4> normal =
-                    Maths::normalise(Maths::cross(vec_1, vec_2));
-
-                /*  Compute dot with light direction. */
-                double angle_intensity = Maths::dot(
-                    normal,
-                    Maths::normalise(lights[i].vec)
-                );
+    return res;
+}
 
-                for (int j = 0; j < 3; j++) {
-                    curr_triangle->points[j].i += angle_intensity *
-                        lights[i].intensity;
-                }
-            } else if (lights[i].type == Graphics::LightType::POINT) {
-                /*  Compute angle with each vertex. */
-                for (int j = 0; j < 3; j++) {
-                    Maths::Vector<double, 4> direction = Maths::normalise(
-                        curr_triangle->points[j].pos - lights[i].vec
-                    );
-
-                    double scale = Maths::dot(
-                        direction,
-                        Maths::normalise(curr_triangle->points[j].pos)
-                    );
-
-                    curr_triangle->points[j].i += scale *
-                        lights[i].intensity;
+int Renderer::clip_polygon(
+    const frame_settings& settings,
+    Point polygon[],
+    int num_vertices,
+    unsigned int planes
+) {
+    Point clipped[MAX_CLIPPED_VERTICES];
+
+    for (int plane = 0; plane < NUM_CLIP_PLANES; plane++) {
+        if (!(planes & (1u << plane))) {
+            continue;
+        }
+
+        int num_clipped = 0;
+
+        for (int i = 0; i < num_vertices; i++) {
+            const Point& curr = polygon[i];
+            const Point& next = polygon[(i + 1) % num_vertices];
+
+            double curr_distance = this->clip_plane_distance(settings, plane,
+                curr.pos);
+            double next_distance = this->clip_plane_distance(settings, plane,
+                next.pos);
+
+            if (curr_distance >= 0) {
+                clipped[num_clipped] = curr;
+                num_clipped ++;
+            }
+
+            /*  The edge crosses the plane - add the intersection. It is
+                always found from the inside vertex, so that an edge shared by
+                two triangles (and so traversed in opposite directions) is cut
+                at exactly the same point for both. */
+            if ((curr_distance >= 0) != (next_distance >= 0)) {
+                if (curr_distance >= 0) {
+                    clipped[num_clipped] = interpolate_point(curr, next,
+                        curr_distance / (curr_distance - next_distance));
+                } else {
+                    clipped[num_clipped] = interpolate_point(next, curr,
+                        next_distance / (next_distance - curr_distance));
                 }
+
+                num_clipped ++;
             }
         }
 
-        /*  Clamp intensities to range (0, 1). */
-        for (int i = 0; i < 3; i++) {
-            if (curr_triangle->points[i].i < 0.0) {
-                curr_triangle->points[i].i = 0.0;
-            } else if (curr_triangle->points[i].i > 1.0) {
-                curr_triangle->points[i].i = 1.0;
-            }
+        num_vertices = num_clipped;
+
+        for (int i = 0; i < num_vertices; i++) {
+            polygon[i] = clipped[i];
         }
 
-        itr ++;
+        if (num_vertices == 0) {
+            break;
+        }
     }
+
+    return num_vertices;
 }
 
 /*  Make triangles from vertex array - assumes that vertices are in
@@ -268,11 +1603,10 @@ void Renderer::compute_triangle_lighting(
     polygon. */
 int Renderer::make_triangles(
     int num_vertices,
-    Point in_points[4],
-    Triangle out_triangles[2],
+    const Point in_points[],
+    Triangle out_triangles[],
     Resources::TrueColourBitmap* bitmap_ptr
 ) {
-    int vertex_counter = 0;
     int triangle_count = 0;
 
     /*  Form a triangle out of the first vertex and every subsequent
@@ -292,57 +1626,92 @@ int Renderer::make_triangles(
     return triangle_count;
 }
 
-/*  To clip the active triangles against the near plane, we invoke the
-    clip_triangles member function with lambdas for determining whether a
-    vertex is in the viewing plane and for finding intersects with the
-    viewing plane. Note that the terms "viewing plane" and "near plane"
-    refer to the same thing. */
-void Renderer::clip_near_plane(
-    std::vector<Triangle>& triangles,
-    std::list<int>& active_indices
+void Renderer::clip_triangles(
+    const frame_settings& settings,
+    TriangleBuffer& triangles,
+    IndexBuffer& active_indices,
+    size_t first_active,
+    RenderStats& stats
 ) {
-    clip_triangles(
-        triangles,
-        active_indices,
+    Point polygon[MAX_CLIPPED_VERTICES];
+    Triangle out_triangles[MAX_CLIPPED_VERTICES - 2];
+
+    /*  Only the triangles active on entry are clipped - those appended below
+        already lie inside the visible region. */
+    size_t num_active = active_indices.size();
+    size_t num_kept = first_active;
+
+    for (size_t n = first_active; n < num_active; n++) {
+        int index = active_indices[n];
+        Triangle* curr_triangle = &triangles[index];
+
+        unsigned int outcode_0 = curr_triangle->points[0].outcode;
+        unsigned int outcode_1 = curr_triangle->points[1].outcode;
+        unsigned int outcode_2 = curr_triangle->points[2].outcode;
+
+        /*  Trivially reject - all vertices outside of the same plane. */
+        if (outcode_0 & outcode_1 & outcode_2 & REJECT_PLANES_MASK) {
+            stats.rejected ++;
+            continue;
+        }
 
-        /*  Lambda for in_viewing_region operand. In this case the viewing
-            region is the forward side of the near plane (z > view_distance). */
-        [this](Point point) {
-            return point.pos(2) >= this->view_plane_distance;
-        },
+        active_indices[num_kept] = index;
+        num_kept ++;
 
-        /*  Lambda for get_intersect operand. This returns a vector storing the
-            point where the line vertex_1 -> vertex_2 intersects the
-            viewing region boundary. That is a precondition of this function
-            and calls on vertex values that do not establish this precondition
-            should be considered undefined as this code needs to be called for
-            all triangles, and validation per triangle would cost clock
-            cycles. */
-        [this](
-            Point point_1,
-            Point point_2
-        ) {
-            Maths::Vector<double, 4> diff = point_2.pos - point_1.pos;
-            double scale = (this->view_plane_distance - point_1.pos(2)) /
-                diff(2);
-
-            /*  Since we are in 3d camera space, we also interpolate the depth
-                and intensity accordingly. */
-
-            return Point {
-                point_1.pos + scale * diff,
-                point_1.i + scale * (point_2.i -
-                    point_1.i),
-                point_1.r + scale * (point_2.r - point_1.r),
-                point_1.g + scale * (point_2.g - point_1.g),
-                point_1.b + scale * (point_2.b - point_1.b),
-                point_1.tex_x + scale * (point_2.tex_x - point_1.tex_x),
-                point_1.tex_y + scale * (point_2.tex_y - point_1.tex_y),
-                0.0, 0.0,
-                0.0, 0.0, 0.0,
-                0.0, 0.0
-            };
+        /*  Trivially accept - all vertices inside every plane. Triangles
+            crossing only the edges of the screen are accepted too, to be
+            scissored by the rasteriser. */
+        unsigned int outcodes = outcode_0 | outcode_1 | outcode_2;
+        unsigned int planes = outcodes & CLIPPED_PLANES_MASK;
+
+        if (outcodes == 0) {
+            stats.accepted ++;
+            continue;
+        }
+
+        if (planes == 0) {
+            stats.scissored ++;
+            continue;
+        }
+
+        stats.clipped ++;
+
+        for (int i = 0; i < 3; i++) {
+            polygon[i] = curr_triangle->points[i];
+        }
+
+        int num_vertices = this->clip_polygon(settings, polygon, 3,
+            planes);
+
+        int num_triangles = this->make_triangles(
+            num_vertices,
+            polygon,
+            out_triangles,
+            curr_triangle->bitmap_ptr
+        );
+
+        /*  Clipped away entirely, despite not being trivially rejected. */
+        if (num_triangles == 0) {
+            num_kept --;
+            stats.clipped --;
+            stats.rejected ++;
+            continue;
+        }
+
+        /*  The first triangle replaces the original and the rest are added
+            to the end. */
+        *curr_triangle = out_triangles[0];
+
+        for (int i = 1; i < num_triangles; i++) {
+            triangles.push_back(out_triangles[i]);
+            active_indices.push_back(triangles.size() - 1);
         }
+    }
+
+    /*  Close the gap between the kept and appended indices. */
+    active_indices.erase(
+        active_indices.begin() + num_kept,
+        active_indices.begin() + num_active
     );
 }
 
@@ -363,282 +1732,392 @@ void Renderer::clip_near_plane(
     the near plane (z_near) but we do not do this as we will want to know the
     depths at the per-pixel level when we come to do tetxure sampling and
     shading interpolation.
-    
-    In the future it might be worth considering a homogeneous projection like
-    in hardware accelerated APIs? This might just introduced more floating
-    point operations in software though (which do not translate to time
-    overhead in hardware due to the massive level of parallelism). */
-void Renderer::perspective_project_triangles(
-    std::vector<Triangle>& triangles,
-    std::list<int>& active_indices
-) {
-    /*  Project all vertices. */
-    std::list<int>::iterator itr = active_indices.begin();
-    
-    while (itr != active_indices.end()) {
-        Triangle* curr_tri = &triangles[*itr];
-        
-        /*  Project all vertices. */
-        for (int i = 0; i < 3; i++) {
-            double z_near_div_z = this->view_plane_distance /
-                curr_tri->points[i].pos(2);
-            curr_tri->points[i].pos(0) *= z_near_div_z;
-            curr_tri->points[i].pos(1) *= z_near_div_z;
-
-            /*  Since we now convert to 2d space, the vertex attributes no
-                longer vary linearly with the new screen space coordinates.
-                Therefore, we have to interpolate against each attribute / z
-                instead, so we store these in the points.
-                
-                Note that since we have already clipped against the near plane,
-                we can assume that the z coordinate is > 0. */
-            curr_tri->points[i].inv_z = 1.0 / curr_tri->points[i].pos(2);
-            curr_tri->points[i].i_div_z = curr_tri->points[i].i /
-                curr_tri->points[i].pos(2);
-            curr_tri->points[i].r_div_z = curr_tri->points[i].r /
-                curr_tri->points[i].pos(2);
-            curr_tri->points[i].g_div_z = curr_tri->points[i].g /
-                curr_tri->points[i].pos(2);
-            curr_tri->points[i].b_div_z = curr_tri->points[i].b /
-                curr_tri->points[i].pos(2);
-            curr_tri->points[i].tex_x_div_z = curr_tri->points[i].tex_x /
-                curr_tri->points[i].pos(2);
-            curr_tri->points[i].tex_y_div_z = curr_tri->points[i].tex_y /
-                curr_tri->points[i].pos(2);
-        }
-
-        itr++;
-    }
-}
-
-/*  Helper function for clipping against the bounds of the 2d viewing plane. */
-static Point make_scaled_point_2d(
-    Point point_1,
-    Point point_2,
-    double scale,
-    Maths::Vector<double, 4> diff
-) {
-    return Point {
-        point_1.pos + scale * diff,
-        
-        /*  Intensity, red, green, blue, tex_x, tex_y - we used the
-            a / z variants below now as we are in 2d perspective
-            projected space so these attributes no longer vary linearly
-            with the coordinates in pos. */
-        0.0,
-        0.0, 0.0, 0.0,
-        0.0, 0.0,
-        
-        /*  Attributes / z: 1 / z, intensity, red, green, blue, texture
-            x, texture y. */
-        point_1.inv_z + scale * (point_2.inv_z - point_1.inv_z),
-        point_1.i_div_z + scale * (point_2.i_div_z - point_1.i_div_z),
-        point_1.r_div_z + scale * (point_2.r_div_z - point_1.r_div_z),
-        point_1.g_div_z + scale * (point_2.g_div_z - point_1.g_div_z),
-        point_1.b_div_z + scale * (point_2.b_div_z - point_1.b_div_z),
-        point_1.tex_x_div_z + scale * (point_2.tex_x_div_z -
-            point_1.tex_x_div_z),
-        point_1.tex_y_div_z + scale * (point_2.tex_y_div_z -
-            point_1.tex_y_div_z)
-    };
-}
 
-/*  Clip in 2d against the left bound of the screen. */
-void Renderer::clip_left_bound(
-    std::vector<Triangle>& triangles,
-    std::list<int>& active_indices
+    This is done as a homogeneous projection, like in hardware accelerated
+    APIs - the projection transform (applied during vertex processing, so that
+    clipping can be done in clip space) gives x * z_near and y * z_near, with
+    w = z, and the perspective divide by w here completes it. */
+void Renderer::perspective_project_triangles(
+    TriangleBuffer& triangles,
+    IndexBuffer& active_indices,
+    size_t first_active,
+    FrameArena& arena
 ) {
-    this->clip_triangles(
-        triangles,
-        active_indices,
+    /*  Since we now convert to 2d space, the vertex attributes no longer vary
+        linearly with the new screen space coordinates. Therefore, we have to
+        interpolate against each attribute / z instead, so we store these in
+        the points.
 
-        [this](Point& point) {
-            return point.pos(0) > this->screen_left_bound;
-        },
+        Note that since we have already clipped against the near plane, we
+        can assume that w (i.e. z) is > 0.
+
+        The vertices of the active triangles are gathered into streams,
+        projected together, and written back. */
+    static constexpr int NUM_ATTRIBUTES = 6;
 
-        [this](
-            Point& point_1,
-            Point& point_2
-        ) {
-            Maths::Vector<double, 4> diff = point_2.pos - point_1.pos;
-            double scale = (this->screen_left_bound - point_1.pos(0)) / diff(0);
-            return make_scaled_point_2d(point_1, point_2, scale, diff);
+    size_t count = (active_indices.size() - first_active) * 3;
+
+    point_stream points = allocate_point_stream(arena, count);
+    double* inv_z = arena.allocate_array<double>(count);
+    double* attributes[NUM_ATTRIBUTES];
+
+    for (int a = 0; a < NUM_ATTRIBUTES; a++) {
+        attributes[a] = arena.allocate_array<double>(count);
+    }
+
+    size_t n = 0;
+
+    for (size_t k = first_active; k < active_indices.size(); k++) {
+        for (const Point& point : triangles[active_indices[k]].points) {
+            points.x[n] = point.pos(0);
+            points.y[n] = point.pos(1);
+            points.w[n] = point.pos(3);
+            attributes[0][n] = point.i;
+            attributes[1][n] = point.r;
+            attributes[2][n] = point.g;
+            attributes[3][n] = point.b;
+            attributes[4][n] = point.tex_x;
+            attributes[5][n] = point.tex_y;
+            n ++;
         }
+    }
+
+    project_points(
+        points,
+        inv_z,
+        attributes,
+        NUM_ATTRIBUTES,
+        count
     );
+
+    n = 0;
+
+    for (size_t k = first_active; k < active_indices.size(); k++) {
+        for (Point& point : triangles[active_indices[k]].points) {
+            point.pos(0) = points.x[n];
+            point.pos(1) = points.y[n];
+            point.inv_z = inv_z[n];
+            point.i_div_z = attributes[0][n];
+            point.r_div_z = attributes[1][n];
+            point.g_div_z = attributes[2][n];
+            point.b_div_z = attributes[3][n];
+            point.tex_x_div_z = attributes[4][n];
+            point.tex_y_div_z = attributes[5][n];
+            n ++;
+        }
+    }
 }
 
-/*  Clip in 2d against the right bound of the screen. */
-void Renderer::clip_right_bound(
-    std::vector<Triangle>& triangles,
-    std::list<int>& active_indices
+/*  Convert triangles to pixel space. */
+void Renderer::convert_triangles_to_pixel_space(
+    const frame_settings& settings,
+    TriangleBuffer& triangles,
+    IndexBuffer& active_indices,
+    size_t first_active,
+    int buffer_width,
+    int buffer_height,
+    FrameArena& arena
 ) {
-    this->clip_triangles(
-        triangles,
-        active_indices,
+    size_t count = (active_indices.size() - first_active) * 3;
 
-        [this](Point& point) {
-            return point.pos(0) < this->screen_right_bound;
-        },
+    double* x = arena.allocate_array<double>(count);
+    double* y = arena.allocate_array<double>(count);
 
-        [this](
-            Point& point_1,
-            Point& point_2
-        ) {
-            Maths::Vector<double, 4> diff = point_2.pos - point_1.pos;
-            double scale = (this->screen_right_bound - point_1.pos(0)) /
-                diff(0);
-            return make_scaled_point_2d(point_1, point_2, scale, diff);
+    size_t n = 0;
+
+    for (size_t k = first_active; k < active_indices.size(); k++) {
+        for (const Point& point : triangles[active_indices[k]].points) {
+            x[n] = point.pos(0);
+            y[n] = point.pos(1);
+            n ++;
         }
+    }
+
+    convert_points_to_pixels(
+        x,
+        y,
+        viewport {
+            this->screen_left_bound,
+            this->screen_right_bound,
+            this->screen_bottom_bound,
+            this->screen_top_bound,
+            buffer_width,
+            buffer_height,
+            get_subpixel_scale(settings)
+        },
+        count
     );
+
+    n = 0;
+
+    for (size_t k = first_active; k < active_indices.size(); k++) {
+        for (Point& point : triangles[active_indices[k]].points) {
+            point.pos(0) = x[n];
+            point.pos(1) = y[n];
+            n ++;
+        }
+    }
 }
 
-/*  Clip in 2d against the top bound of the screen. */
-void Renderer::clip_top_bound(
-    std::vector<Triangle>& triangles,
-    std::list<int>& active_indices
+/*  Set the depths of the pixels of rect to 0 (infinitely far away) - in
+    every depth format, this is all zero bytes. */
+static void clear_depths(
+    const System::FramebufferView& framebuffer,
+    const pixel_rect& rect
 ) {
-    this->clip_triangles(
-        triangles,
-        active_indices,
-
-        [this](Point& point) {
-            return point.pos(1) < this->screen_top_bound;
-        },
+    size_t row_size = (rect.x_max - rect.x_min) *
+        System::get_depth_format_size(framebuffer.depth_format);
 
-        [this](
-            Point& point_1,
-            Point& point_2
-        ) {
-            Maths::Vector<double, 4> diff = point_2.pos - point_1.pos;
-            double scale = (this->screen_top_bound - point_1.pos(1)) / diff(1);
-            return make_scaled_point_2d(point_1, point_2, scale, diff);
-        }
-    );
+    for (int y = rect.y_min; y < rect.y_max; y++) {
+        std::memset(framebuffer.depth_pixel(rect.x_min, y), 0, row_size);
+    }
 }
 
-/*  Clip in 2d against the bottom bound of the screen. */
-void Renderer::clip_bottom_bound(
-    std::vector<Triangle>& triangles,
-    std::list<int>& active_indices
+/*  Rasterise triangles - with a single thread the triangles are drawn in order
+    into the whole render buffer. Otherwise, they are first binned into screen
+    tiles, and each tile is then drawn independently by one thread of the
+    worker pool, scissored to that tile. Since the triangles within each tile
+    are drawn in the same order as in the single threaded case, and the
+    scissored rasteriser steps a triangle identically regardless of the
+    scissor, the resulting image is the same.
+
+    The depth buffer is cleared in the same way - all at once with a single
+    thread, or otherwise by each tile just before it is drawn (while its
+    depths are in the cache of the thread drawing it). A tile is only
+    cleared if it was drawn in since it was last cleared. */
+void Renderer::rasterise_triangles(
+    frame_context& frame,
+    const System::FramebufferView& framebuffer
 ) {
-    this->clip_triangles(
-        triangles,
-        active_indices,
+    const Triangle* const* draw_list = frame.draw_list;
+    int draw_count = frame.draw_count;
+    int buffer_width = framebuffer.width;
+    int buffer_height = framebuffer.height;
 
-        [this](Point& point) {
-            return point.pos(1) > this->screen_bottom_bound;
-        },
+    if (this->worker_pool->get_thread_count() == 1) {
+        pixel_rect scissor { 0, 0, buffer_width, buffer_height };
+
+        clear_depths(framebuffer, scissor);
 
-        [this](
-            Point& point_1,
-            Point& point_2
-        ) {
-            Maths::Vector<double, 4> diff = point_2.pos - point_1.pos;
-            double scale = (this->screen_bottom_bound - point_1.pos(1)) /
-                diff(1);
-            return make_scaled_point_2d(point_1, point_2, scale, diff);
+        for (int n = 0; n < draw_count; n++) {
+            this->rasterise_triangle(frame.settings, framebuffer,
+                *draw_list[n], scissor);
         }
-    );
-}
 
-/*  Clip against screen bounds - in 2d. */
-void Renderer::clip_screen_bounds(
-    std::vector<Triangle>& triangles,
-    std::list<int>& active_indices
-) {
-    this->clip_left_bound(triangles, active_indices);
-    this->clip_right_bound(triangles, active_indices);
-    this->clip_top_bound(triangles, active_indices);
-    this->clip_bottom_bound(triangles, active_indices);
+        return;
+    }
+
+    this->bin_triangles_into_tiles(frame, buffer_width, buffer_height);
+
+    int tile_count = frame.tile_columns * frame.tile_rows;
+
+    /*  Every tile of a depth buffer not drawn into before may be dirty. */
+    const System::FramebufferView& last_view = frame.dirty_depth_view;
+
+    if (last_view.depth != framebuffer.depth ||
+        last_view.width != buffer_width ||
+        last_view.height != buffer_height ||
+        last_view.depth_format != framebuffer.depth_format ||
+        (int) frame.dirty_depth_tiles.size() != tile_count) {
+        frame.dirty_depth_tiles.assign(tile_count, 1);
+        frame.dirty_depth_view = framebuffer;
+    }
+
+    this->worker_pool->run(
+        tile_count,
+        [&](int tile) {
+            int tile_x = (tile % frame.tile_columns) * this->tile_size;
+            int tile_y = (tile / frame.tile_columns) * this->tile_size;
+
+            pixel_rect scissor {
+                tile_x,
+                tile_y,
+                std::min(tile_x + this->tile_size, buffer_width),
+                std::min(tile_y + this->tile_size, buffer_height)
+            };
+
+            if (frame.dirty_depth_tiles[tile]) {
+                clear_depths(framebuffer, scissor);
+            }
+
+            frame.dirty_depth_tiles[tile] =
+                frame.tile_offsets[tile] != frame.tile_offsets[tile + 1];
+
+            for (int i = frame.tile_offsets[tile];
+                i < frame.tile_offsets[tile + 1]; i++) {
+                this->rasterise_triangle(
+                    frame.settings,
+                    framebuffer,
+                    *draw_list[frame.tile_indices[i]],
+                    scissor
+                );
+            }
+        }
+    );
 }
 
-/*  Convert triangles to pixel space. */
-void Renderer::convert_triangles_to_pixel_space(
-    std::vector<Triangle>& triangles,
-    std::list<int>& active_indices,
+void Renderer::bin_triangles_into_tiles(
+    frame_context& frame,
     int buffer_width,
     int buffer_height
 ) {
-    std::list<int>::iterator itr = active_indices.begin();
+    const Triangle* const* draw_list = frame.draw_list;
+    int draw_count = frame.draw_count;
+
+    frame.tile_columns = (buffer_width + this->tile_size - 1) /
+        this->tile_size;
+    frame.tile_rows = (buffer_height + this->tile_size - 1) / this->tile_size;
+
+    int tile_count = frame.tile_columns * frame.tile_rows;
+
+    /*  The bins are built with a counting sort, in two passes over the
+        triangles - the first counts the triangles in each tile, giving the
+        offset of each tile's bin in one shared index array, and the second
+        fills in the bins. The range of tiles overlapped by each triangle
+        (inclusive, and empty if it is off screen) is kept between the
+        passes. */
+    pixel_rect* tile_ranges = frame.arena.allocate_array<pixel_rect>(
+        draw_count
+    );
+    int* tile_counts = frame.arena.allocate_array<int>(tile_count + 1);
 
-    while (itr != active_indices.end()) {
-        Triangle* curr_triangle = &triangles[*itr];
+    std::fill(tile_counts, tile_counts + tile_count + 1, 0);
+
+    for (int n = 0; n < draw_count; n++) {
+        const Triangle& triangle = *draw_list[n];
+        pixel_coord coords[3];
 
         for (int i = 0; i < 3; i++) {
-            curr_triangle->points[i].pos(0) = round(
-                ((curr_triangle->points[i].pos(0) - this->screen_left_bound) /
-                (this->screen_right_bound - this->screen_left_bound)) *
-                (buffer_width - 1)
-            );
-            
-            curr_triangle->points[i].pos(1) = (buffer_height - 1) - round(
-                ((curr_triangle->points[i].pos(1) - this->screen_bottom_bound) /
-                (this->screen_top_bound - this->screen_bottom_bound)) *
-                (buffer_height - 1)
-            );
+            coords[i].x = triangle.points[i].pos(0);
+            coords[i].y = triangle.points[i].pos(1);
+        }
+
+        pixel_rect bounds = shaded_triangle_bounds(
+            coords[0],
+            coords[1],
+            coords[2]
+        );
+
+        /*  Clamp to the render buffer before finding the tiles overlapped. The
+            scissor guarantees that nothing is drawn outside of a tile, so
+            conservative bounds only cost a little work in neighbouring
+            tiles. */
+        if (bounds.x_max <= 0 || bounds.y_max <= 0 ||
+            bounds.x_min >= buffer_width || bounds.y_min >= buffer_height) {
+            tile_ranges[n] = { 0, 0, -1, -1 };
+            continue;
+        }
+
+        pixel_rect& range = tile_ranges[n];
+
+        range.x_min = std::max(bounds.x_min, 0) / this->tile_size;
+        range.x_max = (std::min(bounds.x_max, buffer_width) - 1) /
+            this->tile_size;
+        range.y_min = std::max(bounds.y_min, 0) / this->tile_size;
+        range.y_max = (std::min(bounds.y_max, buffer_height) - 1) /
+            this->tile_size;
+
+        for (int row = range.y_min; row <= range.y_max; row++) {
+            for (int column = range.x_min; column <= range.x_max; column++) {
+                tile_counts[row * frame.tile_columns + column + 1] ++;
+            }
         }
+    }
 
-        itr ++;
+    /*  Prefix sum the counts into the offset of each bin. */
+    for (int tile = 0; tile < tile_count; tile++) {
+        tile_counts[tile + 1] += tile_counts[tile];
     }
-}
 
-/*  Rasterise triangles - for now, we simply just invoke the wireframe triangle
-    function from the rasteriser. */
-void Renderer::rasterise_triangles(
-    System::RenderWindow& render_window,
-    std::vector<Triangle>& triangles,
-    std::list<int>& active_indices
-) {
-    std::list<int>::iterator itr = active_indices.begin();
+    frame.tile_offsets = tile_counts;
+    frame.tile_indices = frame.arena.allocate_array<int>(
+        tile_counts[tile_count]
+    );
 
-    while (itr != active_indices.end()) {
-        Triangle* curr_triangle = &triangles[*itr];
+    /*  Fill the bins in triangle order, advancing a cursor for each. */
+    int* cursors = frame.arena.allocate_array<int>(tile_count);
 
-        draw_shaded_triangle(
-            render_window,
+    std::copy(tile_counts, tile_counts + tile_count, cursors);
 
-            {
-                curr_triangle->points[0].pos(0),
-                curr_triangle->points[0].pos(1),
-                curr_triangle->points[0].inv_z,
-                curr_triangle->points[0].i_div_z,
-                curr_triangle->points[0].r_div_z,
-                curr_triangle->points[0].g_div_z,
-                curr_triangle->points[0].b_div_z,
-                curr_triangle->points[0].tex_x_div_z,
-                curr_triangle->points[0].tex_y_div_z
-            },
+    for (int n = 0; n < draw_count; n++) {
+        const pixel_rect& range = tile_ranges[n];
 
-            {
-                curr_triangle->points[1].pos(0),
-                curr_triangle->points[1].pos(1),
-                curr_triangle->points[1].inv_z,
-                curr_triangle->points[1].i_div_z,
-                curr_triangle->points[1].r_div_z,
-                curr_triangle->points[1].g_div_z,
-                curr_triangle->points[1].b_div_z,
-                curr_triangle->points[1].tex_x_div_z,
-                curr_triangle->points[1].tex_y_div_z
-            },
+        for (int row = range.y_min; row <= range.y_max; row++) {
+            for (int column = range.x_min; column <= range.x_max; column++) {
+                int tile = row * frame.tile_columns + column;
 
-            {
-                curr_triangle->points[2].pos(0),
-                curr_triangle->points[2].pos(1),
-                curr_triangle->points[2].inv_z,
-                curr_triangle->points[2].i_div_z,
-                curr_triangle->points[2].r_div_z,
-                curr_triangle->points[2].g_div_z,
-                curr_triangle->points[2].b_div_z,
-                curr_triangle->points[2].tex_x_div_z,
-                curr_triangle->points[2].tex_y_div_z
-            },
+                frame.tile_indices[cursors[tile]] = n;
+                cursors[tile] ++;
+            }
+        }
+    }
+}
+
+void Renderer::rasterise_triangle(
+    const frame_settings& settings,
+    const System::FramebufferView& framebuffer,
+    const Triangle& triangle,
+    const pixel_rect& scissor
+) {
+    const Point* points = triangle.points;
+    pixel_coord coords[3];
+
+    /*  Only interpolate the intensity and colour if they vary across the
+        triangle - e.g. an unlit or flat shaded triangle of a single colour
+        is drawn by a span kernel without either. */
+    triangle_shading shading {
+        settings.depth_features | SHADE_TEXTURE,
+        settings.rasteriser_precision,
+        points[0].i,
+        points[0].r,
+        points[0].g,
+        points[0].b
+    };
+
+    if (points[1].i != points[0].i || points[2].i != points[0].i) {
+        shading.features |= SHADE_GOURAUD;
+    }
+
+    if (points[1].r != points[0].r || points[2].r != points[0].r ||
+        points[1].g != points[0].g || points[2].g != points[0].g ||
+        points[1].b != points[0].b || points[2].b != points[0].b) {
+        shading.features |= SHADE_VERTEX_COLOUR;
+    }
+
+    for (int i = 0; i < 3; i++) {
+        coords[i] = {
+            triangle.points[i].pos(0),
+            triangle.points[i].pos(1),
+            triangle.points[i].inv_z,
+            triangle.points[i].i_div_z,
+            triangle.points[i].r_div_z,
+            triangle.points[i].g_div_z,
+            triangle.points[i].b_div_z,
+            triangle.points[i].tex_x_div_z,
+            triangle.points[i].tex_y_div_z
+        };
+    }
 
-            curr_triangle->bitmap_ptr,
-            render_window.get_width(),
-            render_window.get_height()
+    if (get_frame_rasteriser_mode(settings) == RasteriserMode::HALF_SPACE) {
+        draw_shaded_triangle_half_space(
+            framebuffer,
+            coords[0],
+            coords[1],
+            coords[2],
+            triangle.bitmap_ptr,
+            scissor,
+            shading
+        );
+    } else {
+        draw_shaded_triangle(
+            framebuffer,
+            coords[0],
+            coords[1],
+            coords[2],
+            triangle.bitmap_ptr,
+            scissor,
+            shading
         );
-        
-        itr ++;
     }
 }
 
@@ -11,21 +11,63 @@
 
 #include "./../Maths/Vector.hpp"
 #include "./../System/RenderWindow.hpp"
+#include "./../System/DepthBuffer.hpp"
 #include "Model.hpp"
 #include "./../Maths/Transform.hpp"
 #include "./../Resources/load_resources.hpp"
-
-#include <list>
+#include "Rasteriser.hpp"
+#include "FrameArena.hpp"
+#include "SceneIndex.hpp"
+#include "VertexKernel.hpp"
+#include "WorkerPool.hpp"
+
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
 #include <vector>
 #include <iostream>
 
 namespace Graphics {
 
+/*  A camera's view transform, cached as for model_matrices. Each time it is
+    recomputed it is given a new generation, unique across all cameras, so
+    that matrices derived from it can tell whether they are up to date. */
+struct camera_matrices {
+    Maths::Vector<double, 4> position;
+    Maths::Vector<double, 4> rotation;
+    bool valid = false;
+
+    Maths::Matrix<double, 4, 4> view;
+    unsigned long long generation = 0;
+};
+
 struct Camera {
     Maths::Vector<double, 4> position;
     Maths::Vector<double, 4> rotation;
+
+    mutable camera_matrices matrices {};
 };
 
+/*  World space to camera space - recomputed only if the camera has moved
+    since it was last computed. */
+const Maths::Matrix<double, 4, 4>& view_transform(const Camera& camera);
+
+/*  Model space to camera space, for positions and for normals (the view
+    transform is a rigid motion, so applies to normals unchanged). These are
+    cached in the model, and recomputed only if the model or the camera has
+    moved - or a different camera is used - since they were last computed. */
+const Maths::Matrix<double, 4, 4>& model_view_transform(
+    const Model& model,
+    const Camera& camera
+);
+
+const Maths::Matrix<double, 4, 4>& model_view_normal_transform(
+    const Model& model,
+    const Camera& camera
+);
+
 enum class LightType {
     AMBIENT,
     DIRECTION,
@@ -42,251 +84,707 @@ struct Scene {
     std::vector<Model*> models;
     std::vector<Light> lights;
     Camera camera;
+
+    /*  Optional index over models, used to cull them hierarchically. If set,
+        it must have been built over models. */
+    SceneIndex* index = nullptr;
+};
+
+/*  Culling and clipping statistics of a frame. The first four counts are of
+    what became of the triangles that survived culling when they were
+    clipped. */
+struct RenderStats {
+    /*  Entirely inside the screen. */
+    unsigned int accepted;
+
+    /*  Entirely outside of the screen, nearer than the near plane or beyond
+        the far plane. */
+    unsigned int rejected;
+
+    /*  Crossing the edge of the screen but within the guard band, so drawn
+        unclipped and scissored to the render buffer by the rasteriser. */
+    unsigned int scissored;
+
+    /*  Clipped geometrically against the near or far plane or guard band. */
+    unsigned int clipped;
+
+    /*  Models none of whose vertices were processed - rejected whole by
+        their bounding volumes, or all of whose clusters or faces were
+        culled. */
+    unsigned int culled_models;
+
+    /*  Clusters of the models that were not culled whole, and how many of
+        those were culled for lying outside of the view frustum or for
+        facing entirely away from the camera. */
+    unsigned int clusters;
+    unsigned int frustum_culled_clusters;
+    unsigned int back_face_culled_clusters;
+
+    /*  Faces of the remaining clusters culled as back faces. */
+    unsigned int back_faces;
 };
 
+/*  Per-frame geometry buffers. These draw their storage from the Renderer's
+    frame arena, so only live for the duration of render_scene. */
+using PointBuffer = ArenaVector<Point>;
+using TriangleBuffer = ArenaVector<Triangle>;
+using IndexBuffer = ArenaVector<int>;
+using LightBuffer = ArenaVector<Light>;
+
 class Renderer {
     public:
-        Renderer(double fov, double aspect_ratio, double far_plane_distance);
-
+        /*  thread_count is the number of threads used to render each frame
+            (including the calling thread).
+
+            The geometry stage (vertex processing, clipping and projection)
+            is split into jobs of a few clusters of one model each, which the
+            threads run in parallel, each thread writing its triangles to
+            buffers of its own. These are merged in job order before
+            rasterisation, so the order of the triangles does not depend on
+            the number of threads.
+
+            With more than one thread, triangles are then binned into square
+            screen tiles of tile_size pixels which are rasterised in
+            parallel - each tile is owned by a single thread, so no
+            synchronisation is needed on the render or depth buffers. The
+            output is identical to that of a single thread. */
+        Renderer(double fov, double aspect_ratio, double far_plane_distance,
+            unsigned int thread_count = 1, int tile_size = 64);
+
+        /*  The destructor stops the pipeline threads, once they finish the
+            stage they are running - frames in flight are discarded. */
+        ~Renderer();
+
+        /*  Render a scene into a window. The window's depth buffer is
+            cleared as part of rendering - with more than one thread, one
+            tile at a time, just before the tile is drawn. Tiles with
+            nothing drawn in them in the last frame are already clear, so
+            are skipped, unless the window's depths have been written by
+            anything else since then (e.g. copy_framebuffer), in which case
+            every tile is cleared. */
         void render_scene(
             System::RenderWindow& render_window,
             const Scene& scene
         );
 
-    private:     
-        Triangle transform_triangle(
-            const Triangle& triangle,
-            const Maths::Matrix<double, 4, 4>& transform
+        /*  Pipelined rendering - submit_scene snapshots a scene (the
+            placements of its models, its lights and its camera) and returns
+            without waiting for it to be drawn. The frame's geometry stage
+            then runs on a pipeline thread, and its rasterisation on another,
+            into render and depth buffers owned by the Renderer. So the
+            geometry of one frame is processed while the frame before it is
+            rasterised and the one before that is presented by the caller,
+            and frames are produced at the rate of the slowest of these
+            rather than of all of them in turn.
+
+            render_window is only used for the size, pixel format and depth
+            format of the frame. If the scene has an index, it is updated and
+            queried before submit_scene returns. Each frame is drawn with the
+            settings (e.g. the far plane distance) at the time it was
+            submitted, so they may be changed while frames are in flight.
+            Meshes and their textures are not copied, but read by the
+            pipeline threads after submit_scene returns - they must not be
+            modified or freed until wait_frame has returned every frame
+            that uses them.
+
+            Returns true if the scene was submitted, or false (submitting
+            nothing) if MAX_FRAMES_IN_FLIGHT frames have already been
+            submitted and not yet returned by wait_frame. */
+        bool submit_scene(
+            System::RenderWindow& render_window,
+            const Scene& scene
         );
 
-        void build_triangles_list_from_models(
-            std::vector<Triangle>& triangles,
-            std::list<int>& active_indices,
-            std::vector<Model*>& models
+        /*  Wait for the oldest frame submitted to finish, and return a view
+            of its render and depth buffers, which remains valid until the
+            next call to wait_frame (see copy_framebuffer). get_render_stats
+            then returns the statistics of that frame. Returns nullptr, without
+            waiting, if no frames are in flight. */
+        const System::FramebufferView* wait_frame();
+
+        static constexpr int MAX_FRAMES_IN_FLIGHT = 2;
+
+        /*  Select the triangle filling algorithm used by subsequent calls to
+            render_scene. The scanline rasteriser is used by default, unless
+            the precision is FIXED (see set_rasteriser_precision). */
+        void set_rasteriser_mode(RasteriserMode mode);
+
+        RasteriserMode get_rasteriser_mode();
+
+        /*  Select the precision of the rasteriser's arithmetic for
+            subsequent frames - see RasteriserPrecision. DOUBLE is used by
+            default. Only the half-space rasteriser has a FIXED mode, so with
+            FIXED, frames are always drawn by the half-space rasteriser
+            (whatever set_rasteriser_mode selected), with vertices placed to a
+            sixteenth of a pixel. */
+        void set_rasteriser_precision(RasteriserPrecision precision);
+
+        RasteriserPrecision get_rasteriser_precision();
+
+        /*  Enable or disable the depth test, and the writing of depths, for
+            subsequent frames. Both are enabled by default. */
+        void set_depth_test(bool enabled);
+
+        bool get_depth_test();
+
+        void set_depth_write(bool enabled);
+
+        bool get_depth_write();
+
+        /*  Number of heap allocations made by the frame arenas so far. Once
+            the scene stops growing this no longer changes from frame to
+            frame - i.e. rendering a frame allocates nothing. Not to be
+            called while pipelined frames are in flight. */
+        unsigned long long get_frame_arena_allocation_count();
+
+        /*  Guard band clipping - a triangle crossing the edge of the screen is
+            only clipped geometrically if it also crosses the guard band, a
+            region scale times the size of the screen about its centre.
+            Otherwise it is passed to the rasteriser as it is, which scissors
+            it to the render buffer. A scale of 1 clips to the screen itself.
+            The scale is clamped to [1, MAX_GUARD_BAND_SCALE], which keeps
+            pixel coordinates well within the range of an int. */
+        void set_guard_band_scale(double scale);
+
+        double get_guard_band_scale();
+
+        static constexpr double DEFAULT_GUARD_BAND_SCALE = 4.0;
+        static constexpr double MAX_GUARD_BAND_SCALE = 64.0;
+
+        /*  Geometry further than distance from the camera is not drawn -
+            triangles are clipped against the far plane, and models lying
+            entirely beyond it are culled. This bounds the depth range, so the
+            depth buffer (which holds 1 / z) only holds values in
+            [1 / far plane distance, 1 / view plane distance]. The distance is
+            clamped to at least twice the view plane distance. */
+        void set_far_plane_distance(double distance);
+
+        double get_far_plane_distance();
+
+        /*  Culling and clipping statistics of the last frame rendered (or,
+            when pipelined, returned by wait_frame). */
+        RenderStats get_render_stats();
+
+    private:     
+        /*  A run of consecutive visible clusters of a model, processed as
+            one job of the geometry stage. */
+        struct geometry_job {
+            const Model* model;
+
+            /*  The model's cached model view transforms, and its world space
+                vertices if it is static (nullptr otherwise). */
+            const Maths::Matrix<double, 4, 4>* transform;
+            const Maths::Matrix<double, 4, 4>* normal_matrix;
+            const world_vertices* world;
+
+            /*  The camera in model space, and the sign of the determinant
+                of the model transform - faces are culled if
+                orientation * dot(normal, vertex - eye) > 0. */
+            Maths::Vector<double, 4> eye;
+            double orientation;
+
+            const MeshCluster* clusters;
+            int cluster_count;
+
+            /*  The position of the model among those drawn this frame. */
+            int model_number;
+
+            /*  Results - the thread that ran the job, and the range of that
+                thread's active indices holding the job's triangles. drawn is
+                true if any faces were front facing. */
+            unsigned int thread = 0;
+            int first_active = 0;
+            int active_count = 0;
+            bool drawn = false;
+        };
+
+        using GeometryJobBuffer = ArenaVector<geometry_job>;
+
+        /*  The settings that a frame is drawn with. Each frame takes a copy
+            of the Renderer's when it starts, and only reads that, so that
+            changing them does not affect pipelined frames already in
+            flight. */
+        struct frame_settings {
+            RasteriserMode rasteriser_mode = RasteriserMode::SCANLINE;
+
+            RasteriserPrecision rasteriser_precision =
+                RasteriserPrecision::DOUBLE;
+
+            /*  SHADE_DEPTH_TEST and SHADE_DEPTH_WRITE, as enabled. The other
+                shading features are chosen for each triangle. */
+            unsigned int depth_features = SHADE_DEPTH_TEST | SHADE_DEPTH_WRITE;
+
+            double guard_band_scale = DEFAULT_GUARD_BAND_SCALE;
+            double far_plane_distance = 0.0;
+        };
+
+        /*  State of a frame shared by all of the jobs of its geometry
+            stage. */
+        struct geometry_frame {
+            const LightBuffer* lights;
+            const LightBuffer* world_lights;
+
+            /*  The camera position, with w = 0, and the transform from world
+                space to clip space - for static models. */
+            Maths::Vector<double, 4> eye_offset;
+            Maths::Matrix<double, 4, 4> clip_transform;
+
+            int buffer_width;
+            int buffer_height;
+        };
+
+        /*  Per-thread state of the geometry stage. Each thread appends the
+            triangles of the jobs it runs to its own buffers, drawn from its
+            own arena. */
+        struct geometry_thread {
+            explicit geometry_thread(size_t arena_capacity);
+
+            /*  Release the buffers and reset the arena, for a new frame. */
+            void reset();
+
+            FrameArena arena;
+            RenderStats stats {};
+
+            PointBuffer vertices;
+            TriangleBuffer triangles;
+            IndexBuffer active_indices;
+        };
+
+        /*  Target number of triangles in a geometry job - jobs are made of
+            whole clusters, so hold a little more than this, unless they are
+            the last of a model. */
+        static constexpr int GEOMETRY_JOB_TRIANGLES = 256;
+
+        /*  A model to be drawn, and whether it is already known to lie
+            entirely inside the visible region. */
+        struct visible_model {
+            const Model* model;
+            bool inside;
+        };
+
+        /*  Where a frame is in the pipeline - HELD once it has been returned
+            by wait_frame, until the next call. */
+        enum class FrameStage {
+            FREE,
+            GEOMETRY,
+            RASTERISATION,
+            COMPLETE,
+            HELD
+        };
+
+        /*  Everything a frame needs from the start of its geometry stage to
+            the end of its rasterisation. render_scene has one of its own, and
+            the pipeline one for each frame in flight plus the one held by
+            the caller. */
+        struct frame_context {
+            explicit frame_context(unsigned int thread_count);
+
+            /*  Release everything allocated for the last frame. */
+            void reset();
+
+            /*  The number of heap allocations made by the frame's arenas. */
+            unsigned long long get_heap_allocation_count();
+
+            /*  Backs the per-frame state of the frame as a whole - the light
+                buffers, visible models, culled clusters, geometry jobs, draw
+                list and tile bins. The triangles themselves are in the
+                arenas of the geometry threads. The arenas are reset for each
+                frame, retaining their memory, so that steady state frames do
+                not allocate. */
+            FrameArena arena;
+
+            /*  One per thread that may run geometry jobs (see
+                WorkerPool::run_on_threads). */
+            std::vector<std::unique_ptr<geometry_thread>> geometry_threads;
+
+            /*  The most vertices of any geometry job, and triangles and
+                bytes of scratch space of any frame, so far - which every
+                geometry thread reserves room for (see reset). */
+            size_t peak_vertices = 0;
+            size_t peak_triangles = 0;
+            size_t peak_scratch = 0;
+            size_t reserved_bytes = 0;
+
+            RenderStats stats {};
+
+            frame_settings settings {};
+
+            /*  The output of the geometry stage. */
+            const Triangle** draw_list = nullptr;
+            int draw_count = 0;
+
+            /*  Tiled rasterisation state. Only used when the worker pool has
+                more than one thread. */
+            int tile_columns = 0;
+            int tile_rows = 0;
+            int* tile_offsets = nullptr;
+            int* tile_indices = nullptr;
+
+            /*  Whether the depths of each tile may have been written since
+                they were last cleared, and the depth buffer (with its size)
+                that this describes. For a window's depth buffer, also its
+                depth write count just after the frame locked it (see
+                RenderWindow::get_depth_write_count). */
+            std::vector<uint8_t> dirty_depth_tiles;
+            System::FramebufferView dirty_depth_view {};
+            unsigned long long dirty_depth_writes = 0;
+
+            /*  Pipelined frames only - the snapshot of the scene and the
+                buffers the frame is drawn into. The models are copies of the
+                scene's, of which only the placements are updated from frame
+                to frame, so that their caches stay warm. */
+            std::vector<Model> models;
+            std::vector<Light> lights;
+            Camera camera;
+            visible_model* visible_models = nullptr;
+            int visible_count = 0;
+            int model_count = 0;
+
+            std::vector<uint32_t> colour;
+            System::DepthBuffer depth;
+            System::FramebufferView framebuffer {};
+
+            FrameStage stage = FrameStage::FREE;
+            unsigned long long number = 0;
+        };
+
+        /*  Find the models of a scene that may be visible, culling them
+            hierarchically if it has an index. models are the models to
+            draw in place of the scene's (e.g. copies of them), in the same
+            order. */
+        void find_visible_models(
+            frame_context& frame,
+            const Scene& scene,
+            Model* const* models
         );
 
-        void convert_triangles_to_camera_space(
-            std::vector<Triangle>& triangles,
-            std::list<int>& active_indices,
-            const Camera& camera
+        /*  Transform, light, assemble, clip and project the triangles of the
+            visible models of a frame, into its draw list. */
+        void run_geometry_stage(
+            frame_context& frame,
+            const Camera& camera,
+            const Light* lights,
+            size_t light_count,
+            int buffer_width,
+            int buffer_height
         );
 
+        /*  Start the pipeline threads, and create the frames they use. */
+        void start_pipeline();
+
+        void run_geometry_stage_thread();
+
+        void run_raster_stage_thread();
+
+        /*  The oldest pipelined frame in the given stage, or nullptr. Only
+            called with the pipeline mutex held. */
+        frame_context* find_pipeline_frame(FrameStage stage);
+
         void convert_lights_to_camera_space(
-            std::vector<Light>& lights,
-            const Camera& camera
+            LightBuffer& lights,
+            const Maths::Matrix<double, 4, 4>& camera_transform
+        );
+
+        /*  Cull a model, and then the clusters of its mesh, against the
+            visible region, and cull the clusters that face away from the
+            camera. Then split the remaining clusters into geometry jobs,
+            appended to jobs. inside is true if the model is already known to
+            lie entirely inside the visible region. Returns false if no
+            clusters of the model were left.
+
+            This also brings the model's cached matrices (and, for a static
+            model, its world space vertices) up to date, so that the jobs
+            only ever read them. */
+        bool queue_model_jobs(
+            frame_context& frame,
+            GeometryJobBuffer& jobs,
+            const Model& model,
+            const Camera& camera,
+            bool inside,
+            int model_number
         );
 
-        void cull_triangle_back_faces(
-            std::vector<Triangle>& triangles,
-            std::list<int>& active_indices
+        /*  The geometry stage for one job - cull the faces of its clusters
+            that face away from the camera, process the vertices used by the
+            rest and assemble their triangles, then clip, project and convert
+            those to pixel space, into the buffers of the given geometry
+            thread. Static models are lit in world space (by the frame's
+            world_lights), and others in camera space. */
+        void process_geometry_job(
+            frame_context& context,
+            geometry_job& job,
+            unsigned int thread,
+            const geometry_frame& frame
         );
 
-        /*  Compute triangle lighting in scene. */
-        void compute_triangle_lighting(
-            std::vector<Triangle>& triangles,
-            const std::list<int>& active_indices,
-            const std::vector<Light>& lights
+        /*  Where a model lies relative to the visible region of clip space,
+            given its model to camera space transform. Its bounding sphere is
+            tested first, as that is cheaper, and its bounding box only if the
+            sphere crosses one of the planes bounding the region. */
+        Containment classify_model(
+            const frame_settings& settings,
+            const Model& model,
+            const Maths::Matrix<double, 4, 4>& transform
         );
 
-        /*  Clip vertices - this clips the vertices by walking through each line
-            segment of a triangle. The resulting array of vertices, out, will either
-            contain 0 vertices (the entire triangle is outside of the viewing region),
-            3 vertices (one triangle in the plane can be made) or 4 (a quad in the
-            viewing region can be made).
-
-            Note that this is defined in the header as it is a template function.
-
-            This algorithm works by considering each connected pair of nodes in the
-            triangle (i, j) - in the code these are represented by the vertex array
-            order, e.g. for { v1, v2, v3 } we would consider these sides to be the
-            lines (v1, v2) (from v1 to v2), (v2, v3) (from v2 to v3), (v3, v1) (from v3
-            to v1). We keep a sequence of vertices to output called out:
-                if i is in the viewing region, we add i to out.
-
-                if the line i -> j crosses the viewing region boundary, we add the
-                intersection of the line with the boundary to out.
-
-            The intuition behind this is that we walk from each vertex to it's
-            subsequent vertex according to the original winding (i.e. the order of the
-            vertices). When we cross an intersection between the viewing region and
-            outside, we add that vertex when we would encounter it on our walk. Since
-            we do not add vertices outside of the the viewing region, we automatically
-            connect adjacent intersections where a line exists completely out of the
-            plane - connecting the last intersection before we "left" and the first
-            intersection when we "returned".
-            
-            Understand that the result of this function is simply a shape (a triangle,
-            a quad or no shape at all). The windings / direction of the lines around
-            the perimeter are consistent with one another (as in they connect to form a
-            clockwise or anticlockwise traversal of the shape - they all follow tip to
-            tail) and are preserved (i.e. have the same direction / ordering as the
-            original shape) because the points added are added in order of their
-            traversal around the perimeter according to the same winding. */
-        template <typename F, typename G>
-        int clip_points(
-            Triangle* triangle,
-            Point out[4],
-            F in_viewing_region,
-            G get_intersect
-        ) {
-            bool in_points[3] = {
-                in_viewing_region(triangle->points[0]),
-                in_viewing_region(triangle->points[1]),
-                in_viewing_region(triangle->points[2])
-            };
-
-            int out_index = 0;
-            int next_i = 0;
-
-            for (int i = 0; i < 3; i++) {
-                if (in_points[i]) {
-                    out[out_index] = triangle->points[i];
-                    out_index ++;
-                }
-
-                next_i = (i + 1) % 3;
-
-                if (in_points[i] != in_points[next_i]) {
-                    /*  Line vertex[i] -> vertex[next_i] cross viewing region -
-                        find intersection and add it as next point. */
-                    out[out_index] = get_intersect(
-                        triangle->points[i],
-                        triangle->points[next_i]
-                    );
-                    out_index ++;
-                }
-            }
-
-            return out_index;
-        }
+        /*  Where a box lies relative to the visible region of clip space,
+            given a transform from the box's space to clip space. */
+        Containment classify_box(
+            const frame_settings& settings,
+            const Maths::Matrix<double, 4, 4>& clip_transform,
+            const bounding_box& box
+        );
 
-        int make_triangles(
-            int num_vertices,
-            Point in_points[4],
-            Triangle out_triangles[2],
+        /*  Vertex processing - transform each of count vertices of a mesh
+            (the vertices numbered mesh_indices[0] to
+            mesh_indices[count - 1]) to camera space, by the model view
+            transforms of its positions and normals, and light it (Gouraud
+            shading), appending the results to the post-transform vertex
+            buffer. This is done once per vertex, no matter how many
+            triangles share it. Scratch space is allocated from arena. */
+        void process_model_vertices(
+            const frame_settings& settings,
+            PointBuffer& vertices,
+            const Maths::Matrix<double, 4, 4>& transform,
+            const Maths::Matrix<double, 4, 4>& normal_matrix,
+            const LightBuffer& lights,
+            const Mesh& mesh,
+            const int* mesh_indices,
+            size_t count,
+            FrameArena& arena
+        );
+
+        /*  As process_model_vertices, but for a static model whose vertices
+            are already in world space - they are lit there, by world space
+            lights with the camera at eye, and then transformed straight to
+            clip space by clip_transform. */
+        void process_static_vertices(
+            const frame_settings& settings,
+            PointBuffer& vertices,
+            const world_vertices& world,
+            const Maths::Matrix<double, 4, 4>& clip_transform,
+            const LightBuffer& lights,
+            const Maths::Vector<double, 4>& eye,
+            const Mesh& mesh,
+            const int* mesh_indices,
+            size_t count,
+            FrameArena& arena
+        );
+
+        /*  Light count vertices, given their positions and unit normals
+            (in the same space as the lights, with the camera at eye), and
+            append them to the post-transform vertex buffer with their clip
+            space positions and the rest of their attributes from the mesh. */
+        void shade_vertices(
+            const frame_settings& settings,
+            PointBuffer& vertices,
+            const point_stream& positions,
+            const point_stream& normals,
+            const point_stream& clip_positions,
+            const LightBuffer& lights,
+            const Maths::Vector<double, 4>& eye,
+            const Mesh& mesh,
+            const int* mesh_indices,
+            size_t count
+        );
+
+        /*  Compute the intensity of a vertex with the given unit normal, the
+            vertex, lights and eye (the position of the camera, as an offset
+            with w = 0) being in the same space - zero in camera space. */
+        void compute_vertex_lighting(
+            Point& point,
+            const Maths::Vector<double, 4>& normal,
+            const LightBuffer& lights,
+            const Maths::Vector<double, 4>& eye
+        );
+
+        /*  Triangle assembly - build face_count triangles from processed
+            vertices, which start at first_vertex in vertices. The vertices
+            of face f are slots[faces[3 * f]], slots[faces[3 * f + 1]] and
+            slots[faces[3 * f + 2]] vertices on from there. */
+        void assemble_triangles(
+            TriangleBuffer& triangles,
+            IndexBuffer& active_indices,
+            const PointBuffer& vertices,
+            size_t first_vertex,
+            const int* faces,
+            int face_count,
+            const int* slots,
             Resources::TrueColourBitmap* bitmap_ptr
         );
 
-        /*  Clip triangles - another template function, this time that clips
-            a list of triangles using specific region-checking and
-            interpolation functors. Once again, this must be defined in the
-            class declaration as it is a template function. */
-        template <typename F, typename G>
+        /*  Clipping is done in homogeneous clip space, against all of the
+            planes bounding the visible region at once. Each processed vertex
+            carries an outcode - a bit per plane that it lies outside of - so
+            that a triangle entirely inside every plane (all outcodes 0) is
+            accepted, and one entirely outside any single plane (a bit common
+            to all three outcodes) is rejected, without clipping. Only the
+            remaining triangles, which straddle a plane, are clipped, and then
+            only against the planes that they straddle.
+
+            Only the active indices from first_active onwards are clipped.
+            They are compacted in place - the indices of the triangles that
+            survive clipping are moved towards the front of that range,
+            preserving their order, and any further triangles made from a
+            clipped polygon are appended to the end. The outcome of each
+            triangle is counted in stats. */
         void clip_triangles(
-            std::vector<Triangle>& triangles,
-            std::list<int>& active_indices,
-            F in_viewing_region,
-            G get_intersect
-        ) {
-            std::list<int>::iterator itr = active_indices.begin();
-            Point clipped_points[4];
-            int num_clipped_points = 0;
-            Triangle out_triangles[2];
-            int num_triangles = 0;
-
-            while (itr != active_indices.end()) {
-                Triangle* curr_triangle = &triangles[*itr];
-
-                /*  Clip all vertices to obtain nothing, a triangle or a
-                    quad. */
-                num_clipped_points = clip_points(
-                    curr_triangle,
-                    clipped_points,
-                    in_viewing_region,
-                    get_intersect
-                );
-
-                /*  Partition the given shape into triangles. */
-                num_triangles = make_triangles(
-                    num_clipped_points,
-                    clipped_points,
-                    out_triangles,
-                    curr_triangle->bitmap_ptr
-                );
-
-                /*  Add corresponding triangles to passed structures. */
-                if (num_triangles == 0) {
-                    /*  Remove current triangle - fully clipped. Note that the
-                        erase member function on std::list returns the next
-                        iterator, so we can skip the increment below. */
-                    itr = active_indices.erase(itr);
-                    continue;
-                } else if (num_triangles == 1) {
-                    /*  Copy resulting triangle to current triangle address. */
-                    *curr_triangle = out_triangles[0];
-                } else if (num_triangles == 2) {
-                    /*  Copy resulting triangle and add new triangle. */
-                    *curr_triangle = out_triangles[0];
-                    triangles.push_back(out_triangles[1]);
-                    active_indices.push_front(
-                        triangles.size() - 1
-                    );
-                }
-
-                itr ++;
-            }
-        }
-
-        void clip_near_plane(
-            std::vector<Triangle>& triangles,
-            std::list<int>& active_indices
+            const frame_settings& settings,
+            TriangleBuffer& triangles,
+            IndexBuffer& active_indices,
+            size_t first_active,
+            RenderStats& stats
         );
 
-        void perspective_project_triangles(
-            std::vector<Triangle>& triangles,
-            std::list<int>& active_indices
+        unsigned int compute_outcode(
+            const frame_settings& settings,
+            const Maths::Vector<double, 4>& pos
+        );
+
+        /*  Signed distance (scaled) of a clip space point from a plane -
+            negative outside of the visible region. */
+        double clip_plane_distance(
+            const frame_settings& settings,
+            int plane,
+            const Maths::Vector<double, 4>& pos
         );
 
-        void clip_left_bound(
-            std::vector<Triangle>& triangles,
-            std::list<int>& active_indices
+        /*  Sutherland-Hodgman clip a convex polygon of num_vertices vertices,
+            in place, against each plane whose bit is set in planes. Returns
+            the number of vertices left (0 if it was entirely clipped away). */
+        int clip_polygon(
+            const frame_settings& settings,
+            Point polygon[],
+            int num_vertices,
+            unsigned int planes
         );
 
-        void clip_right_bound(
-            std::vector<Triangle>& triangles,
-            std::list<int>& active_indices
+        /*  Make triangles from a convex polygon - returns the number of
+            triangles (num_vertices - 2, or 0 if fewer than 3 vertices). */
+        int make_triangles(
+            int num_vertices,
+            const Point in_points[],
+            Triangle out_triangles[],
+            Resources::TrueColourBitmap* bitmap_ptr
         );
 
-        void clip_top_bound(
-            std::vector<Triangle>& triangles,
-            std::list<int>& active_indices
+        /*  Perspective divide - from clip space to the view plane. As with
+            clipping, only the active triangles from first_active onwards are
+            processed, and scratch space is allocated from arena. */
+        void perspective_project_triangles(
+            TriangleBuffer& triangles,
+            IndexBuffer& active_indices,
+            size_t first_active,
+            FrameArena& arena
         );
 
-        void clip_bottom_bound(
-            std::vector<Triangle>& triangles,
-            std::list<int>& active_indices
+        void convert_triangles_to_pixel_space(
+            const frame_settings& settings,
+            TriangleBuffer& triangles,
+            IndexBuffer& active_indices,
+            size_t first_active,
+            int buffer_width,
+            int buffer_height,
+            FrameArena& arena
         );
 
-        void clip_screen_bounds(
-            std::vector<Triangle>& triangles,
-            std::list<int>& active_indices
+        /*  Clear the depth buffer, and rasterise the triangles of the draw
+            list of a frame, in order. */
+        void rasterise_triangles(
+            frame_context& frame,
+            const System::FramebufferView& framebuffer
         );
 
-        void convert_triangles_to_pixel_space(
-            std::vector<Triangle>& triangles,
-            std::list<int>& active_indices,
+        /*  Sort the triangles of the draw list into the screen tiles that
+            their bounding boxes overlap, preserving their order within each
+            tile. The triangles of tile t are those of the draw list at
+            tile_indices[tile_offsets[t]] up to
+            tile_indices[tile_offsets[t + 1]]. Both arrays are allocated from
+            the frame's arena. */
+        void bin_triangles_into_tiles(
+            frame_context& frame,
             int buffer_width,
             int buffer_height
         );
-    
-        void rasterise_triangles(
-            System::RenderWindow& render_window,
-            std::vector<Triangle>& triangles,
-            std::list<int>& active_indices
+
+        /*  The rasteriser that frames are drawn with - the half-space
+            rasteriser if the precision is FIXED, otherwise the one selected
+            by the mode. */
+        static RasteriserMode get_frame_rasteriser_mode(
+            const frame_settings& settings
+        );
+
+        /*  The fraction of a pixel that vertices are placed to is one over
+            this, for the rasteriser precision. */
+        static double get_subpixel_scale(const frame_settings& settings);
+
+        void rasterise_triangle(
+            const frame_settings& settings,
+            const System::FramebufferView& framebuffer,
+            const Triangle& triangle,
+            const pixel_rect& scissor
         );
 
         double fov;
         double aspect_ratio;
         double view_plane_distance;
-        double far_plane_distance;
 
         const double screen_left_bound;
         const double screen_right_bound;
         const double screen_top_bound;
         const double screen_bottom_bound;
-        
+
+        /*  Camera space to clip space. The visible region of clip space is
+            bounded by the near plane (w >= view_plane_distance), the far
+            plane (w <= far_plane_distance) and the four planes through the
+            camera and the screen bounds (e.g. x >= screen_left_bound * w). */
+        const Maths::Matrix<double, 4, 4> projection_transform;
+
+        /*  Triangles are only clipped against the near and far planes and
+            the planes through the guard band bounds - the screen planes are
+            used to reject triangles, but not to clip them. */
+        static constexpr int NUM_CLIP_PLANES = 6;
+
+        RenderStats render_stats {};
+
+        /*  Clipping a triangle against a plane adds at most one vertex. */
+        static constexpr int MAX_CLIPPED_VERTICES = 3 + NUM_CLIP_PLANES;
+
+        /*  The settings of subsequent frames, copied into each frame as it
+            starts. */
+        frame_settings settings;
+
+        int tile_size;
+        std::unique_ptr<WorkerPool> worker_pool;
+
+        /*  The frame used by render_scene. */
+        std::unique_ptr<frame_context> immediate_frame;
+
+        /*  Pipeline state - the frames are created, and the threads started,
+            by the first call to submit_scene. Frames are numbered in the
+            order they are submitted, and pass through the stages in that
+            order. Changes of stage are made with the mutex held, and
+            signalled through frame_changed. */
+        std::vector<std::unique_ptr<frame_context>> pipeline_frames;
+        std::thread geometry_stage_thread;
+        std::thread raster_stage_thread;
+        std::mutex pipeline_mutex;
+        std::condition_variable frame_changed;
+        unsigned long long submitted_frames = 0;
+        unsigned long long returned_frames = 0;
+        bool stop_pipeline = false;
 };
 
+/*  Copy a frame (e.g. returned by Renderer::wait_frame) into the render and
+    depth buffers of a window, ready to be displayed. Only the area the two
+    have in common is copied. Pixels and depths are copied as they are if
+    the window has the same pixel format and depth format (and scale) as the
+    frame, or converted one at a time otherwise. */
+void copy_framebuffer(
+    const System::FramebufferView& frame,
+    System::RenderWindow& render_window
+);
+
 }
 
 #endif
\ No newline at end of file
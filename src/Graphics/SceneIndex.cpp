@@ -0,0 +1,47 @@
+/*  SceneIndex.cpp
+
+    Implements the scene index. */
+
+#include "SceneIndex.hpp"
+
+namespace Graphics {
+
+void SceneIndex::build(const std::vector<Model*>& models) {
+    this->models = models;
+    this->placements.clear();
+
+    std::vector<bounding_box> boxes;
+
+    for (const Model* m : this->models) {
+        this->placements.push_back(model_placement {
+            m->position,
+            m->rotation,
+            m->scale
+        });
+        boxes.push_back(get_model_bounds(*m));
+    }
+
+    this->bvh.build(boxes.data(), boxes.size());
+}
+
+void SceneIndex::update() {
+    for (size_t n = 0; n < this->models.size(); n++) {
+        const Model& m = *this->models[n];
+        model_placement& placement = this->placements[n];
+
+        if (m.position == placement.position &&
+            m.rotation == placement.rotation &&
+            m.scale == placement.scale) {
+            continue;
+        }
+
+        placement = model_placement { m.position, m.rotation, m.scale };
+        this->bvh.refit(n, get_model_bounds(m));
+    }
+}
+
+const std::vector<Model*>& SceneIndex::get_models() const {
+    return this->models;
+}
+
+}
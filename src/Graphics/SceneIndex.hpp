@@ -0,0 +1,90 @@
+/*  SceneIndex.hpp
+
+    An optional index over the models of a scene - a bounding volume
+    hierarchy over their world space bounding boxes. Given one, the Renderer
+    culls whole groups of models against the view frustum at once rather
+    than testing every model, and it can also be used to find the models a
+    ray may hit or that overlap a box (e.g. for picking or collisions).
+
+    The index keeps pointers to the models, so notices when they move: update
+    refits the boxes of the models whose position, rotation or scale has
+    changed since it was last called. */
+
+#ifndef SCENE_INDEX_HPP
+#define SCENE_INDEX_HPP
+
+#include "BVH.hpp"
+#include "Model.hpp"
+
+#include <vector>
+
+namespace Graphics {
+
+class SceneIndex {
+    public:
+        /*  (Re)build the index over a set of models. Models must not be
+            added or removed, nor their meshes changed, while the index is in
+            use - build it again instead. */
+        void build(const std::vector<Model*>& models);
+
+        /*  Refit the boxes of the models that have moved since the index was
+            built or last updated. The Renderer calls this at the start of
+            each frame, so it never sees stale boxes. */
+        void update();
+
+        const std::vector<Model*>& get_models() const;
+
+        /*  As BVH::query, calling visit(model, inside). */
+        template <typename C, typename F>
+        void query(const C& classify, const F& visit) const {
+            this->bvh.query(classify, [&](int item, bool inside) {
+                visit(this->models[item], inside);
+            });
+        }
+
+        /*  As BVH::query, calling visit(n, inside) with the position of the
+            model in get_models(). */
+        template <typename C, typename F>
+        void query_indices(const C& classify, const F& visit) const {
+            this->bvh.query(classify, visit);
+        }
+
+        /*  As BVH::query_ray, calling visit(model, t). */
+        template <typename F>
+        void query_ray(
+            const Maths::Vector<double, 4>& origin,
+            const Maths::Vector<double, 4>& direction,
+            double max_t,
+            const F& visit
+        ) const {
+            this->bvh.query_ray(origin, direction, max_t,
+                [&](int item, double t) {
+                    visit(this->models[item], t);
+                }
+            );
+        }
+
+        /*  As BVH::query_box, calling visit(model). */
+        template <typename F>
+        void query_box(const bounding_box& box, const F& visit) const {
+            this->bvh.query_box(box, [&](int item) {
+                visit(this->models[item]);
+            });
+        }
+
+    private:
+        /*  The transform of a model when its box was last computed. */
+        struct model_placement {
+            Maths::Vector<double, 4> position;
+            Maths::Vector<double, 4> rotation;
+            Maths::Vector<double, 4> scale;
+        };
+
+        std::vector<Model*> models;
+        std::vector<model_placement> placements;
+        BVH bvh;
+};
+
+}
+
+#endif
@@ -0,0 +1,1278 @@
+/*  SpanKernel.cpp
+
+    Scalar, SSE2 and AVX2 span kernels and the runtime dispatch between them.
+
+    To keep the output of every kernel identical, the scalar kernel mirrors the
+    vector instructions exactly:
+        - One reciprocal of 1/z is computed per pixel and every attribute is
+          multiplied by it (rather than dividing each attribute by 1/z).
+        - Clamping uses max_lane and min_lane, which have the same semantics as
+          the maxpd and minpd instructions (including for NaN operands).
+        - Rounding of texture coordinates and truncation of colours use the
+          same truncating conversion as cvttpd2dq, applied after clamping so
+          that values are never negative.
+
+    Each kernel is a template over the shading features of the span (see
+    triangle_shading), instantiated for every combination of them. A
+    feature's test is then resolved at compile time, so a variant does no
+    work for the features it lacks - no interpolation of attributes held
+    constant, no texture fetch, and no reading or writing of depths that are
+    not tested or written.
+
+    Kernels are also templates over the format of the depth buffer. Inverse
+    depths are converted to the format first (see encode_depth), and the
+    converted values compared with the depth buffer, so that a pixel is
+    drawn exactly when the value it would write is greater than the one it
+    would replace. */
+
+#include "SpanKernel.hpp"
+
+#include <cstring>
+#include <utility>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define SPAN_KERNEL_X86
+#include <immintrin.h>
+#endif
+
+namespace Graphics {
+
+template <typename T>
+static inline T max_lane(T a, T b) {
+    return a > b ? a : b;
+}
+
+template <typename T>
+static inline T min_lane(T a, T b) {
+    return a < b ? a : b;
+}
+
+/*  The type of a single depth in each format. */
+template <System::DepthFormat D>
+struct depth_storage {
+    using type = double;
+};
+
+template <>
+struct depth_storage<System::DepthFormat::FLOAT32> {
+    using type = float;
+};
+
+template <>
+struct depth_storage<System::DepthFormat::UNORM24> {
+    using type = uint32_t;
+};
+
+template <>
+struct depth_storage<System::DepthFormat::UNORM16> {
+    using type = uint16_t;
+};
+
+template <System::DepthFormat D>
+static constexpr bool is_unorm_depth() {
+    return D == System::DepthFormat::UNORM24 ||
+        D == System::DepthFormat::UNORM16;
+}
+
+template <System::DepthFormat D>
+static constexpr uint32_t get_unorm_depth_max() {
+    return D == System::DepthFormat::UNORM16 ? System::UNORM16_DEPTH_MAX :
+        System::UNORM24_DEPTH_MAX;
+}
+
+/*  An inverse depth of type T as stored in format D. The UNORM formats clamp
+    and then truncate, as cvttpd2dq and cvttps2dq do. */
+template <System::DepthFormat D, typename T>
+static inline typename depth_storage<D>::type encode_depth(T inv_z, T scale) {
+    if (is_unorm_depth<D>()) {
+        return (int) min_lane(max_lane(inv_z * scale, (T) 0.0),
+            (T) get_unorm_depth_max<D>());
+    }
+
+    return inv_z;
+}
+
+template <System::DepthFormat D, typename T>
+static inline void write_depth(const span_output& output, int n, T inv_z) {
+    using depth_type = typename depth_storage<D>::type;
+
+    ((depth_type*) output.depth)[n] = encode_depth<D>(inv_z,
+        (T) output.depth_scale);
+}
+
+/*  Shade the pixels of a span from index first onwards, with attributes of
+    type T (double, or float for RasteriserPrecision::FLOAT), into a depth
+    buffer of format D. Also used by the vector kernels for the pixels left
+    over after their last full vector. */
+template <typename T, unsigned int F, System::DepthFormat D>
+static void shade_span_scalar_from(
+    const span_input& input,
+    const span_output& output,
+    int first
+) {
+    using depth_type = typename depth_storage<D>::type;
+
+    const pixel_coord& origin = input.origin;
+    const pixel_coord& step = input.step;
+    const Resources::TrueColourBitmap* bitmap_ptr = input.bitmap_ptr;
+
+    depth_type* depth = (depth_type*) output.depth;
+    const T depth_scale = output.depth_scale;
+
+    const T zero = 0.0;
+    const T max_channel = 255.0;
+
+    for (int n = first; n < input.count; n++) {
+        T k = input.k_start + n;
+
+        T inv_z = (T) origin.inv_z + k * (T) step.inv_z;
+
+        depth_type depth_value = 0;
+
+        if (F & (SHADE_DEPTH_TEST | SHADE_DEPTH_WRITE)) {
+            depth_value = encode_depth<D>(inv_z, depth_scale);
+        }
+
+        /*  Check depth buffer. */
+        if ((F & SHADE_DEPTH_TEST) && !(depth_value > depth[n])) {
+            continue;
+        }
+
+        /*  Recover the attributes by multiplying I/z by z = 1 / (1/z). */
+        T z = (T) 1.0 / inv_z;
+
+        T intensity = input.intensity;
+        T mix_r = input.red;
+        T mix_g = input.green;
+        T mix_b = input.blue;
+
+        if (F & SHADE_GOURAUD) {
+            intensity = ((T) origin.i_div_z + k * (T) step.i_div_z) * z;
+        }
+
+        if (F & SHADE_VERTEX_COLOUR) {
+            mix_r = ((T) origin.r_div_z + k * (T) step.r_div_z) * z;
+            mix_g = ((T) origin.g_div_z + k * (T) step.g_div_z) * z;
+            mix_b = ((T) origin.b_div_z + k * (T) step.b_div_z) * z;
+        }
+
+        if (F & SHADE_TEXTURE) {
+            T tex_x = ((T) origin.tex_x_div_z + k * (T) step.tex_x_div_z) * z;
+            T tex_y = ((T) origin.tex_y_div_z + k * (T) step.tex_y_div_z) * z;
+
+            /*  Clamp to the bitmap, then round to the nearest texel. */
+            T max_x = bitmap_ptr->width - 1;
+            T max_y = bitmap_ptr->height - 1;
+
+            int pixel_x = (int) (min_lane(max_lane(tex_x * max_x, zero), max_x)
+                + (T) 0.5);
+            int pixel_y = (int) (min_lane(max_lane(tex_y * max_y, zero), max_y)
+                + (T) 0.5);
+
+            pixel_y = bitmap_ptr->height - 1 - pixel_y;
+
+            const Resources::RGBAPixel& texel =
+                bitmap_ptr->pixels[pixel_y * bitmap_ptr->width + pixel_x];
+
+            mix_r = texel.r * (mix_r / max_channel);
+            mix_g = texel.g * (mix_g / max_channel);
+            mix_b = texel.b * (mix_b / max_channel);
+        }
+
+        uint32_t red = (int) min_lane(max_lane(mix_r * intensity, zero),
+            max_channel);
+        uint32_t green = (int) min_lane(max_lane(mix_g * intensity, zero),
+            max_channel);
+        uint32_t blue = (int) min_lane(max_lane(mix_b * intensity, zero),
+            max_channel);
+
+        output.colour[n] = (red << output.red_shift) |
+            (green << output.green_shift) | (blue << output.blue_shift);
+
+        if (F & SHADE_DEPTH_WRITE) {
+            depth[n] = depth_value;
+        }
+    }
+}
+
+template <typename T, unsigned int F, System::DepthFormat D>
+static void shade_span_scalar(
+    const span_input& input,
+    const span_output& output
+) {
+    shade_span_scalar_from<T, F, D>(input, output, 0);
+}
+
+#ifdef SPAN_KERNEL_X86
+
+/*  (a + k * a_step) * z - recover an attribute from its value divided by
+    depth. */
+__attribute__((target("sse2")))
+static inline __m128d attribute_sse2(double a, double a_step, __m128d k,
+    __m128d z) {
+    return _mm_mul_pd(_mm_add_pd(_mm_set1_pd(a),
+        _mm_mul_pd(k, _mm_set1_pd(a_step))), z);
+}
+
+__attribute__((target("avx2")))
+static inline __m256d attribute_avx2(double a, double a_step, __m256d k,
+    __m256d z) {
+    return _mm256_mul_pd(_mm256_add_pd(_mm256_set1_pd(a),
+        _mm256_mul_pd(k, _mm256_set1_pd(a_step))), z);
+}
+
+/*  Packed depth test of the two pixels from n onwards, as a bit mask of the
+    lanes that pass. */
+template <System::DepthFormat D>
+__attribute__((target("sse2")))
+static inline int depth_test_sse2(__m128d inv_z, const span_output& output,
+    int n) {
+    if (D == System::DepthFormat::DOUBLE) {
+        return _mm_movemask_pd(_mm_cmpgt_pd(inv_z,
+            _mm_loadu_pd((const double*) output.depth + n)));
+    }
+
+    if (D == System::DepthFormat::FLOAT32) {
+        __m128 stored = _mm_castsi128_ps(_mm_loadl_epi64(
+            (const __m128i*) ((const float*) output.depth + n)));
+
+        return _mm_movemask_ps(_mm_cmpgt_ps(_mm_cvtpd_ps(inv_z), stored)) &
+            3;
+    }
+
+    __m128i values = _mm_cvttpd_epi32(_mm_min_pd(_mm_max_pd(
+        _mm_mul_pd(inv_z, _mm_set1_pd(output.depth_scale)),
+        _mm_setzero_pd()), _mm_set1_pd(get_unorm_depth_max<D>())));
+
+    __m128i stored;
+
+    if (D == System::DepthFormat::UNORM24) {
+        stored = _mm_loadl_epi64(
+            (const __m128i*) ((const uint32_t*) output.depth + n));
+    } else {
+        /*  Zero extend the two 16 bit depths. */
+        uint32_t pair;
+        std::memcpy(&pair, (const uint16_t*) output.depth + n, sizeof(pair));
+
+        stored = _mm_unpacklo_epi16(_mm_cvtsi32_si128(pair),
+            _mm_setzero_si128());
+    }
+
+    return _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpgt_epi32(values,
+        stored))) & 3;
+}
+
+/*  The inverse depths of four pixels in a UNORM format, in 32 bit lanes. */
+template <System::DepthFormat D>
+__attribute__((target("avx2")))
+static inline __m128i depth_values_avx2(__m256d inv_z,
+    const span_output& output) {
+    return _mm256_cvttpd_epi32(_mm256_min_pd(_mm256_max_pd(
+        _mm256_mul_pd(inv_z, _mm256_set1_pd(output.depth_scale)),
+        _mm256_setzero_pd()), _mm256_set1_pd(get_unorm_depth_max<D>())));
+}
+
+/*  The depths of the four pixels from n onwards in a UNORM depth buffer, in
+    32 bit lanes. */
+template <System::DepthFormat D>
+__attribute__((target("avx2")))
+static inline __m128i load_depths_avx2(const span_output& output, int n) {
+    if (D == System::DepthFormat::UNORM16) {
+        return _mm_cvtepu16_epi32(_mm_loadl_epi64(
+            (const __m128i*) ((const uint16_t*) output.depth + n)));
+    }
+
+    return _mm_loadu_si128(
+        (const __m128i*) ((const uint32_t*) output.depth + n));
+}
+
+/*  Packed depth test of the four pixels from n onwards, as a mask of 32 bit
+    lanes (set for those that pass). */
+template <System::DepthFormat D>
+__attribute__((target("avx2")))
+static inline __m128i depth_test_avx2(__m256d inv_z,
+    const span_output& output, int n) {
+    if (D == System::DepthFormat::DOUBLE) {
+        __m256d pass = _mm256_cmp_pd(inv_z,
+            _mm256_loadu_pd((const double*) output.depth + n), _CMP_GT_OQ);
+
+        /*  Select the low 32 bits of each 64 bit lane. */
+        return _mm256_castsi256_si128(_mm256_permutevar8x32_epi32(
+            _mm256_castpd_si256(pass),
+            _mm256_setr_epi32(0, 2, 4, 6, 0, 0, 0, 0)));
+    }
+
+    if (D == System::DepthFormat::FLOAT32) {
+        return _mm_castps_si128(_mm_cmp_ps(_mm256_cvtpd_ps(inv_z),
+            _mm_loadu_ps((const float*) output.depth + n), _CMP_GT_OQ));
+    }
+
+    return _mm_cmpgt_epi32(depth_values_avx2<D>(inv_z, output),
+        load_depths_avx2<D>(output, n));
+}
+
+/*  Write the inverse depths of the lanes of the four pixels from n onwards
+    that are set in mask. */
+template <System::DepthFormat D>
+__attribute__((target("avx2")))
+static inline void store_depths_avx2(__m256d inv_z, __m128i mask,
+    const span_output& output, int n) {
+    if (D == System::DepthFormat::DOUBLE) {
+        _mm256_maskstore_pd((double*) output.depth + n,
+            _mm256_cvtepi32_epi64(mask), inv_z);
+        return;
+    }
+
+    if (D == System::DepthFormat::FLOAT32) {
+        _mm_maskstore_ps((float*) output.depth + n, mask,
+            _mm256_cvtpd_ps(inv_z));
+        return;
+    }
+
+    __m128i values = depth_values_avx2<D>(inv_z, output);
+
+    if (D == System::DepthFormat::UNORM24) {
+        _mm_maskstore_epi32((int*) ((uint32_t*) output.depth + n), mask,
+            values);
+        return;
+    }
+
+    /*  There is no masked store of 16 bit lanes, so blend with the depths
+        already there. */
+    values = _mm_blendv_epi8(load_depths_avx2<D>(output, n), values, mask);
+
+    _mm_storel_epi64((__m128i*) ((uint16_t*) output.depth + n),
+        _mm_packus_epi32(values, values));
+}
+
+template <unsigned int F, System::DepthFormat D>
+__attribute__((target("sse2")))
+static void shade_span_sse2(
+    const span_input& input,
+    const span_output& output
+) {
+    const pixel_coord& origin = input.origin;
+    const pixel_coord& step = input.step;
+    const Resources::TrueColourBitmap* bitmap_ptr = input.bitmap_ptr;
+
+    const __m128d lane_offsets = _mm_set_pd(1.0, 0.0);
+    const __m128d zero = _mm_setzero_pd();
+    const __m128d one = _mm_set1_pd(1.0);
+    const __m128d half = _mm_set1_pd(0.5);
+    const __m128d max_channel = _mm_set1_pd(255.0);
+
+    const __m128i red_shift = _mm_cvtsi32_si128(output.red_shift);
+    const __m128i green_shift = _mm_cvtsi32_si128(output.green_shift);
+    const __m128i blue_shift = _mm_cvtsi32_si128(output.blue_shift);
+    const __m128i channel_mask = _mm_set1_epi32(0xff);
+
+    __m128d max_x = zero;
+    __m128d max_y = zero;
+
+    if (F & SHADE_TEXTURE) {
+        max_x = _mm_set1_pd(bitmap_ptr->width - 1);
+        max_y = _mm_set1_pd(bitmap_ptr->height - 1);
+    }
+
+    int n = 0;
+
+    for (; n + 2 <= input.count; n += 2) {
+        __m128d k = _mm_add_pd(_mm_set1_pd(input.k_start + n), lane_offsets);
+
+        __m128d inv_z = _mm_add_pd(_mm_set1_pd(origin.inv_z),
+            _mm_mul_pd(k, _mm_set1_pd(step.inv_z)));
+
+        /*  Packed depth test. */
+        int mask = 3;
+
+        if (F & SHADE_DEPTH_TEST) {
+            mask = depth_test_sse2<D>(inv_z, output, n);
+
+            if (mask == 0) {
+                continue;
+            }
+        }
+
+        __m128d z = _mm_div_pd(one, inv_z);
+
+        __m128d intensity = _mm_set1_pd(input.intensity);
+        __m128d mix_r = _mm_set1_pd(input.red);
+        __m128d mix_g = _mm_set1_pd(input.green);
+        __m128d mix_b = _mm_set1_pd(input.blue);
+
+        if (F & SHADE_GOURAUD) {
+            intensity = attribute_sse2(origin.i_div_z, step.i_div_z, k, z);
+        }
+
+        if (F & SHADE_VERTEX_COLOUR) {
+            mix_r = attribute_sse2(origin.r_div_z, step.r_div_z, k, z);
+            mix_g = attribute_sse2(origin.g_div_z, step.g_div_z, k, z);
+            mix_b = attribute_sse2(origin.b_div_z, step.b_div_z, k, z);
+        }
+
+        if (F & SHADE_TEXTURE) {
+            __m128d tex_x = attribute_sse2(origin.tex_x_div_z,
+                step.tex_x_div_z, k, z);
+            __m128d tex_y = attribute_sse2(origin.tex_y_div_z,
+                step.tex_y_div_z, k, z);
+
+            __m128i pixel_x = _mm_cvttpd_epi32(_mm_add_pd(_mm_min_pd(
+                _mm_max_pd(_mm_mul_pd(tex_x, max_x), zero), max_x), half));
+            __m128i pixel_y = _mm_cvttpd_epi32(_mm_add_pd(_mm_min_pd(
+                _mm_max_pd(_mm_mul_pd(tex_y, max_y), zero), max_y), half));
+
+            /*  SSE2 has no gather, so fetch the two texels individually. */
+            int x0 = _mm_cvtsi128_si32(pixel_x);
+            int x1 = _mm_cvtsi128_si32(_mm_srli_si128(pixel_x, 4));
+            int y0 = _mm_cvtsi128_si32(pixel_y);
+            int y1 = _mm_cvtsi128_si32(_mm_srli_si128(pixel_y, 4));
+
+            int indices[2] = {
+                (bitmap_ptr->height - 1 - y0) * bitmap_ptr->width + x0,
+                (bitmap_ptr->height - 1 - y1) * bitmap_ptr->width + x1
+            };
+
+            const uint32_t* texels =
+                (const uint32_t*) bitmap_ptr->pixels.data();
+            __m128i texel = _mm_set_epi32(0, 0, texels[indices[1]],
+                texels[indices[0]]);
+
+            /*  RGBAPixel is laid out as a, b, g, r in memory. */
+            __m128d texel_r = _mm_cvtepi32_pd(_mm_srli_epi32(texel, 24));
+            __m128d texel_g = _mm_cvtepi32_pd(_mm_and_si128(
+                _mm_srli_epi32(texel, 16), channel_mask));
+            __m128d texel_b = _mm_cvtepi32_pd(_mm_and_si128(
+                _mm_srli_epi32(texel, 8), channel_mask));
+
+            mix_r = _mm_mul_pd(texel_r, _mm_div_pd(mix_r, max_channel));
+            mix_g = _mm_mul_pd(texel_g, _mm_div_pd(mix_g, max_channel));
+            mix_b = _mm_mul_pd(texel_b, _mm_div_pd(mix_b, max_channel));
+        }
+
+        __m128i red = _mm_cvttpd_epi32(_mm_min_pd(_mm_max_pd(
+            _mm_mul_pd(mix_r, intensity), zero), max_channel));
+        __m128i green = _mm_cvttpd_epi32(_mm_min_pd(_mm_max_pd(
+            _mm_mul_pd(mix_g, intensity), zero), max_channel));
+        __m128i blue = _mm_cvttpd_epi32(_mm_min_pd(_mm_max_pd(
+            _mm_mul_pd(mix_b, intensity), zero), max_channel));
+
+        __m128i pixels = _mm_or_si128(_mm_or_si128(
+            _mm_sll_epi32(red, red_shift), _mm_sll_epi32(green, green_shift)),
+            _mm_sll_epi32(blue, blue_shift));
+
+        /*  SSE2 has no masked store, so write the passing lanes singly. */
+        if (mask & 1) {
+            output.colour[n] = _mm_cvtsi128_si32(pixels);
+
+            if (F & SHADE_DEPTH_WRITE) {
+                write_depth<D>(output, n, _mm_cvtsd_f64(inv_z));
+            }
+        }
+
+        if (mask & 2) {
+            output.colour[n + 1] = _mm_cvtsi128_si32(
+                _mm_srli_si128(pixels, 4));
+
+            if (F & SHADE_DEPTH_WRITE) {
+                write_depth<D>(output, n + 1,
+                    _mm_cvtsd_f64(_mm_unpackhi_pd(inv_z, inv_z)));
+            }
+        }
+    }
+
+    shade_span_scalar_from<double, F, D>(input, output, n);
+}
+
+template <unsigned int F, System::DepthFormat D>
+__attribute__((target("avx2")))
+static void shade_span_avx2(
+    const span_input& input,
+    const span_output& output
+) {
+    const pixel_coord& origin = input.origin;
+    const pixel_coord& step = input.step;
+    const Resources::TrueColourBitmap* bitmap_ptr = input.bitmap_ptr;
+
+    const __m256d lane_offsets = _mm256_set_pd(3.0, 2.0, 1.0, 0.0);
+    const __m256d zero = _mm256_setzero_pd();
+    const __m256d one = _mm256_set1_pd(1.0);
+    const __m256d half = _mm256_set1_pd(0.5);
+    const __m256d max_channel = _mm256_set1_pd(255.0);
+
+    const __m128i red_shift = _mm_cvtsi32_si128(output.red_shift);
+    const __m128i green_shift = _mm_cvtsi32_si128(output.green_shift);
+    const __m128i blue_shift = _mm_cvtsi32_si128(output.blue_shift);
+    const __m128i channel_mask = _mm_set1_epi32(0xff);
+
+    __m256d max_x = zero;
+    __m256d max_y = zero;
+    __m128i bitmap_width = _mm_setzero_si128();
+    __m128i bitmap_max_y = _mm_setzero_si128();
+
+    if (F & SHADE_TEXTURE) {
+        max_x = _mm256_set1_pd(bitmap_ptr->width - 1);
+        max_y = _mm256_set1_pd(bitmap_ptr->height - 1);
+        bitmap_width = _mm_set1_epi32(bitmap_ptr->width);
+        bitmap_max_y = _mm_set1_epi32(bitmap_ptr->height - 1);
+    }
+
+    int n = 0;
+
+    for (; n + 4 <= input.count; n += 4) {
+        __m256d k = _mm256_add_pd(_mm256_set1_pd(input.k_start + n),
+            lane_offsets);
+
+        __m256d inv_z = _mm256_add_pd(_mm256_set1_pd(origin.inv_z),
+            _mm256_mul_pd(k, _mm256_set1_pd(step.inv_z)));
+
+        /*  Packed depth test. */
+        __m128i pass = _mm_set1_epi32(-1);
+
+        if (F & SHADE_DEPTH_TEST) {
+            pass = depth_test_avx2<D>(inv_z, output, n);
+
+            if (_mm_movemask_ps(_mm_castsi128_ps(pass)) == 0) {
+                continue;
+            }
+        }
+
+        __m256d z = _mm256_div_pd(one, inv_z);
+
+        __m256d intensity = _mm256_set1_pd(input.intensity);
+        __m256d mix_r = _mm256_set1_pd(input.red);
+        __m256d mix_g = _mm256_set1_pd(input.green);
+        __m256d mix_b = _mm256_set1_pd(input.blue);
+
+        if (F & SHADE_GOURAUD) {
+            intensity = attribute_avx2(origin.i_div_z, step.i_div_z, k, z);
+        }
+
+        if (F & SHADE_VERTEX_COLOUR) {
+            mix_r = attribute_avx2(origin.r_div_z, step.r_div_z, k, z);
+            mix_g = attribute_avx2(origin.g_div_z, step.g_div_z, k, z);
+            mix_b = attribute_avx2(origin.b_div_z, step.b_div_z, k, z);
+        }
+
+        if (F & SHADE_TEXTURE) {
+            __m256d tex_x = attribute_avx2(origin.tex_x_div_z,
+                step.tex_x_div_z, k, z);
+            __m256d tex_y = attribute_avx2(origin.tex_y_div_z,
+                step.tex_y_div_z, k, z);
+
+            __m128i pixel_x = _mm256_cvttpd_epi32(_mm256_add_pd(
+                _mm256_min_pd(_mm256_max_pd(_mm256_mul_pd(tex_x, max_x),
+                zero), max_x), half));
+            __m128i pixel_y = _mm256_cvttpd_epi32(_mm256_add_pd(
+                _mm256_min_pd(_mm256_max_pd(_mm256_mul_pd(tex_y, max_y),
+                zero), max_y), half));
+
+            /*  Texture coordinates are clamped even for lanes that failed the
+                depth test, so every lane can be gathered safely. */
+            __m128i indices = _mm_add_epi32(_mm_mullo_epi32(
+                _mm_sub_epi32(bitmap_max_y, pixel_y), bitmap_width), pixel_x);
+
+            __m128i texel = _mm_i32gather_epi32(
+                (const int*) bitmap_ptr->pixels.data(), indices, 4);
+
+            /*  RGBAPixel is laid out as a, b, g, r in memory. */
+            __m256d texel_r = _mm256_cvtepi32_pd(_mm_srli_epi32(texel, 24));
+            __m256d texel_g = _mm256_cvtepi32_pd(_mm_and_si128(
+                _mm_srli_epi32(texel, 16), channel_mask));
+            __m256d texel_b = _mm256_cvtepi32_pd(_mm_and_si128(
+                _mm_srli_epi32(texel, 8), channel_mask));
+
+            mix_r = _mm256_mul_pd(texel_r, _mm256_div_pd(mix_r, max_channel));
+            mix_g = _mm256_mul_pd(texel_g, _mm256_div_pd(mix_g, max_channel));
+            mix_b = _mm256_mul_pd(texel_b, _mm256_div_pd(mix_b, max_channel));
+        }
+
+        __m128i red = _mm256_cvttpd_epi32(_mm256_min_pd(_mm256_max_pd(
+            _mm256_mul_pd(mix_r, intensity), zero), max_channel));
+        __m128i green = _mm256_cvttpd_epi32(_mm256_min_pd(_mm256_max_pd(
+            _mm256_mul_pd(mix_g, intensity), zero), max_channel));
+        __m128i blue = _mm256_cvttpd_epi32(_mm256_min_pd(_mm256_max_pd(
+            _mm256_mul_pd(mix_b, intensity), zero), max_channel));
+
+        __m128i pixels = _mm_or_si128(_mm_or_si128(
+            _mm_sll_epi32(red, red_shift), _mm_sll_epi32(green, green_shift)),
+            _mm_sll_epi32(blue, blue_shift));
+
+        /*  Write only the lanes that passed the depth test. */
+        if (F & SHADE_DEPTH_TEST) {
+            _mm_maskstore_epi32((int*) (output.colour + n), pass, pixels);
+        } else {
+            _mm_storeu_si128((__m128i*) (output.colour + n), pixels);
+        }
+
+        if (F & SHADE_DEPTH_WRITE) {
+            store_depths_avx2<D>(inv_z, pass, output, n);
+        }
+    }
+
+    shade_span_scalar_from<double, F, D>(input, output, n);
+}
+
+/*  Single precision kernels - the same steps as the double kernels, with
+    twice as many pixels per vector. A DOUBLE depth buffer holds twice as
+    many bits as the inverse depths, which are widened to compare with and
+    write to it. */
+__attribute__((target("sse2")))
+static inline __m128 attribute_sse2_float(float a, float a_step, __m128 k,
+    __m128 z) {
+    return _mm_mul_ps(_mm_add_ps(_mm_set1_ps(a),
+        _mm_mul_ps(k, _mm_set1_ps(a_step))), z);
+}
+
+__attribute__((target("avx2")))
+static inline __m256 attribute_avx2_float(float a, float a_step, __m256 k,
+    __m256 z) {
+    return _mm256_mul_ps(_mm256_add_ps(_mm256_set1_ps(a),
+        _mm256_mul_ps(k, _mm256_set1_ps(a_step))), z);
+}
+
+/*  The inverse depths of four pixels in a FLOAT32 or UNORM format, in 32
+    bit lanes. */
+template <System::DepthFormat D>
+__attribute__((target("sse2")))
+static inline __m128i depth_values_sse2_float(__m128 inv_z,
+    const span_output& output) {
+    if (D == System::DepthFormat::FLOAT32) {
+        return _mm_castps_si128(inv_z);
+    }
+
+    return _mm_cvttps_epi32(_mm_min_ps(_mm_max_ps(
+        _mm_mul_ps(inv_z, _mm_set1_ps(output.depth_scale)),
+        _mm_setzero_ps()), _mm_set1_ps(get_unorm_depth_max<D>())));
+}
+
+/*  Packed depth test of the four pixels from n onwards, as a bit mask of
+    the lanes that pass. */
+template <System::DepthFormat D>
+__attribute__((target("sse2")))
+static inline int depth_test_sse2_float(__m128 inv_z,
+    const span_output& output, int n) {
+    if (D == System::DepthFormat::DOUBLE) {
+        const double* depth = (const double*) output.depth + n;
+
+        return _mm_movemask_pd(_mm_cmpgt_pd(_mm_cvtps_pd(inv_z),
+            _mm_loadu_pd(depth))) |
+            (_mm_movemask_pd(_mm_cmpgt_pd(_mm_cvtps_pd(
+            _mm_movehl_ps(inv_z, inv_z)), _mm_loadu_pd(depth + 2))) << 2);
+    }
+
+    if (D == System::DepthFormat::FLOAT32) {
+        return _mm_movemask_ps(_mm_cmpgt_ps(inv_z,
+            _mm_loadu_ps((const float*) output.depth + n)));
+    }
+
+    __m128i stored;
+
+    if (D == System::DepthFormat::UNORM24) {
+        stored = _mm_loadu_si128(
+            (const __m128i*) ((const uint32_t*) output.depth + n));
+    } else {
+        stored = _mm_unpacklo_epi16(_mm_loadl_epi64(
+            (const __m128i*) ((const uint16_t*) output.depth + n)),
+            _mm_setzero_si128());
+    }
+
+    return _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpgt_epi32(
+        depth_values_sse2_float<D>(inv_z, output), stored)));
+}
+
+/*  Write the inverse depths of all four pixels from n onwards. */
+template <System::DepthFormat D>
+__attribute__((target("sse2")))
+static inline void store_depths_sse2_float(__m128 inv_z,
+    const span_output& output, int n) {
+    if (D == System::DepthFormat::DOUBLE) {
+        double* depth = (double*) output.depth + n;
+
+        _mm_storeu_pd(depth, _mm_cvtps_pd(inv_z));
+        _mm_storeu_pd(depth + 2, _mm_cvtps_pd(_mm_movehl_ps(inv_z, inv_z)));
+        return;
+    }
+
+    __m128i values = depth_values_sse2_float<D>(inv_z, output);
+
+    if (D == System::DepthFormat::UNORM16) {
+        /*  SSE2 can only pack 32 bit lanes into signed 16 bit ones, so
+            offset the values into that range, and back again. */
+        __m128i packed = _mm_packs_epi32(_mm_sub_epi32(values,
+            _mm_set1_epi32(0x8000)), _mm_setzero_si128());
+
+        _mm_storel_epi64((__m128i*) ((uint16_t*) output.depth + n),
+            _mm_xor_si128(packed, _mm_set1_epi16((short) 0x8000)));
+        return;
+    }
+
+    _mm_storeu_si128((__m128i*) ((uint32_t*) output.depth + n), values);
+}
+
+/*  The inverse depths of eight pixels in a FLOAT32 or UNORM format, in 32
+    bit lanes. */
+template <System::DepthFormat D>
+__attribute__((target("avx2")))
+static inline __m256i depth_values_avx2_float(__m256 inv_z,
+    const span_output& output) {
+    if (D == System::DepthFormat::FLOAT32) {
+        return _mm256_castps_si256(inv_z);
+    }
+
+    return _mm256_cvttps_epi32(_mm256_min_ps(_mm256_max_ps(
+        _mm256_mul_ps(inv_z, _mm256_set1_ps(output.depth_scale)),
+        _mm256_setzero_ps()), _mm256_set1_ps(get_unorm_depth_max<D>())));
+}
+
+/*  The depths of the eight pixels from n onwards in a UNORM depth buffer,
+    in 32 bit lanes. */
+template <System::DepthFormat D>
+__attribute__((target("avx2")))
+static inline __m256i load_depths_avx2_float(const span_output& output,
+    int n) {
+    if (D == System::DepthFormat::UNORM16) {
+        return _mm256_cvtepu16_epi32(_mm_loadu_si128(
+            (const __m128i*) ((const uint16_t*) output.depth + n)));
+    }
+
+    return _mm256_loadu_si256(
+        (const __m256i*) ((const uint32_t*) output.depth + n));
+}
+
+/*  Packed depth test of the eight pixels from n onwards, as a mask of 32
+    bit lanes (set for those that pass). */
+template <System::DepthFormat D>
+__attribute__((target("avx2")))
+static inline __m256i depth_test_avx2_float(__m256 inv_z,
+    const span_output& output, int n) {
+    if (D == System::DepthFormat::DOUBLE) {
+        const double* depth = (const double*) output.depth + n;
+
+        __m256d pass_low = _mm256_cmp_pd(
+            _mm256_cvtps_pd(_mm256_castps256_ps128(inv_z)),
+            _mm256_loadu_pd(depth), _CMP_GT_OQ);
+        __m256d pass_high = _mm256_cmp_pd(
+            _mm256_cvtps_pd(_mm256_extractf128_ps(inv_z, 1)),
+            _mm256_loadu_pd(depth + 4), _CMP_GT_OQ);
+
+        /*  Select the low 32 bits of each 64 bit lane of both halves. */
+        const __m256i low_halves = _mm256_setr_epi32(0, 2, 4, 6, 0, 0, 0, 0);
+
+        return _mm256_inserti128_si256(
+            _mm256_permutevar8x32_epi32(_mm256_castpd_si256(pass_low),
+            low_halves),
+            _mm256_castsi256_si128(_mm256_permutevar8x32_epi32(
+            _mm256_castpd_si256(pass_high), low_halves)), 1);
+    }
+
+    if (D == System::DepthFormat::FLOAT32) {
+        return _mm256_castps_si256(_mm256_cmp_ps(inv_z,
+            _mm256_loadu_ps((const float*) output.depth + n), _CMP_GT_OQ));
+    }
+
+    return _mm256_cmpgt_epi32(depth_values_avx2_float<D>(inv_z, output),
+        load_depths_avx2_float<D>(output, n));
+}
+
+/*  Write the inverse depths of the lanes of the eight pixels from n onwards
+    that are set in mask. */
+template <System::DepthFormat D>
+__attribute__((target("avx2")))
+static inline void store_depths_avx2_float(__m256 inv_z, __m256i mask,
+    const span_output& output, int n) {
+    if (D == System::DepthFormat::DOUBLE) {
+        double* depth = (double*) output.depth + n;
+
+        _mm256_maskstore_pd(depth,
+            _mm256_cvtepi32_epi64(_mm256_castsi256_si128(mask)),
+            _mm256_cvtps_pd(_mm256_castps256_ps128(inv_z)));
+        _mm256_maskstore_pd(depth + 4,
+            _mm256_cvtepi32_epi64(_mm256_extracti128_si256(mask, 1)),
+            _mm256_cvtps_pd(_mm256_extractf128_ps(inv_z, 1)));
+        return;
+    }
+
+    __m256i values = depth_values_avx2_float<D>(inv_z, output);
+
+    if (D != System::DepthFormat::UNORM16) {
+        _mm256_maskstore_epi32((int*) ((uint32_t*) output.depth + n), mask,
+            values);
+        return;
+    }
+
+    /*  There is no masked store of 16 bit lanes, so blend with the depths
+        already there. */
+    values = _mm256_blendv_epi8(load_depths_avx2_float<D>(output, n), values,
+        mask);
+
+    _mm_storeu_si128((__m128i*) ((uint16_t*) output.depth + n),
+        _mm_packus_epi32(_mm256_castsi256_si128(values),
+        _mm256_extracti128_si256(values, 1)));
+}
+
+template <unsigned int F, System::DepthFormat D>
+__attribute__((target("sse2")))
+static void shade_span_sse2_float(
+    const span_input& input,
+    const span_output& output
+) {
+    const pixel_coord& origin = input.origin;
+    const pixel_coord& step = input.step;
+    const Resources::TrueColourBitmap* bitmap_ptr = input.bitmap_ptr;
+
+    const __m128 lane_offsets = _mm_setr_ps(0.0f, 1.0f, 2.0f, 3.0f);
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 one = _mm_set1_ps(1.0f);
+    const __m128 half = _mm_set1_ps(0.5f);
+    const __m128 max_channel = _mm_set1_ps(255.0f);
+
+    const __m128i red_shift = _mm_cvtsi32_si128(output.red_shift);
+    const __m128i green_shift = _mm_cvtsi32_si128(output.green_shift);
+    const __m128i blue_shift = _mm_cvtsi32_si128(output.blue_shift);
+    const __m128i channel_mask = _mm_set1_epi32(0xff);
+
+    __m128 max_x = zero;
+    __m128 max_y = zero;
+
+    if (F & SHADE_TEXTURE) {
+        max_x = _mm_set1_ps(bitmap_ptr->width - 1);
+        max_y = _mm_set1_ps(bitmap_ptr->height - 1);
+    }
+
+    int n = 0;
+
+    for (; n + 4 <= input.count; n += 4) {
+        __m128 k = _mm_add_ps(_mm_set1_ps(input.k_start + n), lane_offsets);
+
+        __m128 inv_z = _mm_add_ps(_mm_set1_ps(origin.inv_z),
+            _mm_mul_ps(k, _mm_set1_ps(step.inv_z)));
+
+        /*  Packed depth test. */
+        int mask = 15;
+
+        if (F & SHADE_DEPTH_TEST) {
+            mask = depth_test_sse2_float<D>(inv_z, output, n);
+
+            if (mask == 0) {
+                continue;
+            }
+        }
+
+        __m128 z = _mm_div_ps(one, inv_z);
+
+        __m128 intensity = _mm_set1_ps(input.intensity);
+        __m128 mix_r = _mm_set1_ps(input.red);
+        __m128 mix_g = _mm_set1_ps(input.green);
+        __m128 mix_b = _mm_set1_ps(input.blue);
+
+        if (F & SHADE_GOURAUD) {
+            intensity = attribute_sse2_float(origin.i_div_z, step.i_div_z,
+                k, z);
+        }
+
+        if (F & SHADE_VERTEX_COLOUR) {
+            mix_r = attribute_sse2_float(origin.r_div_z, step.r_div_z, k, z);
+            mix_g = attribute_sse2_float(origin.g_div_z, step.g_div_z, k, z);
+            mix_b = attribute_sse2_float(origin.b_div_z, step.b_div_z, k, z);
+        }
+
+        if (F & SHADE_TEXTURE) {
+            __m128 tex_x = attribute_sse2_float(origin.tex_x_div_z,
+                step.tex_x_div_z, k, z);
+            __m128 tex_y = attribute_sse2_float(origin.tex_y_div_z,
+                step.tex_y_div_z, k, z);
+
+            alignas(16) int pixel_x[4];
+            alignas(16) int pixel_y[4];
+
+            _mm_store_si128((__m128i*) pixel_x, _mm_cvttps_epi32(_mm_add_ps(
+                _mm_min_ps(_mm_max_ps(_mm_mul_ps(tex_x, max_x), zero),
+                max_x), half)));
+            _mm_store_si128((__m128i*) pixel_y, _mm_cvttps_epi32(_mm_add_ps(
+                _mm_min_ps(_mm_max_ps(_mm_mul_ps(tex_y, max_y), zero),
+                max_y), half)));
+
+            /*  SSE2 has no gather, so fetch the texels individually. */
+            const uint32_t* texels =
+                (const uint32_t*) bitmap_ptr->pixels.data();
+            alignas(16) uint32_t lanes[4];
+
+            for (int i = 0; i < 4; i++) {
+                lanes[i] = texels[(bitmap_ptr->height - 1 - pixel_y[i]) *
+                    bitmap_ptr->width + pixel_x[i]];
+            }
+
+            __m128i texel = _mm_load_si128((const __m128i*) lanes);
+
+            /*  RGBAPixel is laid out as a, b, g, r in memory. */
+            __m128 texel_r = _mm_cvtepi32_ps(_mm_srli_epi32(texel, 24));
+            __m128 texel_g = _mm_cvtepi32_ps(_mm_and_si128(
+                _mm_srli_epi32(texel, 16), channel_mask));
+            __m128 texel_b = _mm_cvtepi32_ps(_mm_and_si128(
+                _mm_srli_epi32(texel, 8), channel_mask));
+
+            mix_r = _mm_mul_ps(texel_r, _mm_div_ps(mix_r, max_channel));
+            mix_g = _mm_mul_ps(texel_g, _mm_div_ps(mix_g, max_channel));
+            mix_b = _mm_mul_ps(texel_b, _mm_div_ps(mix_b, max_channel));
+        }
+
+        __m128i red = _mm_cvttps_epi32(_mm_min_ps(_mm_max_ps(
+            _mm_mul_ps(mix_r, intensity), zero), max_channel));
+        __m128i green = _mm_cvttps_epi32(_mm_min_ps(_mm_max_ps(
+            _mm_mul_ps(mix_g, intensity), zero), max_channel));
+        __m128i blue = _mm_cvttps_epi32(_mm_min_ps(_mm_max_ps(
+            _mm_mul_ps(mix_b, intensity), zero), max_channel));
+
+        __m128i pixels = _mm_or_si128(_mm_or_si128(
+            _mm_sll_epi32(red, red_shift), _mm_sll_epi32(green, green_shift)),
+            _mm_sll_epi32(blue, blue_shift));
+
+        if (mask == 15) {
+            _mm_storeu_si128((__m128i*) (output.colour + n), pixels);
+
+            if (F & SHADE_DEPTH_WRITE) {
+                store_depths_sse2_float<D>(inv_z, output, n);
+            }
+
+            continue;
+        }
+
+        /*  SSE2 has no masked store, so write the passing lanes singly. */
+        alignas(16) uint32_t colours[4];
+        alignas(16) float depths[4];
+
+        _mm_store_si128((__m128i*) colours, pixels);
+        _mm_store_ps(depths, inv_z);
+
+        for (int i = 0; i < 4; i++) {
+            if (mask & (1 << i)) {
+                output.colour[n + i] = colours[i];
+
+                if (F & SHADE_DEPTH_WRITE) {
+                    write_depth<D>(output, n + i, depths[i]);
+                }
+            }
+        }
+    }
+
+    shade_span_scalar_from<float, F, D>(input, output, n);
+}
+
+template <unsigned int F, System::DepthFormat D>
+__attribute__((target("avx2")))
+static void shade_span_avx2_float(
+    const span_input& input,
+    const span_output& output
+) {
+    const pixel_coord& origin = input.origin;
+    const pixel_coord& step = input.step;
+    const Resources::TrueColourBitmap* bitmap_ptr = input.bitmap_ptr;
+
+    const __m256 lane_offsets = _mm256_setr_ps(0.0f, 1.0f, 2.0f, 3.0f, 4.0f,
+        5.0f, 6.0f, 7.0f);
+    const __m256 zero = _mm256_setzero_ps();
+    const __m256 one = _mm256_set1_ps(1.0f);
+    const __m256 half = _mm256_set1_ps(0.5f);
+    const __m256 max_channel = _mm256_set1_ps(255.0f);
+
+    const __m128i red_shift = _mm_cvtsi32_si128(output.red_shift);
+    const __m128i green_shift = _mm_cvtsi32_si128(output.green_shift);
+    const __m128i blue_shift = _mm_cvtsi32_si128(output.blue_shift);
+    const __m256i channel_mask = _mm256_set1_epi32(0xff);
+
+    __m256 max_x = zero;
+    __m256 max_y = zero;
+    __m256i bitmap_width = _mm256_setzero_si256();
+    __m256i bitmap_max_y = _mm256_setzero_si256();
+
+    if (F & SHADE_TEXTURE) {
+        max_x = _mm256_set1_ps(bitmap_ptr->width - 1);
+        max_y = _mm256_set1_ps(bitmap_ptr->height - 1);
+        bitmap_width = _mm256_set1_epi32(bitmap_ptr->width);
+        bitmap_max_y = _mm256_set1_epi32(bitmap_ptr->height - 1);
+    }
+
+    int n = 0;
+
+    for (; n + 8 <= input.count; n += 8) {
+        __m256 k = _mm256_add_ps(_mm256_set1_ps(input.k_start + n),
+            lane_offsets);
+
+        __m256 inv_z = _mm256_add_ps(_mm256_set1_ps(origin.inv_z),
+            _mm256_mul_ps(k, _mm256_set1_ps(step.inv_z)));
+
+        /*  Packed depth test. */
+        __m256i pass = _mm256_set1_epi32(-1);
+
+        if (F & SHADE_DEPTH_TEST) {
+            pass = depth_test_avx2_float<D>(inv_z, output, n);
+
+            if (_mm256_movemask_ps(_mm256_castsi256_ps(pass)) == 0) {
+                continue;
+            }
+        }
+
+        __m256 z = _mm256_div_ps(one, inv_z);
+
+        __m256 intensity = _mm256_set1_ps(input.intensity);
+        __m256 mix_r = _mm256_set1_ps(input.red);
+        __m256 mix_g = _mm256_set1_ps(input.green);
+        __m256 mix_b = _mm256_set1_ps(input.blue);
+
+        if (F & SHADE_GOURAUD) {
+            intensity = attribute_avx2_float(origin.i_div_z, step.i_div_z,
+                k, z);
+        }
+
+        if (F & SHADE_VERTEX_COLOUR) {
+            mix_r = attribute_avx2_float(origin.r_div_z, step.r_div_z, k, z);
+            mix_g = attribute_avx2_float(origin.g_div_z, step.g_div_z, k, z);
+            mix_b = attribute_avx2_float(origin.b_div_z, step.b_div_z, k, z);
+        }
+
+        if (F & SHADE_TEXTURE) {
+            __m256 tex_x = attribute_avx2_float(origin.tex_x_div_z,
+                step.tex_x_div_z, k, z);
+            __m256 tex_y = attribute_avx2_float(origin.tex_y_div_z,
+                step.tex_y_div_z, k, z);
+
+            __m256i pixel_x = _mm256_cvttps_epi32(_mm256_add_ps(
+                _mm256_min_ps(_mm256_max_ps(_mm256_mul_ps(tex_x, max_x),
+                zero), max_x), half));
+            __m256i pixel_y = _mm256_cvttps_epi32(_mm256_add_ps(
+                _mm256_min_ps(_mm256_max_ps(_mm256_mul_ps(tex_y, max_y),
+                zero), max_y), half));
+
+            /*  Texture coordinates are clamped even for lanes that failed the
+                depth test, so every lane can be gathered safely. */
+            __m256i indices = _mm256_add_epi32(_mm256_mullo_epi32(
+                _mm256_sub_epi32(bitmap_max_y, pixel_y), bitmap_width),
+                pixel_x);
+
+            __m256i texel = _mm256_i32gather_epi32(
+                (const int*) bitmap_ptr->pixels.data(), indices, 4);
+
+            /*  RGBAPixel is laid out as a, b, g, r in memory. */
+            __m256 texel_r = _mm256_cvtepi32_ps(_mm256_srli_epi32(texel, 24));
+            __m256 texel_g = _mm256_cvtepi32_ps(_mm256_and_si256(
+                _mm256_srli_epi32(texel, 16), channel_mask));
+            __m256 texel_b = _mm256_cvtepi32_ps(_mm256_and_si256(
+                _mm256_srli_epi32(texel, 8), channel_mask));
+
+            mix_r = _mm256_mul_ps(texel_r, _mm256_div_ps(mix_r, max_channel));
+            mix_g = _mm256_mul_ps(texel_g, _mm256_div_ps(mix_g, max_channel));
+            mix_b = _mm256_mul_ps(texel_b, _mm256_div_ps(mix_b, max_channel));
+        }
+
+        __m256i red = _mm256_cvttps_epi32(_mm256_min_ps(_mm256_max_ps(
+            _mm256_mul_ps(mix_r, intensity), zero), max_channel));
+        __m256i green = _mm256_cvttps_epi32(_mm256_min_ps(_mm256_max_ps(
+            _mm256_mul_ps(mix_g, intensity), zero), max_channel));
+        __m256i blue = _mm256_cvttps_epi32(_mm256_min_ps(_mm256_max_ps(
+            _mm256_mul_ps(mix_b, intensity), zero), max_channel));
+
+        __m256i pixels = _mm256_or_si256(_mm256_or_si256(
+            _mm256_sll_epi32(red, red_shift),
+            _mm256_sll_epi32(green, green_shift)),
+            _mm256_sll_epi32(blue, blue_shift));
+
+        /*  Write only the lanes that passed the depth test. */
+        if (F & SHADE_DEPTH_TEST) {
+            _mm256_maskstore_epi32((int*) (output.colour + n), pass, pixels);
+        } else {
+            _mm256_storeu_si256((__m256i*) (output.colour + n), pixels);
+        }
+
+        if (F & SHADE_DEPTH_WRITE) {
+            store_depths_avx2_float<D>(inv_z, pass, output, n);
+        }
+    }
+
+    shade_span_scalar_from<float, F, D>(input, output, n);
+}
+
+#endif
+
+/*  Every variant of a kernel for a depth format, indexed by shading
+    features. Variants that neither test nor write depths are the same for
+    every format, so share those of the DOUBLE format. */
+using span_feature_sequence =
+    std::make_integer_sequence<unsigned int, NUM_SHADING_VARIANTS>;
+
+static constexpr System::DepthFormat get_variant_depth_format(
+    unsigned int features,
+    System::DepthFormat format
+) {
+    return features & (SHADE_DEPTH_TEST | SHADE_DEPTH_WRITE) ? format :
+        System::DepthFormat::DOUBLE;
+}
+
+template <System::DepthFormat D, unsigned int... F>
+static const span_function* get_scalar_variants(
+    std::integer_sequence<unsigned int, F...>
+) {
+    static const span_function variants[] = {
+        shade_span_scalar<double, F, get_variant_depth_format(F, D)>...
+    };
+    return variants;
+}
+
+template <System::DepthFormat D, unsigned int... F>
+static const span_function* get_scalar_float_variants(
+    std::integer_sequence<unsigned int, F...>
+) {
+    static const span_function variants[] = {
+        shade_span_scalar<float, F, get_variant_depth_format(F, D)>...
+    };
+    return variants;
+}
+
+#ifdef SPAN_KERNEL_X86
+
+template <System::DepthFormat D, unsigned int... F>
+static const span_function* get_sse2_variants(
+    std::integer_sequence<unsigned int, F...>
+) {
+    static const span_function variants[] = {
+        shade_span_sse2<F, get_variant_depth_format(F, D)>...
+    };
+    return variants;
+}
+
+template <System::DepthFormat D, unsigned int... F>
+static const span_function* get_sse2_float_variants(
+    std::integer_sequence<unsigned int, F...>
+) {
+    static const span_function variants[] = {
+        shade_span_sse2_float<F, get_variant_depth_format(F, D)>...
+    };
+    return variants;
+}
+
+template <System::DepthFormat D, unsigned int... F>
+static const span_function* get_avx2_variants(
+    std::integer_sequence<unsigned int, F...>
+) {
+    static const span_function variants[] = {
+        shade_span_avx2<F, get_variant_depth_format(F, D)>...
+    };
+    return variants;
+}
+
+template <System::DepthFormat D, unsigned int... F>
+static const span_function* get_avx2_float_variants(
+    std::integer_sequence<unsigned int, F...>
+) {
+    static const span_function variants[] = {
+        shade_span_avx2_float<F, get_variant_depth_format(F, D)>...
+    };
+    return variants;
+}
+
+#endif
+
+/*  The variants of a kernel, indexed by depth format. */
+struct span_kernel_state {
+    SpanKernel kernel;
+    const span_function* variants[System::NUM_DEPTH_FORMATS];
+    const span_function* float_variants[System::NUM_DEPTH_FORMATS];
+};
+
+template <System::DepthFormat D>
+static void set_format_variants(span_kernel_state& state) {
+    span_feature_sequence features {};
+    int format = (int) D;
+
+    switch (state.kernel) {
+#ifdef SPAN_KERNEL_X86
+        case SpanKernel::AVX2: {
+            state.variants[format] = get_avx2_variants<D>(features);
+            state.float_variants[format] =
+                get_avx2_float_variants<D>(features);
+            break;
+        }
+
+        case SpanKernel::SSE2: {
+            state.variants[format] = get_sse2_variants<D>(features);
+            state.float_variants[format] =
+                get_sse2_float_variants<D>(features);
+            break;
+        }
+#endif
+
+        default: {
+            state.variants[format] = get_scalar_variants<D>(features);
+            state.float_variants[format] =
+                get_scalar_float_variants<D>(features);
+            break;
+        }
+    }
+}
+
+static span_kernel_state make_kernel_state(SpanKernel kernel) {
+    span_kernel_state state { kernel, {}, {} };
+
+    set_format_variants<System::DepthFormat::DOUBLE>(state);
+    set_format_variants<System::DepthFormat::FLOAT32>(state);
+    set_format_variants<System::DepthFormat::UNORM24>(state);
+    set_format_variants<System::DepthFormat::UNORM16>(state);
+
+    return state;
+}
+
+/*  The selected kernel - detected on first use. Function-local statics are
+    initialised exactly once, even if first used by several threads. */
+static span_kernel_state& get_kernel_state() {
+    static span_kernel_state state = make_kernel_state(
+        detect_span_kernel()
+    );
+
+    return state;
+}
+
+span_function get_span_function(
+    unsigned int features,
+    RasteriserPrecision precision,
+    System::DepthFormat depth_format
+) {
+    const span_kernel_state& state = get_kernel_state();
+    const span_function* variants = precision == RasteriserPrecision::FLOAT ?
+        state.float_variants[(int) depth_format] :
+        state.variants[(int) depth_format];
+
+    return variants[features & SHADE_ALL];
+}
+
+SpanKernel detect_span_kernel() {
+#ifdef SPAN_KERNEL_X86
+    __builtin_cpu_init();
+
+    if (__builtin_cpu_supports("avx2")) {
+        return SpanKernel::AVX2;
+    }
+
+    if (__builtin_cpu_supports("sse2")) {
+        return SpanKernel::SSE2;
+    }
+#endif
+
+    return SpanKernel::SCALAR;
+}
+
+bool set_span_kernel(SpanKernel kernel) {
+    SpanKernel best = detect_span_kernel();
+
+    if ((int) kernel > (int) best) {
+        return false;
+    }
+
+    get_kernel_state() = make_kernel_state(kernel);
+
+    return true;
+}
+
+SpanKernel get_span_kernel() {
+    return get_kernel_state().kernel;
+}
+
+}
@@ -0,0 +1,100 @@
+/*  SpanKernel.hpp
+
+    Kernels for shading a horizontal span of pixels - the innermost loop of
+    both triangle rasterisers. Each kernel performs, for every pixel of the
+    span, the perspective-correct attribute reconstruction, depth test,
+    texture fetch and packing of the result into the native pixel format of
+    the render buffer.
+
+    Vectorised kernels process several pixels per iteration (2 with SSE2, 4
+    with AVX2, for double precision attributes). The kernel used is chosen at
+    runtime according to the instruction sets supported by the CPU, falling
+    back to a scalar kernel where neither is available. All kernels perform
+    exactly the same sequence of floating point operations per pixel, so their
+    output is identical.
+
+    Each kernel also has a variant for every combination of shading features
+    (see triangle_shading), compiled with only the work those features need,
+    in both double and single precision, and for every depth buffer format.
+    The single precision variants process twice as many pixels per vector (4
+    with SSE2, 8 with AVX2). The variant is chosen once per triangle, by
+    get_span_function. */
+
+#ifndef SPAN_KERNEL_HPP
+#define SPAN_KERNEL_HPP
+
+#include "Rasteriser.hpp"
+
+#include <cstdint>
+
+namespace Graphics {
+
+enum class SpanKernel {
+    SCALAR,
+    SSE2,
+    AVX2
+};
+
+/*  A span of count pixels to be shaded. The attributes (divided by depth, as
+    in pixel_coord) at the n-th pixel of the span are origin + k * step, where
+    k = k_start + n. The x and y members of origin and step are unused.
+
+    Variants without SHADE_GOURAUD or SHADE_VERTEX_COLOUR use intensity, or
+    red, green and blue, for every pixel instead, and bitmap_ptr is only read
+    by variants with SHADE_TEXTURE. */
+struct span_input {
+    int count;
+    double k_start;
+    pixel_coord origin;
+    pixel_coord step;
+    const Resources::TrueColourBitmap* bitmap_ptr;
+    double intensity;
+    double red;
+    double green;
+    double blue;
+};
+
+/*  Destination of a span - pointers to the first pixel of the span in the
+    colour and depth buffers, along with the depth scale of the depth buffer
+    (see System::FramebufferView) and the bit positions of the red, green
+    and blue channels within a colour pixel. The format of the depth buffer
+    is that the span function was chosen for. */
+struct span_output {
+    uint32_t* colour;
+    void* depth;
+    double depth_scale;
+    uint8_t red_shift;
+    uint8_t green_shift;
+    uint8_t blue_shift;
+};
+
+/*  Shades a span - with SHADE_DEPTH_TEST, only the pixels whose inverse
+    depth is greater than that in the depth buffer are written, and with
+    SHADE_DEPTH_WRITE, their inverse depths are written to the depth buffer
+    too. Inverse depths are converted to the format of the depth buffer
+    before they are compared with it. */
+using span_function = void (*)(const span_input&, const span_output&);
+
+/*  The variant of the selected kernel for a combination of SHADE_ flags,
+    drawing into a depth buffer of the given format. With
+    RasteriserPrecision::FLOAT, the attributes of the span are interpolated
+    in single precision - otherwise in double. */
+span_function get_span_function(
+    unsigned int features,
+    RasteriserPrecision precision = RasteriserPrecision::DOUBLE,
+    System::DepthFormat depth_format = System::DepthFormat::DOUBLE
+);
+
+/*  The most capable kernel supported by the running CPU. */
+SpanKernel detect_span_kernel();
+
+/*  Override the kernel used by shade_span (e.g. to benchmark or compare the
+    kernels). Returns false, leaving the kernel unchanged, if the CPU does not
+    support the requested kernel. Not safe to call while rendering. */
+bool set_span_kernel(SpanKernel kernel);
+
+SpanKernel get_span_kernel();
+
+}
+
+#endif
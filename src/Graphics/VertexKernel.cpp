@@ -0,0 +1,426 @@
+/*  VertexKernel.cpp
+
+    Scalar, SSE2 and AVX2 vertex kernels. The instruction set is the one
+    selected for the span kernels.
+
+    To keep the output of every kernel identical to the scalar one (and to the
+    Maths::Matrix operators it replaces), matrix rows are accumulated from
+    zero in column order, and rounding to the nearest pixel is done by
+    truncating and then correcting by one where the fraction removed was at
+    least a half, which is exactly std::round. SSE2 has no truncation of
+    doubles to doubles, so its kernel rounds each lane with std::round. */
+
+#include "VertexKernel.hpp"
+#include "SpanKernel.hpp"
+
+#include <cmath>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define VERTEX_KERNEL_X86
+#include <immintrin.h>
+#endif
+
+namespace Graphics {
+
+/*  Row-major copy of a matrix, to avoid the bounds checked accessors in the
+    inner loops. */
+struct matrix_elements {
+    double m[16];
+};
+
+static matrix_elements get_matrix_elements(
+    const Maths::Matrix<double, 4, 4>& matrix
+) {
+    matrix_elements res;
+
+    for (int i = 0; i < 4; i++) {
+        for (int j = 0; j < 4; j++) {
+            res.m[i * 4 + j] = matrix(i, j);
+        }
+    }
+
+    return res;
+}
+
+static void transform_points_scalar_from(
+    const matrix_elements& matrix,
+    const point_stream& in,
+    const point_stream& out,
+    size_t first,
+    size_t count
+) {
+    const double* m = matrix.m;
+
+    for (size_t n = first; n < count; n++) {
+        double v[4] = { in.x[n], in.y[n], in.z[n], in.w[n] };
+        double res[4];
+
+        for (int i = 0; i < 4; i++) {
+            double sum = 0.0;
+
+            for (int j = 0; j < 4; j++) {
+                sum += m[i * 4 + j] * v[j];
+            }
+
+            res[i] = sum;
+        }
+
+        out.x[n] = res[0];
+        out.y[n] = res[1];
+        out.z[n] = res[2];
+        out.w[n] = res[3];
+    }
+}
+
+static void project_points_scalar_from(
+    const point_stream& points,
+    double* inv_w,
+    double* const* attributes,
+    int attribute_count,
+    size_t first,
+    size_t count
+) {
+    for (size_t n = first; n < count; n++) {
+        double w = points.w[n];
+
+        points.x[n] /= w;
+        points.y[n] /= w;
+        inv_w[n] = 1.0 / w;
+
+        for (int a = 0; a < attribute_count; a++) {
+            attributes[a][n] /= w;
+        }
+    }
+}
+
+static void convert_points_to_pixels_scalar_from(
+    double* x,
+    double* y,
+    const viewport& view,
+    size_t first,
+    size_t count
+) {
+    double width = view.right - view.left;
+    double height = view.top - view.bottom;
+    double max_x = view.width - 1;
+    double max_y = view.height - 1;
+    double scale = view.subpixel_scale;
+
+    /*  Scaling by a power of two is exact, so this rounds to a whole number
+        of subpixels. */
+    for (size_t n = first; n < count; n++) {
+        x[n] = std::round(((x[n] - view.left) / width) * max_x * scale) /
+            scale;
+        y[n] = max_y - std::round(((y[n] - view.bottom) / height) * max_y *
+            scale) / scale;
+    }
+}
+
+#ifdef VERTEX_KERNEL_X86
+
+/*  One row of a matrix multiplied by 2 or 4 points at once. */
+__attribute__((target("sse2")))
+static inline __m128d matrix_row_sse2(const double* row, __m128d x,
+    __m128d y, __m128d z, __m128d w) {
+    __m128d sum = _mm_setzero_pd();
+
+    sum = _mm_add_pd(sum, _mm_mul_pd(_mm_set1_pd(row[0]), x));
+    sum = _mm_add_pd(sum, _mm_mul_pd(_mm_set1_pd(row[1]), y));
+    sum = _mm_add_pd(sum, _mm_mul_pd(_mm_set1_pd(row[2]), z));
+    sum = _mm_add_pd(sum, _mm_mul_pd(_mm_set1_pd(row[3]), w));
+
+    return sum;
+}
+
+__attribute__((target("avx2")))
+static inline __m256d matrix_row_avx2(const double* row, __m256d x,
+    __m256d y, __m256d z, __m256d w) {
+    __m256d sum = _mm256_setzero_pd();
+
+    sum = _mm256_add_pd(sum, _mm256_mul_pd(_mm256_set1_pd(row[0]), x));
+    sum = _mm256_add_pd(sum, _mm256_mul_pd(_mm256_set1_pd(row[1]), y));
+    sum = _mm256_add_pd(sum, _mm256_mul_pd(_mm256_set1_pd(row[2]), z));
+    sum = _mm256_add_pd(sum, _mm256_mul_pd(_mm256_set1_pd(row[3]), w));
+
+    return sum;
+}
+
+/*  std::round of each lane - truncate, then step away from zero if the
+    fraction removed (which is exact) was at least a half. */
+__attribute__((target("avx2")))
+static inline __m256d round_avx2(__m256d v) {
+    __m256d truncated = _mm256_round_pd(v,
+        _MM_FROUND_TO_ZERO | _MM_FROUND_NO_EXC);
+    __m256d fraction = _mm256_sub_pd(v, truncated);
+
+    __m256d up = _mm256_and_pd(
+        _mm256_cmp_pd(fraction, _mm256_set1_pd(0.5), _CMP_GE_OQ),
+        _mm256_set1_pd(1.0));
+    __m256d down = _mm256_and_pd(
+        _mm256_cmp_pd(fraction, _mm256_set1_pd(-0.5), _CMP_LE_OQ),
+        _mm256_set1_pd(1.0));
+
+    return _mm256_sub_pd(_mm256_add_pd(truncated, up), down);
+}
+
+__attribute__((target("sse2")))
+static void transform_points_sse2(
+    const matrix_elements& matrix,
+    const point_stream& in,
+    const point_stream& out,
+    size_t count
+) {
+    const double* m = matrix.m;
+    size_t n = 0;
+
+    for (; n + 2 <= count; n += 2) {
+        __m128d x = _mm_loadu_pd(in.x + n);
+        __m128d y = _mm_loadu_pd(in.y + n);
+        __m128d z = _mm_loadu_pd(in.z + n);
+        __m128d w = _mm_loadu_pd(in.w + n);
+
+        _mm_storeu_pd(out.x + n, matrix_row_sse2(m, x, y, z, w));
+        _mm_storeu_pd(out.y + n, matrix_row_sse2(m + 4, x, y, z, w));
+        _mm_storeu_pd(out.z + n, matrix_row_sse2(m + 8, x, y, z, w));
+        _mm_storeu_pd(out.w + n, matrix_row_sse2(m + 12, x, y, z, w));
+    }
+
+    transform_points_scalar_from(matrix, in, out, n, count);
+}
+
+__attribute__((target("avx2")))
+static void transform_points_avx2(
+    const matrix_elements& matrix,
+    const point_stream& in,
+    const point_stream& out,
+    size_t count
+) {
+    const double* m = matrix.m;
+    size_t n = 0;
+
+    for (; n + 4 <= count; n += 4) {
+        __m256d x = _mm256_loadu_pd(in.x + n);
+        __m256d y = _mm256_loadu_pd(in.y + n);
+        __m256d z = _mm256_loadu_pd(in.z + n);
+        __m256d w = _mm256_loadu_pd(in.w + n);
+
+        _mm256_storeu_pd(out.x + n, matrix_row_avx2(m, x, y, z, w));
+        _mm256_storeu_pd(out.y + n, matrix_row_avx2(m + 4, x, y, z, w));
+        _mm256_storeu_pd(out.z + n, matrix_row_avx2(m + 8, x, y, z, w));
+        _mm256_storeu_pd(out.w + n, matrix_row_avx2(m + 12, x, y, z, w));
+    }
+
+    transform_points_scalar_from(matrix, in, out, n, count);
+}
+
+__attribute__((target("sse2")))
+static void project_points_sse2(
+    const point_stream& points,
+    double* inv_w,
+    double* const* attributes,
+    int attribute_count,
+    size_t count
+) {
+    const __m128d one = _mm_set1_pd(1.0);
+    size_t n = 0;
+
+    for (; n + 2 <= count; n += 2) {
+        __m128d w = _mm_loadu_pd(points.w + n);
+
+        _mm_storeu_pd(points.x + n, _mm_div_pd(_mm_loadu_pd(points.x + n), w));
+        _mm_storeu_pd(points.y + n, _mm_div_pd(_mm_loadu_pd(points.y + n), w));
+        _mm_storeu_pd(inv_w + n, _mm_div_pd(one, w));
+
+        for (int a = 0; a < attribute_count; a++) {
+            _mm_storeu_pd(attributes[a] + n,
+                _mm_div_pd(_mm_loadu_pd(attributes[a] + n), w));
+        }
+    }
+
+    project_points_scalar_from(points, inv_w, attributes, attribute_count, n,
+        count);
+}
+
+__attribute__((target("avx2")))
+static void project_points_avx2(
+    const point_stream& points,
+    double* inv_w,
+    double* const* attributes,
+    int attribute_count,
+    size_t count
+) {
+    const __m256d one = _mm256_set1_pd(1.0);
+    size_t n = 0;
+
+    for (; n + 4 <= count; n += 4) {
+        __m256d w = _mm256_loadu_pd(points.w + n);
+
+        _mm256_storeu_pd(points.x + n,
+            _mm256_div_pd(_mm256_loadu_pd(points.x + n), w));
+        _mm256_storeu_pd(points.y + n,
+            _mm256_div_pd(_mm256_loadu_pd(points.y + n), w));
+        _mm256_storeu_pd(inv_w + n, _mm256_div_pd(one, w));
+
+        for (int a = 0; a < attribute_count; a++) {
+            _mm256_storeu_pd(attributes[a] + n,
+                _mm256_div_pd(_mm256_loadu_pd(attributes[a] + n), w));
+        }
+    }
+
+    project_points_scalar_from(points, inv_w, attributes, attribute_count, n,
+        count);
+}
+
+__attribute__((target("sse2")))
+static void convert_points_to_pixels_sse2(
+    double* x,
+    double* y,
+    const viewport& view,
+    size_t count
+) {
+    const __m128d left = _mm_set1_pd(view.left);
+    const __m128d bottom = _mm_set1_pd(view.bottom);
+    const __m128d width = _mm_set1_pd(view.right - view.left);
+    const __m128d height = _mm_set1_pd(view.top - view.bottom);
+    const __m128d max_x = _mm_set1_pd(view.width - 1);
+    const __m128d max_y = _mm_set1_pd(view.height - 1);
+    size_t n = 0;
+
+    for (; n + 2 <= count; n += 2) {
+        double scaled_x[2];
+        double scaled_y[2];
+
+        _mm_storeu_pd(scaled_x, _mm_mul_pd(_mm_div_pd(
+            _mm_sub_pd(_mm_loadu_pd(x + n), left), width), max_x));
+        _mm_storeu_pd(scaled_y, _mm_mul_pd(_mm_div_pd(
+            _mm_sub_pd(_mm_loadu_pd(y + n), bottom), height), max_y));
+
+        for (int i = 0; i < 2; i++) {
+            x[n + i] = std::round(scaled_x[i] * view.subpixel_scale) /
+                view.subpixel_scale;
+            y[n + i] = (view.height - 1) - std::round(scaled_y[i] *
+                view.subpixel_scale) / view.subpixel_scale;
+        }
+    }
+
+    convert_points_to_pixels_scalar_from(x, y, view, n, count);
+}
+
+__attribute__((target("avx2")))
+static void convert_points_to_pixels_avx2(
+    double* x,
+    double* y,
+    const viewport& view,
+    size_t count
+) {
+    const __m256d left = _mm256_set1_pd(view.left);
+    const __m256d bottom = _mm256_set1_pd(view.bottom);
+    const __m256d width = _mm256_set1_pd(view.right - view.left);
+    const __m256d height = _mm256_set1_pd(view.top - view.bottom);
+    const __m256d max_x = _mm256_set1_pd(view.width - 1);
+    const __m256d max_y = _mm256_set1_pd(view.height - 1);
+    const __m256d scale = _mm256_set1_pd(view.subpixel_scale);
+    size_t n = 0;
+
+    for (; n + 4 <= count; n += 4) {
+        __m256d scaled_x = _mm256_mul_pd(_mm256_div_pd(
+            _mm256_sub_pd(_mm256_loadu_pd(x + n), left), width), max_x);
+        __m256d scaled_y = _mm256_mul_pd(_mm256_div_pd(
+            _mm256_sub_pd(_mm256_loadu_pd(y + n), bottom), height), max_y);
+
+        _mm256_storeu_pd(x + n, _mm256_div_pd(round_avx2(_mm256_mul_pd(
+            scaled_x, scale)), scale));
+        _mm256_storeu_pd(y + n, _mm256_sub_pd(max_y, _mm256_div_pd(
+            round_avx2(_mm256_mul_pd(scaled_y, scale)), scale)));
+    }
+
+    convert_points_to_pixels_scalar_from(x, y, view, n, count);
+}
+
+#endif
+
+void transform_points(
+    const Maths::Matrix<double, 4, 4>& matrix,
+    const point_stream& in,
+    const point_stream& out,
+    size_t count
+) {
+    matrix_elements elements = get_matrix_elements(matrix);
+
+    switch (get_span_kernel()) {
+#ifdef VERTEX_KERNEL_X86
+        case SpanKernel::AVX2: {
+            transform_points_avx2(elements, in, out, count);
+            break;
+        }
+
+        case SpanKernel::SSE2: {
+            transform_points_sse2(elements, in, out, count);
+            break;
+        }
+#endif
+
+        default: {
+            transform_points_scalar_from(elements, in, out, 0, count);
+            break;
+        }
+    }
+}
+
+void project_points(
+    const point_stream& points,
+    double* inv_w,
+    double* const* attributes,
+    int attribute_count,
+    size_t count
+) {
+    switch (get_span_kernel()) {
+#ifdef VERTEX_KERNEL_X86
+        case SpanKernel::AVX2: {
+            project_points_avx2(points, inv_w, attributes, attribute_count,
+                count);
+            break;
+        }
+
+        case SpanKernel::SSE2: {
+            project_points_sse2(points, inv_w, attributes, attribute_count,
+                count);
+            break;
+        }
+#endif
+
+        default: {
+            project_points_scalar_from(points, inv_w, attributes,
+                attribute_count, 0, count);
+            break;
+        }
+    }
+}
+
+void convert_points_to_pixels(
+    double* x,
+    double* y,
+    const viewport& view,
+    size_t count
+) {
+    switch (get_span_kernel()) {
+#ifdef VERTEX_KERNEL_X86
+        case SpanKernel::AVX2: {
+            convert_points_to_pixels_avx2(x, y, view, count);
+            break;
+        }
+
+        case SpanKernel::SSE2: {
+            convert_points_to_pixels_sse2(x, y, view, count);
+            break;
+        }
+#endif
+
+        default: {
+            convert_points_to_pixels_scalar_from(x, y, view, 0, count);
+            break;
+        }
+    }
+}
+
+}
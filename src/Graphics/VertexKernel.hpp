@@ -0,0 +1,77 @@
+/*  VertexKernel.hpp
+
+    Batched kernels for the per-vertex stages of the pipeline - transforming
+    points by a matrix, perspective projection and conversion to pixel space.
+
+    The kernels operate on structure-of-arrays streams (one array per
+    coordinate or attribute) rather than on Points, so that the vectorised
+    kernels can load and store several vertices' worth of a coordinate at
+    once (2 with SSE2, 4 with AVX2). As with the span kernels, the instruction
+    set used is the one selected by set_span_kernel, and every kernel performs
+    exactly the same floating point operations per vertex, so their results
+    are identical. */
+
+#ifndef VERTEX_KERNEL_HPP
+#define VERTEX_KERNEL_HPP
+
+#include "./../Maths/Matrix.hpp"
+
+#include <cstddef>
+
+namespace Graphics {
+
+/*  A stream of homogeneous points - the n-th point is
+    (x[n], y[n], z[n], w[n]). */
+struct point_stream {
+    double* x;
+    double* y;
+    double* z;
+    double* w;
+};
+
+/*  The mapping from screen space (the view plane, bounded by left, right,
+    bottom and top) to a render buffer of width by height pixels. Points are
+    rounded to the nearest 1 / subpixel_scale of a pixel, which must be a
+    power of two. */
+struct viewport {
+    double left;
+    double right;
+    double bottom;
+    double top;
+    int width;
+    int height;
+    double subpixel_scale = 1.0;
+};
+
+/*  out = matrix * in for each of count points. in and out may be the same
+    streams. */
+void transform_points(
+    const Maths::Matrix<double, 4, 4>& matrix,
+    const point_stream& in,
+    const point_stream& out,
+    size_t count
+);
+
+/*  Perspective divide count clip space points (with w > 0) in place - x
+    and y are divided by w, as is each of the attribute_count attribute
+    streams, and 1 / w is written to inv_w. The z stream is unused. */
+void project_points(
+    const point_stream& points,
+    double* inv_w,
+    double* const* attributes,
+    int attribute_count,
+    size_t count
+);
+
+/*  Convert count screen space x and y coordinates in place to pixel
+    coordinates, rounded to the nearest pixel (y increasing downwards). */
+void convert_points_to_pixels(
+    double* x,
+    double* y,
+    const viewport& view,
+    size_t count
+);
+
+}
+
+#endif
@@ -0,0 +1,195 @@
+/*  WorkerPool.cpp */
+
+#include "WorkerPool.hpp"
+#include <algorithm>
+
+namespace Graphics {
+
+static unsigned long long pack_range(unsigned int begin, unsigned int end) {
+    return (unsigned long long) end << 32 | begin;
+}
+
+static unsigned int range_begin(unsigned long long range) {
+    return range & 0xffffffffu;
+}
+
+static unsigned int range_end(unsigned long long range) {
+    return range >> 32;
+}
+
+WorkerPool::WorkerPool(unsigned int thread_count)
+    : queues { std::make_unique<task_queue[]>(std::max(thread_count, 1u)) } {
+    for (unsigned int i = 1; i < thread_count; i++) {
+        this->workers.emplace_back(&WorkerPool::worker_loop, this, i);
+    }
+}
+
+WorkerPool::~WorkerPool() {
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        this->should_stop = true;
+    }
+
+    this->batch_ready.notify_all();
+
+    for (std::thread& worker : this->workers) {
+        worker.join();
+    }
+}
+
+void WorkerPool::run_batch(int task_count, task_function function,
+    const void* task) {
+    std::unique_lock<std::mutex> batch_lock(this->batch_mutex,
+        std::try_to_lock);
+
+    if (!batch_lock.owns_lock()) {
+        for (int i = 0; i < task_count; i++) {
+            function(task, i, this->get_thread_count());
+        }
+
+        return;
+    }
+
+    /*  Without any workers there is no need to synchronise at all. */
+    if (this->workers.empty()) {
+        for (int i = 0; i < task_count; i++) {
+            function(task, i, 0);
+        }
+
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        this->function = function;
+        this->task = task;
+
+        /*  Deal the tasks out in equal shares of consecutive indices. */
+        unsigned long long thread_count = this->get_thread_count();
+
+        for (unsigned int i = 0; i < thread_count; i++) {
+            this->queues[i].range.store(pack_range(
+                task_count * i / thread_count,
+                task_count * (i + 1) / thread_count
+            ));
+        }
+
+        this->busy_workers = this->workers.size();
+        this->generation ++;
+    }
+
+    this->batch_ready.notify_all();
+
+    /*  The calling thread works on the batch too, rather than sleeping. */
+    this->execute_tasks(0);
+
+    /*  Every worker must have finished with the batch before we return, as
+        the task functor (and anything it references) belongs to the
+        caller. */
+    std::unique_lock<std::mutex> lock(this->mutex);
+    this->batch_done.wait(lock, [this]() { return this->busy_workers == 0; });
+    this->function = nullptr;
+    this->task = nullptr;
+}
+
+unsigned int WorkerPool::get_thread_count() {
+    return this->workers.size() + 1;
+}
+
+void WorkerPool::worker_loop(unsigned int thread) {
+    unsigned long long seen_generation = 0;
+
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(this->mutex);
+            this->batch_ready.wait(lock, [this, seen_generation]() {
+                return this->should_stop ||
+                    this->generation != seen_generation;
+            });
+
+            if (this->should_stop) {
+                return;
+            }
+
+            seen_generation = this->generation;
+        }
+
+        this->execute_tasks(thread);
+
+        {
+            std::lock_guard<std::mutex> lock(this->mutex);
+            this->busy_workers --;
+
+            if (this->busy_workers == 0) {
+                this->batch_done.notify_one();
+            }
+        }
+    }
+}
+
+void WorkerPool::execute_tasks(unsigned int thread) {
+    int index;
+
+    while (this->pop_task(thread, index) ||
+        this->steal_tasks(thread, index)) {
+        this->function(this->task, index, thread);
+    }
+}
+
+bool WorkerPool::pop_task(unsigned int thread, int& index) {
+    std::atomic<unsigned long long>& queue = this->queues[thread].range;
+    unsigned long long range = queue.load();
+
+    while (true) {
+        unsigned int begin = range_begin(range);
+        unsigned int end = range_end(range);
+
+        if (begin >= end) {
+            return false;
+        }
+
+        /*  Fails, updating range, if a thief got there first. */
+        if (queue.compare_exchange_weak(range, pack_range(begin + 1, end))) {
+            index = begin;
+            return true;
+        }
+    }
+}
+
+bool WorkerPool::steal_tasks(unsigned int thread, int& index) {
+    unsigned int thread_count = this->get_thread_count();
+
+    for (unsigned int i = 1; i < thread_count; i++) {
+        std::atomic<unsigned long long>& victim =
+            this->queues[(thread + i) % thread_count].range;
+        unsigned long long range = victim.load();
+
+        while (true) {
+            unsigned int begin = range_begin(range);
+            unsigned int end = range_end(range);
+
+            if (begin >= end) {
+                break;
+            }
+
+            /*  Take the later half, rounding up so that a single remaining
+                task can be stolen. */
+            unsigned int middle = end - (end - begin + 1) / 2;
+
+            if (victim.compare_exchange_weak(range,
+                pack_range(begin, middle))) {
+                /*  Our queue is empty, so no thief will touch it until it
+                    holds the stolen tasks. The indices in a range only ever
+                    shrink, so a thief's stale view of a queue can never
+                    match it again. */
+                this->queues[thread].range.store(pack_range(middle + 1, end));
+                index = middle;
+                return true;
+            }
+        }
+    }
+
+    return false;
+}
+
+}
@@ -0,0 +1,146 @@
+/*  WorkerPool.hpp
+
+    A fixed-size pool of worker threads for data-parallel work. The pool is
+    created once (e.g. by the Renderer at construction) and reused every
+    frame, so that no threads are created or destroyed in the render loop.
+
+    Work is submitted as a number of independent tasks, identified by an index
+    in [0, task_count). The calling thread also takes part in executing the
+    tasks, so a pool of N threads runs N - 1 additional worker threads.
+
+    Tasks are scheduled by work stealing. Each thread starts with an equal
+    share of the tasks - a range of consecutive indices, which it works
+    through in increasing order. A thread that runs out steals the later half
+    of the tasks remaining to another thread, so uneven tasks (e.g. the
+    geometry of models of very different sizes) still keep every thread busy,
+    while threads mostly work on tasks of their own and rarely contend.
+
+    Batches may be run from several threads at once (e.g. by the stages of
+    the Renderer's pipeline). The pool only works on one batch at a time, so a
+    thread that finds it busy runs its whole batch itself instead of waiting
+    for the pool to be free. */
+
+#ifndef WORKER_POOL_HPP
+#define WORKER_POOL_HPP
+
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace Graphics {
+
+class WorkerPool {
+    public:
+        WorkerPool() = delete;
+
+        /*  Construct a pool of thread_count threads in total (including the
+            calling thread). A thread_count of 0 is treated as 1. */
+        explicit WorkerPool(unsigned int thread_count);
+
+        /*  The pool owns running threads, so it is neither copyable nor
+            movable. The destructor stops and joins all workers. */
+        WorkerPool(WorkerPool &)              = delete;
+        WorkerPool(WorkerPool &&)             = delete;
+        WorkerPool& operator=(WorkerPool &)   = delete;
+        WorkerPool&& operator=(WorkerPool &&) = delete;
+
+        ~WorkerPool();
+
+        /*  Execute task(i) for every i in [0, task_count) across the pool and
+            return once all tasks have completed. Tasks may run in any order.
+
+            The task is called through a plain function pointer rather than
+            wrapped in a std::function, which may allocate, so that running a
+            batch never touches the heap. */
+        template <typename F>
+        void run(int task_count, const F& task) {
+            this->run_batch(task_count, &WorkerPool::invoke_task<F>, &task);
+        }
+
+        /*  As run, but calls task(i, thread), thread being the index in
+            [0, get_thread_count()) of the thread running the task (0 for the
+            calling thread) - or get_thread_count() if the pool was busy, and
+            the calling thread is running the batch by itself. No two tasks
+            of a batch run on the same thread at once, so tasks can write to
+            per-thread state (with get_thread_count() + 1 slots) without
+            synchronisation. */
+        template <typename F>
+        void run_on_threads(int task_count, const F& task) {
+            this->run_batch(task_count,
+                &WorkerPool::invoke_task_on_thread<F>, &task);
+        }
+
+        unsigned int get_thread_count();
+
+    private:
+        using task_function = void (*)(const void* task, int index,
+            unsigned int thread);
+
+        template <typename F>
+        static void invoke_task(const void* task, int index, unsigned int) {
+            (*static_cast<const F*>(task))(index);
+        }
+
+        template <typename F>
+        static void invoke_task_on_thread(const void* task, int index,
+            unsigned int thread) {
+            (*static_cast<const F*>(task))(index, thread);
+        }
+
+        void run_batch(int task_count, task_function function,
+            const void* task);
+
+        void worker_loop(unsigned int thread);
+
+        /*  Take and execute tasks from the current batch, first from the
+            thread's own queue and then stolen from the others, until none
+            remain. */
+        void execute_tasks(unsigned int thread);
+
+        /*  Take the next task from a thread's own queue. Returns false if it
+            is empty. */
+        bool pop_task(unsigned int thread, int& index);
+
+        /*  Move the later half of the tasks of another thread's queue to this
+            thread's (empty) queue, taking the first of them. Returns false if
+            every other queue is empty. */
+        bool steal_tasks(unsigned int thread, int& index);
+
+        /*  The tasks queued for a thread - the indices in [begin, end), packed
+            into one word (end in the high half) so that the owner and
+            thieves can both update it with a single compare and swap. Each is
+            padded to its own cache line, so that threads working through
+            their own queues do not contend. */
+        struct alignas(64) task_queue {
+            std::atomic<unsigned long long> range { 0 };
+        };
+
+        std::vector<std::thread> workers;
+
+        /*  One queue per thread, the calling thread's first. */
+        std::unique_ptr<task_queue[]> queues;
+
+        /*  Held by the thread whose batch the pool is working on. */
+        std::mutex batch_mutex;
+
+        std::mutex mutex;
+        std::condition_variable batch_ready;
+        std::condition_variable batch_done;
+
+        /*  Current batch. The generation counter is bumped for each call to
+            run so that sleeping workers can tell a new batch from a spurious
+            wake up. */
+        task_function function = nullptr;
+        const void* task = nullptr;
+        unsigned long long generation = 0;
+        unsigned int busy_workers = 0;
+
+        bool should_stop = false;
+};
+
+}
+
+#endif
@@ -174,6 +174,24 @@ class Vector {
             return vec * scalar;
         }
 
+        /*  Equality - element-wise, so exact. Useful for noticing whether a
+            vector has changed since it was last seen. */
+        friend bool
+        operator==(const Vector<T, N>& lhs, const Vector<T, N>& rhs) {
+            for (int i = 0; i < N; i++) {
+                if (lhs.data[i] != rhs.data[i]) {
+                    return false;
+                }
+            }
+
+            return true;
+        }
+
+        friend bool
+        operator!=(const Vector<T, N>& lhs, const Vector<T, N>& rhs) {
+            return !(lhs == rhs);
+        }
+
         /*  Cross product - might be best implemented in terms of matrix
             determinant? TODO. */
 
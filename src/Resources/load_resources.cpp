@@ -4,8 +4,11 @@
     functions. */
 
 #include "load_resources.hpp"
+#include "./../Maths/Transform.hpp"
 #include <fstream>
+#include <map>
 #include <sstream>
+#include <utility>
 #include <iostream>
 
 namespace Resources {
@@ -142,6 +145,78 @@ TrueColourBitmap* load_bitmap_from_file(std::string bitmap_path) {
     return result;
 };
 
+bool save_render_buffer_to_file(System::RenderWindow& window,
+    std::string bitmap_path) {
+    std::ofstream out_file(bitmap_path, std::ofstream::binary);
+
+    if (!out_file.is_open()) {
+        std::cerr << "Save bitmap error - failed to open file " << bitmap_path
+            << "." << std::endl;
+        return false;
+    }
+
+    System::FramebufferView framebuffer = window.lock_framebuffer();
+
+    /*  Rows of 24 bit pixels, each padded to a multiple of 4 bytes. */
+    size_t line_bytes = framebuffer.width * 3;
+    size_t padding = (line_bytes % 4 == 0) ? 0 : (4 - (line_bytes % 4));
+    size_t row_bytes = line_bytes + padding;
+    size_t buffer_size = row_bytes * framebuffer.height;
+
+    BitmapFileHeader file_header {
+        0x4d42,
+        (uint32_t) (sizeof(BitmapFileHeader) + sizeof(BitmapInfoHeader) +
+            buffer_size),
+        0,
+        0,
+        sizeof(BitmapFileHeader) + sizeof(BitmapInfoHeader)
+    };
+
+    /*  A negative height stores the rows from top to bottom, matching the
+        render buffer. */
+    BitmapInfoHeader info_header {
+        sizeof(BitmapInfoHeader),
+        framebuffer.width,
+        -framebuffer.height,
+        1,
+        24,
+        0,
+        (uint32_t) buffer_size,
+        0,
+        0,
+        0,
+        0
+    };
+
+    std::vector<uint8_t> raw_data(buffer_size, 0);
+
+    for (int y = 0; y < framebuffer.height; y++) {
+        const uint32_t* row = framebuffer.colour_row(y);
+        uint8_t* line = raw_data.data() + y * row_bytes;
+
+        /*  Pixels are stored in blue, green, red order. */
+        for (int x = 0; x < framebuffer.width; x++) {
+            line[x * 3] = row[x] >> framebuffer.blue_shift;
+            line[x * 3 + 1] = row[x] >> framebuffer.green_shift;
+            line[x * 3 + 2] = row[x] >> framebuffer.red_shift;
+        }
+    }
+
+    window.unlock_framebuffer();
+
+    out_file.write((const char*) &file_header, sizeof(file_header));
+    out_file.write((const char*) &info_header, sizeof(info_header));
+    out_file.write((const char*) raw_data.data(), buffer_size);
+
+    if (!out_file) {
+        std::cerr << "Save bitmap error - could not write rgb data to "
+            << bitmap_path << "." << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
 /*  Each point on a face in an obj file can consist of up to three indices:
         The position index (required).
         The texture coordinate index (optional).
@@ -259,6 +334,148 @@ struct FaceTriple {
     int normal_index;
 };
 
+/*  Faces that meet at an angle sharper than this (60 degrees) do not share
+    normals, so that hard edges stay hard under smooth shading. */
+static constexpr double CREASE_ANGLE_COS = 0.5;
+
+/*  Build an indexed mesh from the points of a list of triangular faces (three
+    per face, with 0 for an absent texture coordinate or normal index). Face
+    points with the same position and texture coordinate refer to the same
+    vertex, except where it lies on a crease, in which case each side of the
+    crease gets its own vertex. Normal indices are ignored, so that files
+    giving each face its own normals still share vertices between faces.
+
+    Normals are computed from the faces rather than read from the file, so
+    that they always agree with the winding order used for back face culling.
+    Each vertex normal is the area weighted average of the normals of the
+    faces sharing the vertex that are not across a crease from it.
+
+    Returns nullptr if a face refers to a vertex or texture coordinate that
+    does not exist - obj_path is only used to report this. */
+static Graphics::Mesh* build_indexed_mesh(
+    const std::string& obj_path,
+    const std::vector<Maths::Vector<double, 4>>& vertices,
+    const std::vector<Maths::Vector<double, 4>>& texture_coords,
+    const std::vector<FaceTriple>& face_points
+) {
+    size_t num_faces = face_points.size() / 3;
+
+    /*  Validate indices before using them. */
+    for (const FaceTriple& point : face_points) {
+        if (point.position_index < 1 ||
+            point.position_index > (int) vertices.size() ||
+            point.texture_coord_index < 0 ||
+            point.texture_coord_index > (int) texture_coords.size()) {
+            std::cerr << "Load mesh error - a face in " << obj_path << " refers"
+                " to a vertex or texture coordinate that does not exist."
+                << std::endl;
+            return nullptr;
+        }
+    }
+
+    /*  Face normals - the cross product is twice the area of the face in
+        length, so is used as is for weighting. */
+    std::vector<Maths::Vector<double, 4>> face_normals(num_faces);
+    std::vector<Maths::Vector<double, 4>> unit_face_normals(num_faces);
+
+    for (size_t f = 0; f < num_faces; f++) {
+        const Maths::Vector<double, 4>& p0 =
+            vertices[face_points[f * 3].position_index - 1];
+        const Maths::Vector<double, 4>& p1 =
+            vertices[face_points[f * 3 + 1].position_index - 1];
+        const Maths::Vector<double, 4>& p2 =
+            vertices[face_points[f * 3 + 2].position_index - 1];
+
+        face_normals[f] = Maths::cross(p1 - p0, p2 - p0);
+
+        /*  Degenerate faces are left with a zero normal. */
+        if (Maths::dot(face_normals[f], face_normals[f]) > 0.0) {
+            unit_face_normals[f] = Maths::normalise(face_normals[f]);
+        }
+    }
+
+    /*  Group the face points by position and texture coordinate, in order of
+        first use. */
+    std::map<std::pair<int, int>, std::vector<int>> groups;
+    std::vector<std::vector<int>*> group_order;
+
+    for (size_t i = 0; i < face_points.size(); i++) {
+        std::vector<int>& group = groups[std::make_pair(
+            face_points[i].position_index,
+            face_points[i].texture_coord_index
+        )];
+
+        if (group.empty()) {
+            group_order.push_back(&group);
+        }
+
+        group.push_back(i);
+    }
+
+    Graphics::Mesh* mesh = new Graphics::Mesh();
+    mesh->indices.resize(face_points.size());
+
+    for (std::vector<int>* group : group_order) {
+        const FaceTriple& triple = face_points[group->front()];
+
+        Graphics::Vertex vertex {};
+
+        vertex.pos = vertices[triple.position_index - 1];
+        vertex.r = 255.0;
+        vertex.g = 255.0;
+        vertex.b = 255.0;
+
+        if (triple.texture_coord_index > 0) {
+            vertex.tex_x = texture_coords[triple.texture_coord_index - 1](0);
+            vertex.tex_y = texture_coords[triple.texture_coord_index - 1](1);
+        }
+
+        /*  Vertices made for this group so far - face points on the same
+            side of any crease sum the same faces in the same order, so get
+            exactly the same normal and share a vertex. */
+        size_t first_vertex = mesh->vertices.size();
+
+        for (int i : *group) {
+            int face = i / 3;
+            Maths::Vector<double, 4> normal { 0.0, 0.0, 0.0, 0.0 };
+
+            for (int j : *group) {
+                int other_face = j / 3;
+
+                if (other_face == face || Maths::dot(
+                    unit_face_normals[face],
+                    unit_face_normals[other_face]
+                ) > CREASE_ANGLE_COS) {
+                    normal += face_normals[other_face];
+                }
+            }
+
+            if (Maths::dot(normal, normal) > 0.0) {
+                normal = Maths::normalise(normal);
+            }
+
+            size_t index = first_vertex;
+
+            while (index < mesh->vertices.size() &&
+                mesh->vertices[index].normal != normal) {
+                index ++;
+            }
+
+            if (index == mesh->vertices.size()) {
+                vertex.normal = normal;
+                mesh->vertices.push_back(vertex);
+            }
+
+            mesh->indices[i] = index;
+        }
+    }
+
+    Graphics::compute_mesh_bounds(*mesh);
+    Graphics::build_mesh_clusters(*mesh);
+
+    return mesh;
+}
+
 Graphics::Mesh* load_mesh_from_obj(std::string obj_path) {
     Graphics::Mesh* mesh = nullptr;
 
@@ -271,7 +488,7 @@ Graphics::Mesh* load_mesh_from_obj(std::string obj_path) {
         std::vector<Maths::Vector<double, 4>> vertices;
         std::vector<Maths::Vector<double, 4>> texture_coords;
         std::vector<Maths::Vector<double, 4>> normals;
-        std::vector<Graphics::Triangle> triangles;
+        std::vector<FaceTriple> face_points;
 
         std::string line;
         while (getline(obj_file, line)) {
@@ -367,73 +584,27 @@ Graphics::Mesh* load_mesh_from_obj(std::string obj_path) {
                         break;
                     }
 
-                    /*  Fill out point structures - we do not use normals for
-                        now as we compute them in the rendering pipeline. */
-                    Graphics::Point point_1 {};
-
-                    point_1.pos = vertices[v1[0] - 1];
-                    point_1.r = 255.0;
-                    point_1.g = 255.0;
-                    point_1.b = 255.0;
-
-                    if (
-                        v1_form == ObjTripletFormat::PT ||
-                        v1_form == ObjTripletFormat::PTN
-                    ) {
-                        Maths::Vector<double, 4> tex_vertex =
-                            texture_coords[v1[1] - 1];
-                        point_1.tex_x = tex_vertex(0);
-                        point_1.tex_y = tex_vertex(1);
+                    /*  Texture coordinate and normal indices that are
+                        absent are recorded as 0. */
+                    bool has_tex = v1_form == ObjTripletFormat::PT ||
+                        v1_form == ObjTripletFormat::PTN;
+                    bool has_normal = v1_form == ObjTripletFormat::PN ||
+                        v1_form == ObjTripletFormat::PTN;
+
+                    for (int* v : { v1, v2, v3 }) {
+                        face_points.push_back(FaceTriple {
+                            v[0],
+                            has_tex ? v[1] : 0,
+                            has_normal ? v[2] : 0
+                        });
                     }
-
-                    Graphics::Point point_2 {};
-
-                    point_2.pos = vertices[v2[0] - 1];
-                    point_2.r = 255.0;
-                    point_2.g = 255.0;
-                    point_2.b = 255.0;
-
-                    if (
-                        v2_form == ObjTripletFormat::PT ||
-                        v2_form == ObjTripletFormat::PTN
-                    ) {
-                        Maths::Vector<double, 4> tex_vertex =
-                            texture_coords[v2[1] - 1];
-                        point_2.tex_x = tex_vertex(0);
-                        point_2.tex_y = tex_vertex(1);
-                    }
-
-                    Graphics::Point point_3 {};
-
-                    point_3.pos = vertices[v3[0] - 1];
-                    point_3.r = 255.0;
-                    point_3.g = 255.0;
-                    point_3.b = 255.0;
-
-                    if (
-                        v3_form == ObjTripletFormat::PT ||
-                        v3_form == ObjTripletFormat::PTN
-                    ) {
-                        Maths::Vector<double, 4> tex_vertex =
-                            texture_coords[v3[1] - 1];
-                        point_3.tex_x = tex_vertex(0);
-                        point_3.tex_y = tex_vertex(1);
-                    }
-
-                    std::cout << "Tex coords: (" << std::to_string(point_1.tex_x) << ", " << std::to_string(point_1.tex_y) << "), (" << std::to_string(point_2.tex_x) << ", " << std::to_string(point_2.tex_y) << "), (" << std::to_string(point_3.tex_x) << ", " << std::to_string(point_3.tex_y) << ")" << std::endl;
-
-                    /*  Add triangle to triangles vector. */
-                    triangles.push_back(Graphics::Triangle {
-                        { point_1, point_2, point_3 },
-                        nullptr
-                    });
                 }
             }
         };
 
         if (!failed) {
-            mesh = new Graphics::Mesh();
-            mesh->triangles = triangles;
+            mesh = build_indexed_mesh(obj_path, vertices, texture_coords,
+                face_points);
         }
     }
 
@@ -444,10 +615,7 @@ Graphics::Mesh* load_mesh_from_obj(std::string obj_path) {
 
 /*  Attach a texture to a mesh that already has texture coordinates. */
 void attach_texture(Graphics::Mesh& mesh, TrueColourBitmap& bitmap) {
-    /*  Set the bitmap pointer of all triangles to this bitmap. */
-    for (Graphics::Triangle& tri : mesh.triangles) {
-        tri.bitmap_ptr = &bitmap;
-    }
+    mesh.bitmap_ptr = &bitmap;
 };
 
 }
\ No newline at end of file
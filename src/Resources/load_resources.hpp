@@ -6,6 +6,7 @@
 #define LOAD_RESOURCES_HPP
 
 #include "./../Graphics/Model.hpp"
+#include "./../System/RenderWindow.hpp"
 #include <memory>
 #include <vector>
 
@@ -106,6 +107,12 @@ struct TrueColourBitmap {
 /*  Load bitmap from bmp file. */
 TrueColourBitmap* load_bitmap_from_file(std::string bitmap_path);
 
+/*  Save the current contents of a window's render buffer to a 24 bit bmp
+    file (e.g. to inspect frames drawn by a headless render window). Returns
+    false if the file could not be written. */
+bool save_render_buffer_to_file(System::RenderWindow& window,
+    std::string bitmap_path);
+
 /*  Note that we do not return a smart pointer simply because a load can fail,
     and a resource load is potentially recoverable depending on the context, so
     we may want to accept nullptr as a return value. */
@@ -0,0 +1,117 @@
+/*  DepthBuffer.cpp */
+
+#include "DepthBuffer.hpp"
+#include <algorithm>
+#include <cstring>
+
+namespace System {
+
+DepthBuffer::DepthBuffer(int width, int height, DepthFormat format) {
+    this->resize(width, height, format);
+}
+
+void DepthBuffer::resize(int width, int height, DepthFormat format) {
+    this->width = width;
+    this->height = height;
+    this->format = format;
+
+    size_t bytes = (size_t) width * height * get_depth_format_size(format);
+
+    this->storage.resize((bytes + sizeof(uint64_t) - 1) / sizeof(uint64_t));
+    this->set_max_inverse_depth(this->max_inverse_depth);
+}
+
+void DepthBuffer::clear() {
+    std::memset(this->storage.data(), 0,
+        this->storage.size() * sizeof(uint64_t));
+}
+
+double DepthBuffer::read(int x, int y) {
+    FramebufferView view {};
+    this->fill_view(view);
+
+    return read_depth(view, x, y);
+}
+
+void DepthBuffer::write(int x, int y, double inverse_depth) {
+    FramebufferView view {};
+    this->fill_view(view);
+
+    write_depth(view, x, y, inverse_depth);
+}
+
+void DepthBuffer::set_max_inverse_depth(double max_inverse_depth) {
+    this->max_inverse_depth = max_inverse_depth;
+
+    uint32_t max_value = this->format == DepthFormat::UNORM16 ?
+        UNORM16_DEPTH_MAX : UNORM24_DEPTH_MAX;
+
+    this->scale = max_value / max_inverse_depth;
+}
+
+DepthFormat DepthBuffer::get_format() {
+    return this->format;
+}
+
+void DepthBuffer::fill_view(FramebufferView& view) {
+    view.depth = this->storage.data();
+    view.depth_stride = this->width;
+    view.depth_format = this->format;
+    view.depth_scale = this->scale;
+}
+
+double read_depth(const FramebufferView& view, int x, int y) {
+    void* depth = view.depth_pixel(x, y);
+
+    switch (view.depth_format) {
+        case DepthFormat::FLOAT32: {
+            return *(float*) depth;
+        }
+
+        case DepthFormat::UNORM24: {
+            return *(uint32_t*) depth / view.depth_scale;
+        }
+
+        case DepthFormat::UNORM16: {
+            return *(uint16_t*) depth / view.depth_scale;
+        }
+
+        default: {
+            return *(double*) depth;
+        }
+    }
+}
+
+void write_depth(const FramebufferView& view, int x, int y,
+    double inverse_depth) {
+    void* depth = view.depth_pixel(x, y);
+
+    /*  The same conversion as the span kernels make. */
+    double value = std::max(inverse_depth * view.depth_scale, 0.0);
+
+    switch (view.depth_format) {
+        case DepthFormat::FLOAT32: {
+            *(float*) depth = inverse_depth;
+            break;
+        }
+
+        case DepthFormat::UNORM24: {
+            *(uint32_t*) depth = (uint32_t) std::min(value,
+                (double) UNORM24_DEPTH_MAX);
+            break;
+        }
+
+        case DepthFormat::UNORM16: {
+            *(uint16_t*) depth = (uint16_t) std::min(value,
+                (double) UNORM16_DEPTH_MAX);
+            break;
+        }
+
+        default: {
+            *(double*) depth = inverse_depth;
+            break;
+        }
+    }
+}
+
+}
@@ -0,0 +1,66 @@
+/*  DepthBuffer.hpp
+
+    Storage for a depth buffer in any DepthFormat, shared by the render
+    windows (and the Renderer's own frame buffers). Depths are read and
+    written through this as inverse depths in double precision, whatever
+    their format - the rasteriser instead writes them directly through a
+    FramebufferView, filled in by fill_view. */
+
+#ifndef DEPTH_BUFFER_HPP
+#define DEPTH_BUFFER_HPP
+
+#include <vector>
+#include "RenderWindow.hpp"
+
+namespace System {
+
+class DepthBuffer {
+    public:
+        DepthBuffer(int width = 0, int height = 0,
+            DepthFormat format = DepthFormat::DOUBLE);
+
+        /*  Change the size or format of the buffer. Its contents are then
+            unspecified until it is cleared. */
+        void resize(int width, int height, DepthFormat format);
+
+        /*  Set every depth to 0 (infinitely far away). Since this is all
+            zero bytes in every format, it is a single memset. */
+        void clear();
+
+        double read(int x, int y);
+
+        void write(int x, int y, double inverse_depth);
+
+        /*  See RenderWindow::set_max_inverse_depth. */
+        void set_max_inverse_depth(double max_inverse_depth);
+
+        DepthFormat get_format();
+
+        /*  Fill in the depth members of a view of the buffer. */
+        void fill_view(FramebufferView& view);
+
+    private:
+        int width;
+        int height;
+        DepthFormat format;
+
+        /*  Inverse depths are multiplied by this to give the values stored
+            in the UNORM formats. */
+        double scale;
+
+        double max_inverse_depth = 1.0;
+
+        /*  The depths, in 8 byte words so that DOUBLE depths are aligned. */
+        std::vector<uint64_t> storage;
+};
+
+/*  Read or write a single inverse depth through a view, converting it from
+    or to the view's depth format (as DepthBuffer::read and write do). */
+double read_depth(const FramebufferView& view, int x, int y);
+
+void write_depth(const FramebufferView& view, int x, int y,
+    double inverse_depth);
+
+}
+
+#endif
@@ -0,0 +1,111 @@
+/*  HeadlessRenderWindow.cpp */
+
+#include "HeadlessRenderWindow.hpp"
+#include <cstring>
+
+namespace System {
+
+HeadlessRenderWindow::HeadlessRenderWindow(int width, int height,
+    DepthFormat depth_format) :
+    width{width}, height{height}, rgba_buffer(width * height),
+    depth_buffer(width, height, depth_format) {}
+
+bool HeadlessRenderWindow::handle_events() {
+    return this->open;
+}
+
+void HeadlessRenderWindow::close_window() {
+    this->open = false;
+}
+
+bool HeadlessRenderWindow::is_open() {
+    return this->open;
+}
+
+void HeadlessRenderWindow::clear_window() {
+    std::memset(this->rgba_buffer.data(), 0, this->width * this->height *
+        sizeof(pixel));
+}
+
+void HeadlessRenderWindow::display_render_buffer() {
+    this->presented_frames ++;
+}
+
+void HeadlessRenderWindow::draw_pixel(int x, int y, uint8_t red,
+    uint8_t green, uint8_t blue) {
+    uint32_t pixel_val = (red << this->RED_SHIFT) |
+        (green << this->GREEN_SHIFT) | (blue << this->BLUE_SHIFT);
+
+    this->rgba_buffer[y * this->width + x] = pixel_val;
+}
+
+void HeadlessRenderWindow::reset_depth_buffer() {
+    this->depth_buffer.clear();
+}
+
+double HeadlessRenderWindow::read_depth_buffer(int x, int y) {
+    return this->depth_buffer.read(x, y);
+}
+
+void HeadlessRenderWindow::write_depth_buffer(int x, int y, double val) {
+    this->depth_write_count++;
+    this->depth_buffer.write(x, y, val);
+}
+
+void HeadlessRenderWindow::set_max_inverse_depth(double max_inverse_depth) {
+    this->depth_buffer.set_max_inverse_depth(max_inverse_depth);
+}
+
+int HeadlessRenderWindow::get_width() {
+    return this->width;
+}
+
+int HeadlessRenderWindow::get_height() {
+    return this->height;
+}
+
+PixelFormat HeadlessRenderWindow::get_pixel_format() {
+    return PixelFormat { this->RED_SHIFT, this->GREEN_SHIFT, this->BLUE_SHIFT };
+}
+
+DepthFormat HeadlessRenderWindow::get_depth_format() {
+    return this->depth_buffer.get_format();
+}
+
+KeyState HeadlessRenderWindow::get_key(KeySymbol) {
+    return KeyState::KEY_UP;
+}
+
+FramebufferView HeadlessRenderWindow::lock_framebuffer() {
+    FramebufferView view {};
+
+    view.width = this->width;
+    view.height = this->height;
+    view.colour = this->rgba_buffer.data();
+    view.colour_stride = this->width;
+    view.red_shift = this->RED_SHIFT;
+    view.green_shift = this->GREEN_SHIFT;
+    view.blue_shift = this->BLUE_SHIFT;
+
+    this->depth_buffer.fill_view(view);
+    this->depth_write_count++;
+
+    return view;
+}
+
+void HeadlessRenderWindow::unlock_framebuffer() {
+}
+
+unsigned long long HeadlessRenderWindow::get_depth_write_count() {
+    return this->depth_write_count;
+}
+
+int HeadlessRenderWindow::get_back_buffer_index() {
+    return 0;
+}
+
+PresentStats HeadlessRenderWindow::get_present_stats() {
+    return PresentStats { this->presented_frames, 0, 0 };
+}
+
+}
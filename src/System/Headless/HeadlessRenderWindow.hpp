@@ -0,0 +1,102 @@
+/*  HeadlessRenderWindow.hpp
+
+    A RenderWindow that renders into memory only. It has the same colour and
+    depth buffers as an on-screen render window, but never connects to a
+    display server - so it can be used on machines without a display (e.g.
+    for batch rendering) and to benchmark the rendering pipeline in isolation
+    from blitting.
+
+    The render buffer can be read back with lock_framebuffer or written to a
+    file with Resources::save_render_buffer_to_file. */
+
+#ifndef HEADLESS_RENDER_WINDOW_HPP
+#define HEADLESS_RENDER_WINDOW_HPP
+
+#include <string>
+#include <vector>
+#include "./../RenderWindow.hpp"
+#include "./../DepthBuffer.hpp"
+
+namespace System {
+
+class HeadlessRenderWindow : public RenderWindow {
+    public:
+        HeadlessRenderWindow() = delete;
+
+        /*  There are no events without a display - this only reports
+            whether the window is still open. */
+        bool handle_events() override;
+
+        void close_window() override;
+
+        bool is_open() override;
+
+        void clear_window() override;
+
+        /*  Nothing is displayed - this only counts the frame as presented. */
+        void display_render_buffer() override;
+
+        void draw_pixel(int x, int y, uint8_t red, uint8_t green,
+            uint8_t blue) override;
+        
+        void reset_depth_buffer() override;
+        
+        double read_depth_buffer(int x, int y) override;
+
+        void write_depth_buffer(int x, int y, double val) override;
+
+        void set_max_inverse_depth(double max_inverse_depth) override;
+        
+        int get_width() override;
+
+        int get_height() override;
+
+        PixelFormat get_pixel_format() override;
+
+        DepthFormat get_depth_format() override;
+
+        /*  There is no keyboard, so every key is always up. */
+        KeyState get_key(KeySymbol key_id) override;
+
+        FramebufferView lock_framebuffer() override;
+
+        void unlock_framebuffer() override;
+
+        unsigned long long get_depth_write_count() override;
+
+        /*  There is only ever one buffer. */
+        int get_back_buffer_index() override;
+
+        PresentStats get_present_stats() override;
+
+        /*  Only allow public construction through non-member factory method
+            make_render_window. */
+        friend RenderWindow* make_render_window(std::string title,
+            int width, int height, const RenderWindowOptions& options);
+
+    private:
+        HeadlessRenderWindow(int width, int height, DepthFormat depth_format);
+
+        int width;
+        int height;
+
+        using pixel = uint32_t;
+        std::vector<pixel> rgba_buffer;
+
+        DepthBuffer depth_buffer;
+        unsigned long long depth_write_count = 0;
+
+        /*  Pixels are stored as 0x00RRGGBB, as for the common X11 TrueColor
+            visuals. */
+        static constexpr uint8_t RED_SHIFT = 16;
+        static constexpr uint8_t GREEN_SHIFT = 8;
+        static constexpr uint8_t BLUE_SHIFT = 0;
+
+        bool open = true;
+
+        unsigned long long presented_frames = 0;
+};
+
+}
+
+#endif
@@ -5,11 +5,21 @@
 
 #include "./../RenderWindow.hpp"
 #include "X11RGBARenderWindow.hpp"
+#include "./../Headless/HeadlessRenderWindow.hpp"
 
 namespace System {
 
 RenderWindow* make_render_window(std::string title, int width,
     int height) {
+    return make_render_window(title, width, height, RenderWindowOptions {});
+}
+
+RenderWindow* make_render_window(std::string title, int width, int height,
+    const RenderWindowOptions& options) {
+    if (options.type == RenderWindowType::HEADLESS) {
+        return new HeadlessRenderWindow(width, height, options.depth_format);
+    }
+
     /*  TODO - identify the details about the video hardware and settings of
         the running device and use it to decide which type of render window
         to construct.
@@ -21,7 +31,8 @@ RenderWindow* make_render_window(std::string title, int width,
     /*  Note that since the X11RGBARenderWindow constructor is private and this
         is a friend function (but std::make_unique is not), we cannot use
         make_unique, hence the slightly odd construction. */
-    return new X11RGBARenderWindow(title, width, height);
+    return new X11RGBARenderWindow(title, width, height, options.buffer_count,
+        options.present_mode, options.depth_format);
 }
 
 }
@@ -1,45 +1,95 @@
 /*  X11RGBARenderWindow.cpp */
 
 #include "X11RGBARenderWindow.hpp"
+#include <X11/Xutil.h>
+#include <sys/ipc.h>
+#include <sys/shm.h>
+#include <algorithm>
 #include <cstring>
 #include <iostream>
+#include <stdexcept>
 
 namespace System {
 
 X11RGBARenderWindow::X11RGBARenderWindow(std::string title, int width,
-    int height) : window{title, width, height}, rgba_buffer(width * height),
-    depth_buffer(width * height) {
+    int height, int buffer_count, PresentMode present_mode,
+    DepthFormat depth_format) :
+    window{title, width, height}, colour_buffers(std::max(buffer_count, 1)),
+    depth_buffer(width, height, depth_format), present_mode{present_mode} {
     /*  Create graphics context for window - use default mask and metadata
         values (two zero parameters). */
     this->graphics_context = XCreateGC(this->window.server_connection,
         this->window.window, 0, 0);
-    
-    /*  Create XImage structure - bitmap metadata to inform window of how to
-        interpret render buffer when blitting with an XPutImage call. */
-    this->image_data = XCreateImage(
-        this->window.server_connection, /* display (server connection). */
-        this->window.visual_info, /* visual info / metadata. */
-        this->TRUE_COLOR_BIT_DEPTH, /* bit depth - 24 bits for true colour. */
-        ZPixmap, /* format of RGB bitmap. */
-        0, /* offset from start of buffer to first colour value. */
-        (char*) this->rgba_buffer.data(), /* pointer to data. */
-        this->window.width, this->window.height, /* width and height. */
-        32, /*  pad to nearest 32 bits. */
-        0 /* bytes per line - 0 indicates default width * sizeof(padded pixel)
-             calculation is used. */
-    );
+
+    /*  Either every buffer uses shared memory or none do - if the first
+        cannot, the rest will not be able to either. */
+    this->use_shm = this->create_shm_image(this->colour_buffers[0]);
+
+    for (size_t i = 0; i < this->colour_buffers.size(); i++) {
+        ColourBuffer& buffer = this->colour_buffers[i];
+
+        if (!this->use_shm) {
+            this->create_image(buffer);
+        } else if (i > 0 && !this->create_shm_image(buffer)) {
+            /*  The destructor will not run, so release what has already been
+                created. */
+            for (size_t j = 0; j < i; j++) {
+                this->destroy_image(this->colour_buffers[j]);
+            }
+
+            XFreeGC(this->window.server_connection, this->graphics_context);
+
+            throw std::runtime_error("X11 Error - could not allocate shared"
+                " memory colour buffer.");
+        }
+
+        buffer.state = BufferState::FREE;
+    }
+
+    this->colour_buffers[0].state = BufferState::RENDERING;
+
+    if (this->colour_buffers.size() > 1) {
+        this->present_thread = std::thread(&X11RGBARenderWindow::present_loop,
+            this);
+    } else if (this->use_shm) {
+        /*  With a single buffer, have the server notify us when it has
+            finished reading each frame from the segment. */
+        this->window.shm_completion_event_type = XShmGetEventBase(
+            this->window.server_connection) + ShmCompletion;
+    }
 
     /*  Calculate shift of red, green and blue values. */
     this->red_shift = this->compute_shift_from_rgb_mask(
         this->window.visual_info->red_mask);
-    
+
     this->green_shift = this->compute_shift_from_rgb_mask(
         this->window.visual_info->green_mask);
-    
+
     this->blue_shift = this->compute_shift_from_rgb_mask(
         this->window.visual_info->blue_mask);
 }
 
+X11RGBARenderWindow::~X11RGBARenderWindow() {
+    /*  The present thread shows any frames still queued before it stops. */
+    if (this->present_thread.joinable()) {
+        {
+            std::lock_guard<std::mutex> lock(this->present_mutex);
+            this->stop_presenting = true;
+        }
+
+        this->frame_queued.notify_one();
+        this->present_thread.join();
+    }
+
+    this->wait_for_shm_put();
+
+    for (ColourBuffer& buffer : this->colour_buffers) {
+        this->destroy_image(buffer);
+    }
+
+    XFreeGC(this->window.server_connection, this->graphics_context);
+}
+
 bool X11RGBARenderWindow::handle_events() {
     return this->window.handle_events();
 }
@@ -53,40 +103,72 @@ bool X11RGBARenderWindow::is_open() {
 }
 
 void X11RGBARenderWindow::clear_window() {
-    std::memset(this->rgba_buffer.data(), 0, this->window.width *
-        this->window.height * sizeof(pixel));
+    this->wait_for_shm_put();
+
+    ColourBuffer& buffer = this->colour_buffers[this->back_buffer_index];
+
+    std::memset(buffer.pixels, 0, buffer.stride * this->window.height *
+        sizeof(pixel));
 }
 
 void X11RGBARenderWindow::display_render_buffer() {
-    XPutImage(this->window.server_connection, this->window.window,
-        this->graphics_context, this->image_data, 0, 0, 0, 0,
-        this->window.width, this->window.height);
-    
-    XFlush(this->window.server_connection);
+    if (this->colour_buffers.size() == 1) {
+        /*  Only one blit is kept in flight. */
+        this->wait_for_shm_put();
+
+        this->put_image(this->colour_buffers[0], this->use_shm);
+        this->presented_frames ++;
+
+        if (this->use_shm) {
+            this->window.shm_put_pending = true;
+        }
+
+        XFlush(this->window.server_connection);
+        return;
+    }
+
+    /*  Hand the back buffer to the present thread and continue with
+        another. */
+    std::unique_lock<std::mutex> lock(this->present_mutex);
+
+    this->colour_buffers[this->back_buffer_index].state = BufferState::QUEUED;
+    this->present_queue.push_back(this->back_buffer_index);
+    this->frame_queued.notify_one();
+
+    this->acquire_back_buffer(lock);
 }
 
 inline void X11RGBARenderWindow::draw_pixel(int x, int y, uint8_t red,
     uint8_t green, uint8_t blue) {
+    if (this->window.shm_put_pending) {
+        this->wait_for_shm_put();
+    }
+
     uint32_t pixel_val = (red << this->red_shift) |
         (green << this->green_shift) | (blue << this->blue_shift);
 
-    this->rgba_buffer[y * this->window.width + x] = pixel_val;
+    ColourBuffer& buffer = this->colour_buffers[this->back_buffer_index];
+
+    buffer.pixels[y * buffer.stride + x] = pixel_val;
 }
 
 void X11RGBARenderWindow::reset_depth_buffer() {
-    for (int i = 0; i < this->window.width * this->window.height; i++) {
-        this->depth_buffer[i] = 0.0;
-    }
+    this->depth_buffer.clear();
 };
-        
+
 inline double X11RGBARenderWindow::read_depth_buffer(int x, int y) {
-    return this->depth_buffer[y * this->window.width + x];
+    return this->depth_buffer.read(x, y);
 };
 
 inline void X11RGBARenderWindow::write_depth_buffer(int x, int y, double val) {
-    this->depth_buffer[y * this->window.width + x] = val;
+    this->depth_write_count++;
+    this->depth_buffer.write(x, y, val);
 };
 
+void X11RGBARenderWindow::set_max_inverse_depth(double max_inverse_depth) {
+    this->depth_buffer.set_max_inverse_depth(max_inverse_depth);
+}
+
 int X11RGBARenderWindow::get_width() {
     return this->window.width;
 }
@@ -95,10 +177,62 @@ int X11RGBARenderWindow::get_height() {
     return this->window.height;
 }
 
+PixelFormat X11RGBARenderWindow::get_pixel_format() {
+    return PixelFormat { this->red_shift, this->green_shift, this->blue_shift };
+}
+
+DepthFormat X11RGBARenderWindow::get_depth_format() {
+    return this->depth_buffer.get_format();
+}
+
 KeyState X11RGBARenderWindow::get_key(KeySymbol key_id) {
     return window.get_key(key_id);
 }
 
+FramebufferView X11RGBARenderWindow::lock_framebuffer() {
+    this->wait_for_shm_put();
+
+    ColourBuffer& buffer = this->colour_buffers[this->back_buffer_index];
+
+    FramebufferView view {};
+
+    view.width = this->window.width;
+    view.height = this->window.height;
+    view.colour = buffer.pixels;
+    view.colour_stride = buffer.stride;
+    view.red_shift = this->red_shift;
+    view.green_shift = this->green_shift;
+    view.blue_shift = this->blue_shift;
+
+    this->depth_buffer.fill_view(view);
+    this->depth_write_count++;
+
+    return view;
+}
+
+void X11RGBARenderWindow::unlock_framebuffer() {
+    /*  The buffers are only read by the server when displayed, so there is
+        nothing to do. */
+}
+
+unsigned long long X11RGBARenderWindow::get_depth_write_count() {
+    return this->depth_write_count;
+}
+
+int X11RGBARenderWindow::get_back_buffer_index() {
+    return this->back_buffer_index;
+}
+
+PresentStats X11RGBARenderWindow::get_present_stats() {
+    std::lock_guard<std::mutex> lock(this->present_mutex);
+
+    return PresentStats {
+        this->presented_frames,
+        this->dropped_frames,
+        (int) this->present_queue.size()
+    };
+}
+
 /*  Prerequisite - rgb mask is of form 0b0...1...1...0, i.e. a string of 1s
     surrounded by zero or more 0's on each side. */
 uint8_t X11RGBARenderWindow::compute_shift_from_rgb_mask(
@@ -114,4 +248,217 @@ uint8_t X11RGBARenderWindow::compute_shift_from_rgb_mask(
     return count;
 }
 
-}
\ No newline at end of file
+/*  Set by handle_shm_attach_error if attaching a shared memory segment to
+    the X server fails. X errors are reported asynchronously through a global
+    handler, so this cannot be a member. */
+static bool shm_attach_failed = false;
+
+static int handle_shm_attach_error(Display*, XErrorEvent*) {
+    shm_attach_failed = true;
+    return 0;
+}
+
+static Bool is_shm_completion_event(Display*, XEvent* event,
+    XPointer completion_event_type) {
+    return event->type == *((int*) completion_event_type);
+}
+
+bool X11RGBARenderWindow::create_shm_image(ColourBuffer& buffer) {
+    Display* display = this->window.server_connection;
+
+    if (!XShmQueryExtension(display)) {
+        return false;
+    }
+
+    XShmSegmentInfo& shm_info = buffer.shm_info;
+
+    buffer.image_data = XShmCreateImage(display, this->window.visual_info,
+        this->TRUE_COLOR_BIT_DEPTH, ZPixmap, nullptr, &shm_info,
+        this->window.width, this->window.height);
+
+    if (buffer.image_data == nullptr) {
+        return false;
+    }
+
+    shm_info.shmid = shmget(IPC_PRIVATE, buffer.image_data->bytes_per_line *
+        buffer.image_data->height, IPC_CREAT | 0600);
+
+    if (shm_info.shmid < 0) {
+        XDestroyImage(buffer.image_data);
+        return false;
+    }
+
+    shm_info.shmaddr = (char*) shmat(shm_info.shmid, nullptr, 0);
+    shm_info.readOnly = False;
+
+    if (shm_info.shmaddr == (char*) -1) {
+        shmctl(shm_info.shmid, IPC_RMID, nullptr);
+        XDestroyImage(buffer.image_data);
+        return false;
+    }
+
+    buffer.image_data->data = shm_info.shmaddr;
+
+    /*  The extension can be present but unusable (e.g. for a remote server),
+        in which case attaching fails with an X error rather than a return
+        value. Hence, temporarily install our own error handler and
+        synchronise with the server to find out. */
+    XSync(display, False);
+    shm_attach_failed = false;
+
+    XErrorHandler previous_handler = XSetErrorHandler(
+        handle_shm_attach_error);
+
+    XShmAttach(display, &shm_info);
+    XSync(display, False);
+
+    XSetErrorHandler(previous_handler);
+
+    /*  Mark the segment for removal now - it is only destroyed once both we
+        and the server have detached from it, so this ensures that it does not
+        outlive the program, even if it exits abnormally. */
+    shmctl(shm_info.shmid, IPC_RMID, nullptr);
+
+    if (shm_attach_failed) {
+        std::cerr << "X11 shared memory unavailable - falling back to"
+            " XPutImage." << std::endl;
+
+        shmdt(shm_info.shmaddr);
+        buffer.image_data->data = nullptr;
+        XDestroyImage(buffer.image_data);
+        return false;
+    }
+
+    buffer.pixels = (pixel*) buffer.image_data->data;
+    buffer.stride = buffer.image_data->bytes_per_line / sizeof(pixel);
+
+    return true;
+}
+
+void X11RGBARenderWindow::create_image(ColourBuffer& buffer) {
+    buffer.rgba_buffer.resize(this->window.width * this->window.height);
+    buffer.pixels = buffer.rgba_buffer.data();
+    buffer.stride = this->window.width;
+
+    /*  Create XImage structure - bitmap metadata to inform window of how to
+        interpret render buffer when blitting with an XPutImage call. */
+    buffer.image_data = XCreateImage(
+        this->window.server_connection, /* display (server connection). */
+        this->window.visual_info, /* visual info / metadata. */
+        this->TRUE_COLOR_BIT_DEPTH, /* bit depth - 24 bits for true colour. */
+        ZPixmap, /* format of RGB bitmap. */
+        0, /* offset from start of buffer to first colour value. */
+        (char*) buffer.pixels, /* pointer to data. */
+        this->window.width, this->window.height, /* width and height. */
+        32, /*  pad to nearest 32 bits. */
+        0 /* bytes per line - 0 indicates default width * sizeof(padded pixel)
+             calculation is used. */
+    );
+}
+
+void X11RGBARenderWindow::destroy_image(ColourBuffer& buffer) {
+    if (this->use_shm) {
+        XShmDetach(this->window.server_connection, &buffer.shm_info);
+        XSync(this->window.server_connection, False);
+        shmdt(buffer.shm_info.shmaddr);
+    }
+
+    /*  The pixel data is not owned by the image (it is either rgba_buffer or
+        the shared memory segment), so it must not be freed with it. */
+    buffer.image_data->data = nullptr;
+    XDestroyImage(buffer.image_data);
+}
+
+void X11RGBARenderWindow::put_image(ColourBuffer& buffer,
+    bool send_completion_event) {
+    if (this->use_shm) {
+        /*  The server reads the segment asynchronously - the final parameter
+            requests a completion event once it has done so. */
+        XShmPutImage(this->window.server_connection, this->window.window,
+            this->graphics_context, buffer.image_data, 0, 0, 0, 0,
+            this->window.width, this->window.height,
+            send_completion_event ? True : False);
+    } else {
+        XPutImage(this->window.server_connection, this->window.window,
+            this->graphics_context, buffer.image_data, 0, 0, 0, 0,
+            this->window.width, this->window.height);
+    }
+}
+
+void X11RGBARenderWindow::wait_for_shm_put() {
+    while (this->window.shm_put_pending) {
+        XEvent event;
+
+        XIfEvent(this->window.server_connection, &event,
+            is_shm_completion_event,
+            (XPointer) &this->window.shm_completion_event_type);
+
+        this->window.multiplex_event(event);
+    }
+}
+
+void X11RGBARenderWindow::acquire_back_buffer(
+    std::unique_lock<std::mutex>& lock) {
+    while (true) {
+        for (size_t i = 0; i < this->colour_buffers.size(); i++) {
+            if (this->colour_buffers[i].state == BufferState::FREE) {
+                this->colour_buffers[i].state = BufferState::RENDERING;
+                this->back_buffer_index = i;
+                return;
+            }
+        }
+
+        /*  Every other buffer is queued or being presented. In mailbox mode,
+            take back the oldest frame that has not started presenting. */
+        if (this->present_mode == PresentMode::MAILBOX &&
+            !this->present_queue.empty()) {
+            this->back_buffer_index = this->present_queue.front();
+            this->present_queue.pop_front();
+            this->colour_buffers[this->back_buffer_index].state =
+                BufferState::RENDERING;
+            this->dropped_frames ++;
+            return;
+        }
+
+        this->buffer_freed.wait(lock);
+    }
+}
+
+/*  Runs on the present thread. Xlib is thread safe once XInitThreads has
+    been called (see X11Window), so frames can be sent while the main thread
+    draws and handles events. Rather than waiting on completion events (which
+    are consumed by the main thread's event loop), the present thread
+    synchronises with the server after each frame - once XSync returns, the
+    server has finished reading the buffer. */
+void X11RGBARenderWindow::present_loop() {
+    std::unique_lock<std::mutex> lock(this->present_mutex);
+
+    while (true) {
+        this->frame_queued.wait(lock, [this]() {
+            return this->stop_presenting || !this->present_queue.empty();
+        });
+
+        if (this->present_queue.empty()) {
+            return;
+        }
+
+        int index = this->present_queue.front();
+        this->present_queue.pop_front();
+
+        ColourBuffer& buffer = this->colour_buffers[index];
+        buffer.state = BufferState::PRESENTING;
+
+        lock.unlock();
+
+        this->put_image(buffer, false);
+        XSync(this->window.server_connection, False);
+
+        lock.lock();
+
+        buffer.state = BufferState::FREE;
+        this->presented_frames ++;
+        this->buffer_freed.notify_one();
+    }
+}
+
+}
@@ -1,11 +1,28 @@
-/*  X11RGBARenderWindow.hpp */
+/*  X11RGBARenderWindow.hpp
+
+    TrueColor render window for X11. Where the X server supports the MIT-SHM
+    extension (i.e. it is running on the same machine), the render buffers are
+    allocated in shared memory segments that the server reads directly, so
+    presenting a frame does not copy it through the X connection. Otherwise,
+    the render buffers are ordinary client memory and are sent with XPutImage.
+
+    With a single colour buffer, frames are presented by display_render_buffer
+    itself. With more than one, display_render_buffer queues the frame for a
+    dedicated present thread and moves on to the next back buffer, so that
+    drawing the next frame overlaps with presenting the last. */
 
 #ifndef X11RGBARENDER_WINDOW_HPP
 #define X11RGBARENDER_WINDOW_HPP
 
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
 #include <vector>
 #include "./../RenderWindow.hpp"
+#include "./../DepthBuffer.hpp"
 #include "X11Window.hpp"
+#include <X11/extensions/XShm.h>
 
 namespace System {
 
@@ -13,6 +30,8 @@ class X11RGBARenderWindow : public RenderWindow {
     public:
         X11RGBARenderWindow() = delete;
 
+        ~X11RGBARenderWindow() override;
+
         bool handle_events() override;
 
         void close_window() override;
@@ -25,40 +44,128 @@ class X11RGBARenderWindow : public RenderWindow {
 
         void draw_pixel(int x, int y, uint8_t red, uint8_t green,
             uint8_t blue) override;
-        
+
         void reset_depth_buffer() override;
-        
+
         double read_depth_buffer(int x, int y) override;
 
         void write_depth_buffer(int x, int y, double val) override;
-        
+
+        void set_max_inverse_depth(double max_inverse_depth) override;
+
         int get_width() override;
 
         int get_height() override;
 
+        PixelFormat get_pixel_format() override;
+
+        DepthFormat get_depth_format() override;
+
         KeyState get_key(KeySymbol key_id) override;
 
+        FramebufferView lock_framebuffer() override;
+
+        void unlock_framebuffer() override;
+
+        unsigned long long get_depth_write_count() override;
+
+        int get_back_buffer_index() override;
+
+        PresentStats get_present_stats() override;
+
         /*  Only allow public construction through non-member factory method
             make_render_window. */
-        friend RenderWindow* make_render_window(
-            std::string title, int width, int height);
+        friend RenderWindow* make_render_window(std::string title,
+            int width, int height, const RenderWindowOptions& options);
 
     private:
-        X11RGBARenderWindow(std::string title, int width, int height);
+        X11RGBARenderWindow(std::string title, int width, int height,
+            int buffer_count, PresentMode present_mode,
+            DepthFormat depth_format);
+
+        using pixel = uint32_t;
+
+        /*  Life cycle of a colour buffer. Exactly one buffer is RENDERING
+            (the back buffer) at any time. */
+        enum class BufferState {
+            FREE,
+            RENDERING,
+            QUEUED,
+            PRESENTING
+        };
+
+        struct ColourBuffer {
+            XImage* image_data;
+
+            /*  Shared memory segment holding the pixels, if use_shm. */
+            XShmSegmentInfo shm_info;
+
+            /*  Backing storage for the pixels when shared memory is not
+                used. */
+            std::vector<pixel> rgba_buffer;
+
+            /*  The pixels (in either of the above) and the row stride in
+                pixels. */
+            pixel* pixels;
+            int stride;
+
+            BufferState state;
+        };
 
         uint8_t compute_shift_from_rgb_mask(unsigned long rgb_mask);
 
+        /*  Attempt to create the image of a colour buffer in a shared memory
+            segment attached to the X server. Returns false, leaving the
+            buffer unset, if shared memory is not available. */
+        bool create_shm_image(ColourBuffer& buffer);
+
+        void create_image(ColourBuffer& buffer);
+
+        void destroy_image(ColourBuffer& buffer);
+
+        /*  Send the image of a buffer to the window. */
+        void put_image(ColourBuffer& buffer, bool send_completion_event);
+
+        /*  Block until the server has finished reading the previous frame
+            from shared memory, so that the render buffer can be written (only
+            used with a single buffer). */
+        void wait_for_shm_put();
+
+        /*  Make a buffer that is not waiting to be presented the back buffer,
+            according to the present mode. Requires present_mutex. */
+        void acquire_back_buffer(std::unique_lock<std::mutex>& lock);
+
+        void present_loop();
+
         X11Window window;
 
-        using pixel = uint32_t;
-        std::vector<pixel> rgba_buffer;
+        std::vector<ColourBuffer> colour_buffers;
+        int back_buffer_index = 0;
 
-        std::vector<double> depth_buffer;
+        DepthBuffer depth_buffer;
+        unsigned long long depth_write_count = 0;
 
         static constexpr int TRUE_COLOR_BIT_DEPTH = 24;
 
         GC graphics_context;
-        XImage* image_data;
+
+        bool use_shm = false;
+
+        PresentMode present_mode;
+
+        /*  Present thread state - only used with more than one buffer. Frames
+            are presented in the order of present_queue. The buffer states and
+            counters are shared with the present thread, so are protected by
+            present_mutex. */
+        std::thread present_thread;
+        std::mutex present_mutex;
+        std::condition_variable frame_queued;
+        std::condition_variable buffer_freed;
+        std::deque<int> present_queue;
+        bool stop_presenting = false;
+
+        unsigned long long presented_frames = 0;
+        unsigned long long dropped_frames = 0;
 
         uint8_t red_shift;
         uint8_t green_shift;
@@ -67,4 +174,4 @@ class X11RGBARenderWindow : public RenderWindow {
 
 }
 
-#endif
\ No newline at end of file
+#endif
@@ -9,6 +9,12 @@ namespace System {
 
 X11Window::X11Window(std::string title, int width, int height) :
     width{width}, height{height} {
+    /*  Enable Xlib's internal locking, so that the connection can be used
+        from more than one thread (e.g. by a render window's present thread).
+        This must precede any other Xlib call, and does nothing if called
+        again. */
+    XInitThreads();
+
     /*  Establish connection with X server. NULL indicates default / local
         server should be connected to. */
     this->server_connection = XOpenDisplay(NULL);
@@ -83,7 +89,10 @@ bool X11Window::handle_events() {
 
     while (XPending(this->server_connection)) {
         XNextEvent(this->server_connection, &event);
-        frame_continue = frame_continue && this->multiplex_event(event);
+        /*  Every event must be handled (even once the frame should not
+            continue), as some, such as shared memory completion events,
+            update state that is waited upon. */
+        frame_continue = this->multiplex_event(event) && frame_continue;
     }
 
     return frame_continue;
@@ -128,6 +137,13 @@ KeyState X11Window::get_key(KeySymbol key_id) {
 bool X11Window::multiplex_event(XEvent& event) {
     bool frame_should_continue = true;
 
+    /*  Extension event types are only known at runtime, so this cannot be
+        part of the switch below. */
+    if (event.type == this->shm_completion_event_type) {
+        this->shm_put_pending = false;
+        return frame_should_continue;
+    }
+
     switch (event.type) {
         case Expose: {
             std::cout << "Expose event - TODO." << std::endl;
@@ -68,6 +68,14 @@ class X11Window {
 
         Atom window_manager_delete_window_id;
 
+        /*  Event type of MIT-SHM completion events, or -1 if the render
+            window does not present through shared memory, and whether a
+            shared memory blit has been issued but not yet completed. Set by
+            the render window, and cleared when the completion event arrives
+            (which may happen in handle_events). */
+        int shm_completion_event_type = -1;
+        bool shm_put_pending = false;
+
         /*  Separate ascii and non-ascii keys due to representation differences
             in X11 - ascii keys (characters, numbers, punctuation) have their
             expected numerical values, but control keys - enter, arrows, etc.
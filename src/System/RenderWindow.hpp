@@ -9,6 +9,7 @@
 
 #include <cstdint>
 #include <memory>
+#include <string>
 
 namespace System {
 
@@ -57,8 +58,115 @@ enum class KeyState {
     KEY_UNDEFINED
 };
 
+/*  Formats in which a depth buffer may hold inverse depths (1 / z):
+        - DOUBLE stores them as they are, in 8 bytes.
+        - FLOAT32 stores them in single precision, in 4 bytes.
+        - UNORM24 and UNORM16 store them as unsigned integers of 24 bits (in
+          4 bytes) or 16 bits (in 2 bytes), spread evenly over the range
+          [0, max inverse depth] - see RenderWindow::set_max_inverse_depth.
+          An inverse depth d is stored as floor(d * depth_scale), clamped to
+          the largest value the format holds.
+
+    The narrower formats halve or quarter the memory traffic of the depth
+    test, at the cost of depth precision - surfaces closer together than a
+    step of the format may be drawn in the wrong order. In every format,
+    clearing the buffer (to an inverse depth of 0 - infinitely far away)
+    sets every byte to zero. */
+enum class DepthFormat {
+    DOUBLE,
+    FLOAT32,
+    UNORM24,
+    UNORM16
+};
+
+static constexpr int NUM_DEPTH_FORMATS = 4;
+
+static constexpr uint32_t UNORM24_DEPTH_MAX = (1 << 24) - 1;
+static constexpr uint32_t UNORM16_DEPTH_MAX = (1 << 16) - 1;
+
+/*  Size of a single depth in bytes. */
+inline int get_depth_format_size(DepthFormat format) {
+    switch (format) {
+        case DepthFormat::DOUBLE: {
+            return 8;
+        }
+
+        case DepthFormat::UNORM16: {
+            return 2;
+        }
+
+        default: {
+            return 4;
+        }
+    }
+}
+
+/*  Direct view of a window's render and depth buffers. Pixel (x, y) of the
+    render buffer is colour[y * colour_stride + x] and its depth (the inverse
+    depth 1 / z, where 0 is infinitely far away) is element y * depth_stride
+    + x of depth, in depth_format (see DepthFormat). Strides are given in
+    elements rather than bytes. Colour pixels are in the native format of
+    the window - each 8 bit channel is stored at the bit offset given by the
+    corresponding shift.
+
+    This lets the rasteriser write pixels directly, rather than through a
+    virtual call (or three) per pixel. */
+struct FramebufferView {
+    int width;
+    int height;
+
+    uint32_t* colour;
+    int colour_stride;
+
+    void* depth;
+    int depth_stride;
+    DepthFormat depth_format;
+    double depth_scale;
+
+    uint8_t red_shift;
+    uint8_t green_shift;
+    uint8_t blue_shift;
+
+    uint32_t* colour_row(int y) const {
+        return this->colour + y * this->colour_stride;
+    }
+
+    void* depth_pixel(int x, int y) const {
+        return (uint8_t*) this->depth + (y * this->depth_stride + x) *
+            get_depth_format_size(this->depth_format);
+    }
+
+    uint32_t pack_colour(uint8_t red, uint8_t green, uint8_t blue) const {
+        return (red << this->red_shift) | (green << this->green_shift) |
+            (blue << this->blue_shift);
+    }
+};
+
+/*  Bit offsets of the 8 bit channels of a window's colour pixels, as in
+    FramebufferView. */
+struct PixelFormat {
+    uint8_t red_shift;
+    uint8_t green_shift;
+    uint8_t blue_shift;
+};
+
+/*  Counters describing the presentation of frames by a render window:
+        - presented_frames is the number of frames shown so far.
+        - dropped_frames is the number of frames passed to
+          display_render_buffer that were replaced by a newer frame before
+          they could be shown.
+        - queued_frames is the number of frames currently waiting to be
+          shown. */
+struct PresentStats {
+    unsigned long long presented_frames;
+    unsigned long long dropped_frames;
+    int queued_frames;
+};
+
 class RenderWindow {
     public:
+        virtual ~RenderWindow() = default;
+
         virtual bool handle_events() = 0;
 
         virtual void close_window() = 0;
@@ -77,12 +185,81 @@ class RenderWindow {
         virtual double read_depth_buffer(int x, int y) = 0;
 
         virtual void write_depth_buffer(int x, int y, double val) = 0;
+
+        /*  The largest inverse depth the UNORM depth formats can hold -
+            nearer depths are clamped to it. The Renderer sets this to the
+            inverse of the distance to its view plane. */
+        virtual void set_max_inverse_depth(double max_inverse_depth) = 0;
         
         virtual int get_width() = 0;
 
         virtual int get_height() = 0;
 
+        /*  The formats of the render and depth buffers, which (unlike
+            lock_framebuffer) can be found without waiting for the buffers
+            to be free. */
+        virtual PixelFormat get_pixel_format() = 0;
+
+        virtual DepthFormat get_depth_format() = 0;
+
         virtual KeyState get_key(KeySymbol key_id) = 0;
+
+        /*  Obtain a view of the render and depth buffers for direct access.
+            The view remains valid until the matching call to
+            unlock_framebuffer, during which the buffers must not be cleared,
+            displayed or resized. Locking is cheap, so callers should lock
+            once per frame (or per tile) rather than per pixel. The per-pixel
+            accessors above may still be used while locked. */
+        virtual FramebufferView lock_framebuffer() = 0;
+
+        virtual void unlock_framebuffer() = 0;
+
+        /*  The number of times the depth buffer may have been written, other
+            than by clearing it - i.e. calls to write_depth_buffer and
+            lock_framebuffer. The Renderer compares this with the count just
+            after its own last lock, to tell whether anything else has written
+            depths since its last frame. */
+        virtual unsigned long long get_depth_write_count() = 0;
+
+        /*  Index of the back buffer currently being drawn to, in
+            [0, buffer_count) (see RenderWindowOptions). This changes with
+            each call to display_render_buffer when there is more than one
+            buffer. */
+        virtual int get_back_buffer_index() = 0;
+
+        virtual PresentStats get_present_stats() = 0;
+};
+
+/*  Kinds of RenderWindow that can be requested from make_render_window:
+        - NATIVE opens an on-screen window on the platform's display server.
+        - HEADLESS renders into memory only, and works without a display. */
+enum class RenderWindowType {
+    NATIVE,
+    HEADLESS
+};
+
+/*  How frames are handed to the display when a window has more than one
+    colour buffer:
+        - FIFO shows every frame in order. If all back buffers are waiting to
+          be shown, display_render_buffer blocks until one is free.
+        - MAILBOX never blocks. If no back buffer is free, the oldest frame
+          still waiting to be shown is dropped and its buffer reused. */
+enum class PresentMode {
+    FIFO,
+    MAILBOX
+};
+
+/*  buffer_count is the number of colour buffers. With a single buffer,
+    display_render_buffer presents the frame before returning. With two
+    (double buffering) or more, frames are presented asynchronously, so the
+    next frame can be drawn into another buffer in the meantime. Headless
+    windows present nothing, so always have a single buffer. depth_format is
+    the format of the depth buffer. */
+struct RenderWindowOptions {
+    RenderWindowType type = RenderWindowType::NATIVE;
+    int buffer_count = 1;
+    PresentMode present_mode = PresentMode::FIFO;
+    DepthFormat depth_format = DepthFormat::DOUBLE;
 };
 
 /*  RenderWindow factory method. This constructs some instance of one of the
@@ -96,6 +273,10 @@ class RenderWindow {
     to wrap it in a smart pointer to avoid forgetting to deallocate it. */
 RenderWindow* make_render_window(std::string title, int width, int height);
 
+/*  As above, but constructs the kind of RenderWindow given by options. */
+RenderWindow* make_render_window(std::string title, int width, int height,
+    const RenderWindowOptions& options);
+
 }
 
 #endif
\ No newline at end of file